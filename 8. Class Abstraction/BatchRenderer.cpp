@@ -0,0 +1,188 @@
+#include "BatchRenderer.hpp"
+#include "MeshArena.hpp"
+#include "GLState.hpp"
+
+DrawList::DrawList()
+{
+    lastGeometry = nullptr;
+    lastFirstIndex = 0;
+}
+
+void DrawList::Begin()
+{
+    commands.clear();
+    commandArenas.clear();
+    models.clear();
+    lastGeometry = nullptr;
+    lastFirstIndex = 0;
+}
+
+void DrawList::Add(Mesh *mesh, const glm::mat4 &model, unsigned int lod)
+{
+    Geometry *geometry = mesh->GetGeometry();
+    if(!geometry)
+        return;
+
+    const MeshLOD &range = mesh->GetLOD(lod);
+    if(geometry == lastGeometry && range.firstIndex == lastFirstIndex)
+        ++commands.back().instanceCount;
+    else {
+        DrawElementsIndirectCommand command;
+        command.count = range.indexCount;
+        command.instanceCount = 1;
+        command.firstIndex = geometry->firstIndex + range.firstIndex;
+        command.baseVertex = geometry->baseVertex;
+        command.baseInstance = models.size();
+        commands.push_back(command);
+        commandArenas.push_back(geometry->arena);
+        lastGeometry = geometry;
+        lastFirstIndex = range.firstIndex;
+    }
+    models.push_back(model);
+}
+
+void DrawList::Append(const DrawList &list)
+{
+    // The appended matrices move up by the ones already here
+    unsigned int offset = models.size();
+    size_t first = commands.size();
+    commands.insert(commands.end(), list.commands.begin(), list.commands.end());
+    for(size_t i = first; i < commands.size(); ++i)
+        commands[i].baseInstance += offset;
+    commandArenas.insert(commandArenas.end(), list.commandArenas.begin(), list.commandArenas.end());
+    models.insert(models.end(), list.models.begin(), list.models.end());
+
+    // A later Add may extend the last appended command
+    if(!list.commands.empty()) {
+        lastGeometry = list.lastGeometry;
+        lastFirstIndex = list.lastFirstIndex;
+    }
+}
+
+BatchRenderer::BatchRenderer()
+{
+    drawCount = 0;
+    commandCount = 0;
+
+    indirectBuffer = 0;
+    modelBuffer = 0;
+    drawIndexBuffer = 0;
+    indirectCapacity = 0;
+    modelCapacity = 0;
+    drawIndexCapacity = 0;
+    submits = 0;
+}
+
+void BatchRenderer::Begin()
+{
+    list.Begin();
+}
+
+void BatchRenderer::Add(Mesh *mesh, const glm::mat4 &model, unsigned int lod)
+{
+    list.Add(mesh, model, lod);
+}
+
+void BatchRenderer::Upload(GLenum target, GLuint &buffer, size_t &capacity, size_t size, const void *data)
+{
+    if(buffer == 0)
+        glGenBuffers(1, &buffer);
+    GLState::Get().BindBuffer(target, buffer);
+
+    // Orphan the old storage so this frame does not wait on the last one
+    if(size > capacity)
+        capacity = size;
+    glBufferData(target, capacity, NULL, GL_STREAM_DRAW);
+    glBufferSubData(target, 0, size, data);
+}
+
+void BatchRenderer::Submit()
+{
+    Submit(list);
+}
+
+void BatchRenderer::Submit(const DrawList &list)
+{
+    const std::vector<DrawElementsIndirectCommand> &commands = list.commands;
+    const std::vector<MeshArena *> &commandArenas = list.commandArenas;
+    const std::vector<glm::mat4> &models = list.models;
+    drawCount = models.size();
+    commandCount = commands.size();
+    submits = 0;
+    if(commands.empty())
+        return;
+
+    // The draw indices never change, so that buffer only grows
+    if(models.size() * sizeof(GLuint) > drawIndexCapacity) {
+        std::vector<GLuint> drawIndices(models.size());
+        for(size_t i = 0; i < drawIndices.size(); ++i)
+            drawIndices[i] = i;
+
+        if(drawIndexBuffer == 0)
+            glGenBuffers(1, &drawIndexBuffer);
+        GLState::Get().BindBuffer(GL_ARRAY_BUFFER, drawIndexBuffer);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(GLuint) * drawIndices.size(), drawIndices.data(), GL_STATIC_DRAW);
+        drawIndexCapacity = sizeof(GLuint) * drawIndices.size();
+    }
+
+    Upload(GL_SHADER_STORAGE_BUFFER, modelBuffer, modelCapacity, sizeof(glm::mat4) * models.size(), models.data());
+    GLState::Get().BindBufferBase(GL_SHADER_STORAGE_BUFFER, BATCH_MODEL_BINDING, modelBuffer);
+    Upload(GL_DRAW_INDIRECT_BUFFER, indirectBuffer, indirectCapacity,
+            sizeof(DrawElementsIndirectCommand) * commands.size(), commands.data());
+
+    // Each arena has its own VAO and index type; draw order is kept
+    for(size_t first = 0; first < commands.size();) {
+        MeshArena *arena = commandArenas[first];
+        size_t last = first + 1;
+        while(last < commands.size() && commandArenas[last] == arena)
+            ++last;
+
+        arena->Bind();
+        glBindVertexBuffer(ARENA_DRAW_ID_BINDING, drawIndexBuffer, 0, sizeof(GLuint));
+        glEnableVertexAttribArray(ARENA_DRAW_ID_LOCATION);
+
+        glMultiDrawElementsIndirect(GL_TRIANGLES, arena->GetIndexType(),
+                (void *)(first * sizeof(DrawElementsIndirectCommand)), last - first, 0);
+
+        glDisableVertexAttribArray(ARENA_DRAW_ID_LOCATION);
+        glBindVertexBuffer(ARENA_DRAW_ID_BINDING, 0, 0, sizeof(GLuint));
+        ++submits;
+        first = last;
+    }
+}
+
+unsigned int BatchRenderer::GetDrawCount()
+{
+    return drawCount;
+}
+
+unsigned int BatchRenderer::GetCommandCount()
+{
+    return commandCount;
+}
+
+unsigned int BatchRenderer::GetSubmitCount()
+{
+    return submits;
+}
+
+void BatchRenderer::ClearBatch()
+{
+    GLuint *buffers[] = {&indirectBuffer, &modelBuffer, &drawIndexBuffer};
+    for(int i = 0; i < 3; ++i) {
+        if(*buffers[i] != 0) {
+            GLState::Get().DeleteBuffer(*buffers[i]);
+            *buffers[i] = 0;
+        }
+    }
+    indirectCapacity = 0;
+    modelCapacity = 0;
+    drawIndexCapacity = 0;
+
+    Begin();
+}
+
+BatchRenderer::~BatchRenderer()
+{
+    ClearBatch();
+}
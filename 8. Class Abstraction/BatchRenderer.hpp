@@ -0,0 +1,87 @@
+#ifndef _BATCH_RENDERER_H_
+#define _BATCH_RENDERER_H_
+
+#include <vector>
+
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+
+#include "Mesh.hpp"
+
+// Shader storage binding of the per-draw model matrices
+#define BATCH_MODEL_BINDING 0
+
+// Layout glMultiDrawElementsIndirect reads from GL_DRAW_INDIRECT_BUFFER
+class DrawElementsIndirectCommand {
+    public:
+        GLuint count, instanceCount, firstIndex;
+        GLint baseVertex;
+        GLuint baseInstance;
+};
+
+// The draws of a frame as BatchRenderer submits them: indirect commands,
+// the arena each one draws from and the model matrices, with consecutive
+// draws of the same geometry sharing one command. Recording makes no GL
+// calls, so lists can be built on job threads and joined with Append on
+// the GL thread.
+class DrawList {
+    private:
+        Geometry *lastGeometry;
+        unsigned int lastFirstIndex;
+
+    public:
+        std::vector<DrawElementsIndirectCommand> commands;
+        std::vector<MeshArena *> commandArenas;
+        std::vector<glm::mat4> models;
+
+        DrawList();
+
+        void Begin();
+        // Arena offsets are read here, so do not defragment before Submit
+        void Add(Mesh *mesh, const glm::mat4 &model, unsigned int lod = 0);
+        // Adds list's draws after this one's
+        void Append(const DrawList &list);
+};
+
+// Submits a DrawList with a single glMultiDrawElementsIndirect over the
+// MeshArena. Model matrices go to a shader storage buffer; each command's
+// baseInstance is its first matrix, and an instanced attribute holding 0,
+// 1, 2, ... (location 5) turns that into the index the vertex shader
+// reads, so no GL 4.6 gl_DrawID is needed. Each run of commands in the
+// same arena (vertex format) is one multi-draw.
+class BatchRenderer {
+    private:
+        DrawList list;
+        unsigned int drawCount, commandCount;
+
+        GLuint indirectBuffer, modelBuffer, drawIndexBuffer;
+        size_t indirectCapacity, modelCapacity, drawIndexCapacity;
+        unsigned int submits;
+
+        void Upload(GLenum target, GLuint &buffer, size_t &capacity, size_t size, const void *data);
+
+    public:
+        BatchRenderer();
+
+        // Records into the renderer's own list
+        void Begin();
+        void Add(Mesh *mesh, const glm::mat4 &model, unsigned int lod = 0);
+        // Draws everything added since Begin with the current shader, which
+        // reads "layout(location = 5) in uint" and the Models buffer
+        void Submit();
+        // Draws a list recorded elsewhere, the same way
+        void Submit(const DrawList &list);
+
+        // Of the last list submitted
+        unsigned int GetDrawCount();
+        unsigned int GetCommandCount();
+        // Multi-draw calls issued by the last Submit
+        unsigned int GetSubmitCount();
+
+        void ClearBatch();
+
+        ~BatchRenderer();
+};
+
+#endif
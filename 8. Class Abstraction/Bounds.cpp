@@ -0,0 +1,72 @@
+#include "Bounds.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+// Large enough to contain any scene, small enough that plane tests on it
+// stay finite
+#define UNBOUNDED_EXTENT 1e30f
+
+Bounds::Bounds()
+{
+    center = glm::vec3(0.0f);
+    extents = glm::vec3(UNBOUNDED_EXTENT);
+    radius = UNBOUNDED_EXTENT;
+}
+
+bool Bounds::FromVertices(const VertexLayout &layout, const void *vertexData, unsigned int vertexCount)
+{
+    *this = Bounds();
+    if(vertexCount == 0)
+        return false;
+
+    const unsigned char *bytes = (const unsigned char *)vertexData;
+    glm::vec3 low(UNBOUNDED_EXTENT), high(-UNBOUNDED_EXTENT);
+    for(unsigned int v = 0; v < vertexCount; ++v) {
+        GLfloat position[3];
+        if(!layout.ReadPosition(bytes + (size_t)layout.stride * v, position))
+            return false;
+        glm::vec3 p(position[0], position[1], position[2]);
+        low = glm::min(low, p);
+        high = glm::max(high, p);
+    }
+    center = (low + high) * 0.5f;
+    extents = (high - low) * 0.5f;
+
+    // The box's half diagonal is an upper bound; the farthest vertex is
+    // usually much closer
+    float farthest = 0;
+    for(unsigned int v = 0; v < vertexCount; ++v) {
+        GLfloat position[3];
+        layout.ReadPosition(bytes + (size_t)layout.stride * v, position);
+        farthest = std::max(farthest, glm::length(glm::vec3(position[0], position[1], position[2]) - center));
+    }
+    radius = farthest;
+    return true;
+}
+
+Bounds Bounds::Transform(const glm::mat4 &model) const
+{
+    if(!IsBounded())
+        return *this;
+
+    // Each world axis extent is the sum of the absolute contributions of
+    // the local axes (Arvo)
+    Bounds world;
+    glm::vec4 transformed = model * glm::vec4(center, 1.0f);
+    world.center = glm::vec3(transformed.x, transformed.y, transformed.z);
+    float scale = 0;
+    for(int row = 0; row < 3; ++row) {
+        world.extents[row] = std::fabs(model[0][row]) * extents.x + std::fabs(model[1][row]) * extents.y +
+            std::fabs(model[2][row]) * extents.z;
+    }
+    for(int column = 0; column < 3; ++column)
+        scale = std::max(scale, glm::length(glm::vec3(model[column][0], model[column][1], model[column][2])));
+    world.radius = radius * scale;
+    return world;
+}
+
+bool Bounds::IsBounded() const
+{
+    return radius < UNBOUNDED_EXTENT;
+}
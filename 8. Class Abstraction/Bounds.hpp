@@ -0,0 +1,29 @@
+#ifndef _BOUNDS_H_
+#define _BOUNDS_H_
+
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+
+#include "VertexLayout.hpp"
+
+// Axis-aligned box (center and half extents) and the sphere around the same
+// center that holds every vertex
+class Bounds {
+    public:
+        glm::vec3 center, extents;
+        float radius;
+
+        // Unbounded, so it is never culled
+        Bounds();
+
+        // False, leaving the bounds unbounded, if the layout has no float
+        // or half-float position
+        bool FromVertices(const VertexLayout &layout, const void *vertexData, unsigned int vertexCount);
+        // Box around the transformed box, and the sphere scaled by the
+        // largest axis scale
+        Bounds Transform(const glm::mat4 &model) const;
+        bool IsBounded() const;
+};
+
+#endif
@@ -0,0 +1,305 @@
+#include "Context.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+
+Context::Context()
+{
+    width = 0;
+    height = 0;
+    window = nullptr;
+
+    headless = false;
+    frame = 0;
+    frameLimit = 0;
+    lastFrameEnd = std::chrono::steady_clock::now();
+    frameTime = HEADLESS_FRAME_TIME;
+#ifdef USE_OSMESA
+    osmesaContext = nullptr;
+#else
+    eglDisplay = EGL_NO_DISPLAY;
+    eglContext = EGL_NO_CONTEXT;
+#endif
+    FBO = 0;
+    colorRBO = 0;
+    depthRBO = 0;
+}
+
+bool Context::CreateWindowed(int width, int height, const char *title)
+{
+    this->width = width;
+    this->height = height;
+
+    if(glfwInit() != GLFW_TRUE) {
+        std::cout << "GLFW Init failed!!" << std::endl;
+        glfwTerminate();
+        return false;
+    }
+
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 5);
+    // Core Profile = No Backwards Compatibility
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+
+    window = glfwCreateWindow(width, height, title, NULL, NULL);
+    if (!window) {
+        std::cout << "GLFW window creation failed!" << std::endl;
+        glfwTerminate();
+        return false;
+    }
+
+    // Set context for GLEW to use
+    glfwMakeContextCurrent(window);
+
+    if(!InitGLEW()) {
+        Destroy();
+        return false;
+    }
+    return true;
+}
+
+bool Context::CreateHeadless(int width, int height, unsigned int frameLimit)
+{
+    this->width = width;
+    this->height = height;
+    this->frameLimit = frameLimit;
+    headless = true;
+
+#ifdef USE_OSMESA
+    const int attribs[] = {
+        OSMESA_FORMAT, OSMESA_RGBA,
+        OSMESA_DEPTH_BITS, 24,
+        OSMESA_PROFILE, OSMESA_CORE_PROFILE,
+        OSMESA_CONTEXT_MAJOR_VERSION, 4,
+        OSMESA_CONTEXT_MINOR_VERSION, 5,
+        0
+    };
+    osmesaContext = OSMesaCreateContextAttribs(attribs, NULL);
+    if(!osmesaContext) {
+        std::cout << "OSMesa context creation failed!" << std::endl;
+        return false;
+    }
+
+    // OSMesa needs a default buffer even though drawing goes to the FBO
+    osmesaBuffer.resize(width * height * 4);
+    if(!OSMesaMakeCurrent(osmesaContext, osmesaBuffer.data(), GL_UNSIGNED_BYTE, width, height)) {
+        std::cout << "OSMesa make current failed!" << std::endl;
+        Destroy();
+        return false;
+    }
+#else
+    // A surfaceless display needs no window system and no GPU; Mesa falls
+    // back to llvmpipe when there is no render node
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if(getPlatformDisplay)
+        eglDisplay = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+
+    if(eglDisplay == EGL_NO_DISPLAY || !eglInitialize(eglDisplay, NULL, NULL)) {
+        std::cout << "EGL initialisation failed!" << std::endl;
+        eglDisplay = EGL_NO_DISPLAY;
+        return false;
+    }
+
+    const EGLint attribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 4,
+        EGL_CONTEXT_MINOR_VERSION, 5,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+    eglBindAPI(EGL_OPENGL_API);
+    eglContext = eglCreateContext(eglDisplay, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, attribs);
+    if(eglContext == EGL_NO_CONTEXT || !eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, eglContext)) {
+        std::cout << "EGL context creation failed!" << std::endl;
+        Destroy();
+        return false;
+    }
+#endif
+
+    if(!InitGLEW() || !CreateFramebuffer()) {
+        Destroy();
+        return false;
+    }
+    return true;
+}
+
+bool Context::InitGLEW()
+{
+    // Allow modern extension features
+    glewExperimental = GL_TRUE;
+
+    // GLEW built for GLX reports a missing display once it has loaded the
+    // entry points; that is expected without a window system
+    GLenum result = glewInit();
+    if(result != GLEW_OK && !(headless && result == GLEW_ERROR_NO_GLX_DISPLAY)) {
+        std::cout << "GLEW initialisation failed!" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool Context::CreateFramebuffer()
+{
+    glGenRenderbuffers(1, &colorRBO);
+    glBindRenderbuffer(GL_RENDERBUFFER, colorRBO);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+
+    glGenRenderbuffers(1, &depthRBO);
+    glBindRenderbuffer(GL_RENDERBUFFER, depthRBO);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glGenFramebuffers(1, &FBO);
+    glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorRBO);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depthRBO);
+
+    if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        std::cout << "Offscreen framebuffer incomplete!" << std::endl;
+        return false;
+    }
+
+    // The FBO stays bound, so the render loop draws into it unchanged
+    glViewport(0, 0, width, height);
+    return true;
+}
+
+bool Context::ShouldClose()
+{
+    if(headless)
+        return frame >= frameLimit;
+
+    return glfwWindowShouldClose(window);
+}
+
+void Context::EndFrame()
+{
+    ++frame;
+
+    if(headless) {
+        glFlush();
+        return;
+    }
+
+    glfwSwapBuffers(window);
+    // Get + Handle user input events
+    glfwPollEvents();
+
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    frameTime = std::min(std::chrono::duration<double>(now - lastFrameEnd).count(), MAX_FRAME_TIME);
+    lastFrameEnd = now;
+}
+
+bool Context::IsHeadless()
+{
+    return headless;
+}
+
+double Context::GetFrameTime()
+{
+    return headless ? HEADLESS_FRAME_TIME : frameTime;
+}
+
+unsigned int Context::GetFrame()
+{
+    return frame;
+}
+
+int Context::GetWidth()
+{
+    return width;
+}
+
+int Context::GetHeight()
+{
+    return height;
+}
+
+std::vector<unsigned char> Context::ReadPixels()
+{
+    std::vector<unsigned char> pixels(width * height * 3);
+    std::vector<unsigned char> row(width * 3);
+
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+
+    // GL reads bottom-up
+    for(int y = 0; y < height / 2; ++y) {
+        unsigned char *top = &pixels[y * width * 3];
+        unsigned char *bottom = &pixels[(height - 1 - y) * width * 3];
+        std::copy(top, top + width * 3, row.begin());
+        std::copy(bottom, bottom + width * 3, top);
+        std::copy(row.begin(), row.end(), bottom);
+    }
+    return pixels;
+}
+
+uint64_t Context::Checksum(const std::vector<unsigned char> &pixels)
+{
+    // FNV-1a
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for(size_t i = 0; i < pixels.size(); ++i) {
+        hash ^= pixels[i];
+        hash *= 0x100000001B3ull;
+    }
+    return hash;
+}
+
+bool Context::SavePPM(const char *filePath, const std::vector<unsigned char> &pixels)
+{
+    std::ofstream file(filePath, std::ios::binary);
+    if(!file.is_open()) {
+        std::cout << "Can't write file " << filePath << std::endl;
+        return false;
+    }
+
+    file << "P6\n" << width << " " << height << "\n255\n";
+    file.write((const char *)pixels.data(), pixels.size());
+    return true;
+}
+
+void Context::Destroy()
+{
+    if(FBO != 0) {
+        glDeleteFramebuffers(1, &FBO);
+        FBO = 0;
+    }
+
+    if(colorRBO != 0) {
+        glDeleteRenderbuffers(1, &colorRBO);
+        colorRBO = 0;
+    }
+
+    if(depthRBO != 0) {
+        glDeleteRenderbuffers(1, &depthRBO);
+        depthRBO = 0;
+    }
+
+#ifdef USE_OSMESA
+    if(osmesaContext) {
+        OSMesaDestroyContext(osmesaContext);
+        osmesaContext = nullptr;
+    }
+#else
+    if(eglDisplay != EGL_NO_DISPLAY) {
+        eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if(eglContext != EGL_NO_CONTEXT)
+            eglDestroyContext(eglDisplay, eglContext);
+        eglTerminate(eglDisplay);
+        eglDisplay = EGL_NO_DISPLAY;
+        eglContext = EGL_NO_CONTEXT;
+    }
+#endif
+
+    if(window) {
+        glfwDestroyWindow(window);
+        glfwTerminate();
+        window = nullptr;
+    }
+}
+
+Context::~Context()
+{
+    Destroy();
+}
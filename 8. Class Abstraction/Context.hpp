@@ -0,0 +1,75 @@
+#ifndef _CONTEXT_H_
+#define _CONTEXT_H_
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+#ifdef USE_OSMESA
+#include <GL/osmesa.h>
+#else
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+// Seconds a headless frame advances time by, so runs are repeatable
+#define HEADLESS_FRAME_TIME (1.0 / 60)
+// Longest step a windowed frame reports, so a stall (a breakpoint, a
+// dragged window) does not jump animations ahead
+#define MAX_FRAME_TIME 0.25
+
+// Owns the GL context: either a GLFW window, or a headless context
+// (surfaceless EGL, or OSMesa when built with -DUSE_OSMESA) that renders
+// into an offscreen framebuffer for a fixed number of frames.
+class Context {
+    private:
+        int width, height;
+        GLFWwindow *window;
+
+        bool headless;
+        unsigned int frame, frameLimit;
+        std::chrono::steady_clock::time_point lastFrameEnd;
+        double frameTime;
+#ifdef USE_OSMESA
+        OSMesaContext osmesaContext;
+        std::vector<unsigned char> osmesaBuffer;
+#else
+        EGLDisplay eglDisplay;
+        EGLContext eglContext;
+#endif
+        GLuint FBO, colorRBO, depthRBO;
+
+        bool InitGLEW();
+        bool CreateFramebuffer();
+
+    public:
+        Context();
+
+        bool CreateWindowed(int width, int height, const char *title);
+        bool CreateHeadless(int width, int height, unsigned int frameLimit);
+
+        bool ShouldClose();
+        void EndFrame();
+
+        bool IsHeadless();
+        unsigned int GetFrame();
+        // Seconds to advance animation by this frame: the time between the
+        // last two EndFrames, or HEADLESS_FRAME_TIME when headless
+        double GetFrameTime();
+        int GetWidth();
+        int GetHeight();
+
+        // Colour buffer of the last frame, RGB rows top to bottom
+        std::vector<unsigned char> ReadPixels();
+        static uint64_t Checksum(const std::vector<unsigned char> &pixels);
+        bool SavePPM(const char *filePath, const std::vector<unsigned char> &pixels);
+
+        void Destroy();
+
+        ~Context();
+};
+
+#endif
@@ -0,0 +1,249 @@
+#include "DynamicMesh.hpp"
+#include "GLState.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+DynamicMesh::DynamicMesh()
+{
+    update = DYNAMIC_SUBDATA;
+    VAO = 0;
+    VBO = 0;
+    IBO = 0;
+    indexType = GL_UNSIGNED_INT;
+    vertexCount = 0;
+    indexCount = 0;
+    changed = false;
+    mapped = nullptr;
+    region = 0;
+    for(int i = 0; i < DYNAMIC_REGIONS; ++i)
+        fences[i] = 0;
+    uploadedBytes = 0;
+    uploadCalls = 0;
+    stalls = 0;
+}
+
+bool DynamicMesh::CreateMesh(const VertexLayout &layout, const void *vertexData, unsigned int vertexCount,
+        const unsigned int *indices, unsigned int indexCount, DynamicUpdate update)
+{
+    ClearMesh();
+    if(vertexCount == 0) {
+        std::cout << "A dynamic mesh needs at least one vertex" << std::endl;
+        return false;
+    }
+
+    this->layout = layout;
+    this->update = update;
+    this->vertexCount = vertexCount;
+    const unsigned char *bytes = (const unsigned char *)vertexData;
+    vertices.assign(bytes, bytes + (size_t)layout.stride * vertexCount);
+    size_t size = vertices.size();
+
+    glGenVertexArrays(1, &VAO);
+    GLState::Get().BindVertexArray(VAO);
+    layout.Apply(0);
+
+    glGenBuffers(1, &VBO);
+    GLState::Get().BindBuffer(GL_ARRAY_BUFFER, VBO);
+    if(update == DYNAMIC_PERSISTENT) {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_ARRAY_BUFFER, size * DYNAMIC_REGIONS, NULL, flags);
+        mapped = (unsigned char *)glMapBufferRange(GL_ARRAY_BUFFER, 0, size * DYNAMIC_REGIONS, flags);
+        if(!mapped) {
+            std::cout << "Dynamic mesh mapping failed!" << std::endl;
+            ClearMesh();
+            return false;
+        }
+        for(int i = 0; i < DYNAMIC_REGIONS; ++i)
+            memcpy(mapped + size * i, vertices.data(), size);
+    } else
+        glBufferData(GL_ARRAY_BUFFER, size, vertices.data(), update == DYNAMIC_ORPHAN ? GL_STREAM_DRAW : GL_DYNAMIC_DRAW);
+    glBindVertexBuffer(0, VBO, 0, layout.stride);
+
+    SetIndices(indices, indexCount);
+    return true;
+}
+
+void DynamicMesh::SetIndices(const unsigned int *indices, unsigned int indexCount)
+{
+    if(IBO == 0)
+        glGenBuffers(1, &IBO);
+    GLState::Get().BindVertexArray(VAO);
+    GLState::Get().BindBuffer(GL_ELEMENT_ARRAY_BUFFER, IBO);
+
+    // Respecifying the whole list orphans the old one rather than waiting
+    indexType = IndexTypeFor(vertexCount);
+    if(indexType == GL_UNSIGNED_SHORT) {
+        std::vector<GLushort> shortIndices(indices, indices + indexCount);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLushort) * indexCount, shortIndices.data(), GL_DYNAMIC_DRAW);
+    } else
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * indexCount, indices, GL_DYNAMIC_DRAW);
+    this->indexCount = indexCount;
+}
+
+unsigned char *DynamicMesh::GetVertices()
+{
+    return vertices.data();
+}
+
+void DynamicMesh::MarkDirty(unsigned int firstVertex, unsigned int count)
+{
+    if(count == 0)
+        return;
+
+    size_t first = (size_t)layout.stride * firstVertex, last = (size_t)layout.stride * (firstVertex + count);
+    int lists = update == DYNAMIC_PERSISTENT ? DYNAMIC_REGIONS : 1;
+    for(int i = 0; i < lists; ++i) {
+        // Ranges marked in order, the usual case, extend the last one
+        std::vector<std::pair<size_t, size_t>> &list = dirty[i];
+        if(!list.empty() && first >= list.back().first && first <= list.back().second)
+            list.back().second = std::max(list.back().second, last);
+        else
+            list.push_back(std::make_pair(first, last));
+    }
+    changed = true;
+}
+
+void DynamicMesh::UpdateVertices(unsigned int firstVertex, unsigned int count, const void *vertexData)
+{
+    memcpy(vertices.data() + (size_t)layout.stride * firstVertex, vertexData, (size_t)layout.stride * count);
+    MarkDirty(firstVertex, count);
+}
+
+template<typename Function>
+void DynamicMesh::ForEachRange(std::vector<std::pair<size_t, size_t>> &list, Function upload)
+{
+    std::sort(list.begin(), list.end());
+    size_t i = 0;
+    while(i < list.size()) {
+        size_t first = list[i].first, last = list[i].second;
+        for(++i; i < list.size() && list[i].first <= last + DYNAMIC_MERGE_BYTES; ++i)
+            last = std::max(last, list[i].second);
+        upload(first, last - first);
+    }
+    list.clear();
+}
+
+void DynamicMesh::Upload()
+{
+    uploadedBytes = 0;
+    uploadCalls = 0;
+    if(!changed)
+        return;
+    changed = false;
+
+    size_t size = vertices.size();
+    switch(update) {
+        case DYNAMIC_SUBDATA:
+            GLState::Get().BindBuffer(GL_ARRAY_BUFFER, VBO);
+            ForEachRange(dirty[0], [this](size_t offset, size_t bytes) {
+                glBufferSubData(GL_ARRAY_BUFFER, offset, bytes, vertices.data() + offset);
+                uploadedBytes += bytes;
+                ++uploadCalls;
+            });
+            break;
+
+        case DYNAMIC_ORPHAN:
+            // New storage for the whole buffer, so nothing old survives to be
+            // patched; the GPU keeps reading the orphaned storage until done
+            dirty[0].clear();
+            GLState::Get().BindBuffer(GL_ARRAY_BUFFER, VBO);
+            glBufferData(GL_ARRAY_BUFFER, size, vertices.data(), GL_STREAM_DRAW);
+            uploadedBytes = size;
+            uploadCalls = 1;
+            break;
+
+        case DYNAMIC_PERSISTENT: {
+            // Every draw so far read the current region; move to the next
+            fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            region = (region + 1) % DYNAMIC_REGIONS;
+
+            GLsync &fence = fences[region];
+            if(fence) {
+                // Poll first so only a real wait counts as a stall
+                GLenum status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+                if(status == GL_TIMEOUT_EXPIRED) {
+                    ++stalls;
+                    while(status == GL_TIMEOUT_EXPIRED)
+                        status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+                }
+                glDeleteSync(fence);
+                fence = 0;
+            }
+
+            unsigned char *target = mapped + size * region;
+            ForEachRange(dirty[region], [this, target](size_t offset, size_t bytes) {
+                memcpy(target + offset, vertices.data() + offset, bytes);
+                uploadedBytes += bytes;
+                ++uploadCalls;
+            });
+            GLState::Get().BindVertexArray(VAO);
+            glBindVertexBuffer(0, VBO, size * region, layout.stride);
+            break;
+        }
+    }
+}
+
+void DynamicMesh::RenderMesh()
+{
+    GLState::Get().BindVertexArray(VAO);
+    glDrawElements(GL_TRIANGLES, indexCount, indexType, (void *)0);
+}
+
+unsigned int DynamicMesh::GetVertexCount()
+{
+    return vertexCount;
+}
+
+size_t DynamicMesh::GetUploadedBytes()
+{
+    return uploadedBytes;
+}
+
+unsigned int DynamicMesh::GetUploadCalls()
+{
+    return uploadCalls;
+}
+
+uint64_t DynamicMesh::GetStallCount()
+{
+    return stalls;
+}
+
+void DynamicMesh::ClearMesh()
+{
+    for(int i = 0; i < DYNAMIC_REGIONS; ++i) {
+        if(fences[i]) {
+            glDeleteSync(fences[i]);
+            fences[i] = 0;
+        }
+        dirty[i].clear();
+    }
+
+    // Deleting a buffer unmaps it
+    if(VBO != 0) {
+        GLState::Get().DeleteBuffer(VBO);
+        VBO = 0;
+    }
+    if(IBO != 0) {
+        GLState::Get().DeleteBuffer(IBO);
+        IBO = 0;
+    }
+    if(VAO != 0) {
+        GLState::Get().DeleteVertexArray(VAO);
+        VAO = 0;
+    }
+    mapped = nullptr;
+    region = 0;
+    changed = false;
+
+    vertices.clear();
+    vertexCount = 0;
+    indexCount = 0;
+}
+
+DynamicMesh::~DynamicMesh()
+{
+    ClearMesh();
+}
@@ -0,0 +1,97 @@
+#ifndef _DYNAMIC_MESH_H_
+#define _DYNAMIC_MESH_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "VertexLayout.hpp"
+
+// Copies of the vertex buffer a persistently mapped mesh cycles through
+#define DYNAMIC_REGIONS 3
+
+// Dirty ranges closer than this many bytes are uploaded as one
+#define DYNAMIC_MERGE_BYTES 4096
+
+// How changed vertices reach the GPU
+enum DynamicUpdate {
+    // One GL_DYNAMIC_DRAW buffer; each dirty range is a glBufferSubData.
+    // The driver has to copy or wait when the GPU still reads the buffer
+    DYNAMIC_SUBDATA,
+    // The whole buffer is respecified with GL_STREAM_DRAW whenever anything
+    // changed, which orphans the storage the GPU may still be reading
+    DYNAMIC_ORPHAN,
+    // DYNAMIC_REGIONS persistently mapped copies of the vertices, used in
+    // turn and fenced like UniformRing. Each copy catches up on the ranges
+    // changed since it was last used, so only dirty ranges are written
+    DYNAMIC_PERSISTENT
+};
+
+// A mesh whose vertices change every frame, such as particles or a
+// deforming surface. Unlike Mesh it owns its buffers and VAO rather than a
+// range of a shared arena, so it is never shared or batched. The caller
+// writes a CPU copy of the vertices, marks what changed, and calls Upload
+// once a frame before drawing.
+class DynamicMesh {
+    private:
+        VertexLayout layout;
+        DynamicUpdate update;
+        GLuint VAO, VBO, IBO;
+        GLenum indexType;
+        unsigned int vertexCount, indexCount;
+
+        std::vector<unsigned char> vertices;
+        // Dirty byte ranges [first, last) of vertices not yet uploaded; each
+        // persistent region keeps its own list, the other modes use the first
+        std::vector<std::pair<size_t, size_t>> dirty[DYNAMIC_REGIONS];
+        bool changed;
+
+        unsigned char *mapped;
+        unsigned int region;
+        GLsync fences[DYNAMIC_REGIONS];
+
+        size_t uploadedBytes;
+        unsigned int uploadCalls;
+        uint64_t stalls;
+
+        // Sorts and merges list, then passes each range to upload
+        template<typename Function>
+        void ForEachRange(std::vector<std::pair<size_t, size_t>> &list, Function upload);
+
+    public:
+        DynamicMesh();
+
+        // vertexData holds vertexCount vertices packed with layout
+        bool CreateMesh(const VertexLayout &layout, const void *vertexData, unsigned int vertexCount,
+                const unsigned int *indices, unsigned int indexCount, DynamicUpdate update);
+        // Replaces the index list; indices must stay below the vertex count
+        void SetIndices(const unsigned int *indices, unsigned int indexCount);
+
+        // The CPU copy, packed with the layout; changes only reach the GPU
+        // for ranges passed to MarkDirty
+        unsigned char *GetVertices();
+        void MarkDirty(unsigned int firstVertex, unsigned int count);
+        // Copies count vertices into the CPU copy and marks them
+        void UpdateVertices(unsigned int firstVertex, unsigned int count, const void *vertexData);
+
+        // Sends everything marked since the last Upload; call once a frame
+        // before drawing
+        void Upload();
+        void RenderMesh();
+
+        unsigned int GetVertexCount();
+        // Bytes and GL upload calls of the last Upload
+        size_t GetUploadedBytes();
+        unsigned int GetUploadCalls();
+        // Persistent uploads that had to wait for the GPU
+        uint64_t GetStallCount();
+
+        void ClearMesh();
+
+        ~DynamicMesh();
+};
+
+#endif
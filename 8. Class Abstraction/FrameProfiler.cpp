@@ -0,0 +1,404 @@
+#include "FrameProfiler.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+
+FrameProfiler::FrameProfiler()
+{
+    enabled = false;
+    gpuTiming = false;
+    gpuStart = 0;
+    for(int i = 0; i < PROFILER_LATENCY; ++i) {
+        frames[i].frameQueries[0] = 0;
+        frames[i].frameQueries[1] = 0;
+        for(int q = 0; q < 2 * PROFILER_MAX_SCOPES; ++q)
+            frames[i].scopeQueries[q] = 0;
+        frames[i].gpuScopes = 0;
+        frames[i].pending = false;
+    }
+    frame = 0;
+    inFrame = false;
+    for(int bin = 0; bin < PROFILER_HISTOGRAM_BINS; ++bin) {
+        cpuHistogram[bin] = 0;
+        gpuHistogram[bin] = 0;
+    }
+    lateFrames = 0;
+}
+
+bool FrameProfiler::Create(bool gpuTiming)
+{
+    ClearProfiler();
+
+    this->gpuTiming = gpuTiming && GLEW_ARB_timer_query;
+    if(gpuTiming && !this->gpuTiming)
+        std::cout << "No timer queries; profiling the CPU only" << std::endl;
+
+    if(this->gpuTiming) {
+        for(int i = 0; i < PROFILER_LATENCY; ++i) {
+            glGenQueries(2, frames[i].frameQueries);
+            glGenQueries(2 * PROFILER_MAX_SCOPES, frames[i].scopeQueries);
+        }
+        // GPU timestamps are placed on the CPU timeline from this pair
+        glGetInteger64v(GL_TIMESTAMP, &gpuStart);
+    }
+    start = std::chrono::steady_clock::now();
+    enabled = true;
+    return true;
+}
+
+double FrameProfiler::Now()
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void FrameProfiler::BeginFrame()
+{
+    if(!enabled)
+        return;
+
+    PendingFrame &pending = frames[frame % PROFILER_LATENCY];
+    if(pending.pending)
+        Collect(pending, false);
+
+    pending.frame.index = frame;
+    pending.frame.cpuStart = Now();
+    pending.frame.cpuEnd = pending.frame.cpuStart;
+    pending.frame.gpuStart = -1;
+    pending.frame.gpuEnd = -1;
+    pending.frame.scopes.clear();
+    pending.scopeQueryPairs.clear();
+    pending.gpuScopes = 0;
+    if(gpuTiming)
+        glQueryCounter(pending.frameQueries[0], GL_TIMESTAMP);
+    inFrame = true;
+}
+
+void FrameProfiler::EndFrame()
+{
+    if(!inFrame)
+        return;
+
+    while(!openScopes.empty())
+        EndScope();
+
+    PendingFrame &pending = frames[frame % PROFILER_LATENCY];
+    if(gpuTiming)
+        glQueryCounter(pending.frameQueries[1], GL_TIMESTAMP);
+    pending.frame.cpuEnd = Now();
+    pending.pending = true;
+    inFrame = false;
+    ++frame;
+}
+
+void FrameProfiler::BeginScope(const char *name)
+{
+    if(!inFrame)
+        return;
+
+    PendingFrame &pending = frames[frame % PROFILER_LATENCY];
+    ProfiledScope scope;
+    scope.name = name;
+    scope.depth = openScopes.size();
+    scope.cpuStart = Now();
+    scope.cpuEnd = scope.cpuStart;
+    scope.gpuStart = -1;
+    scope.gpuEnd = -1;
+
+    int pair = -1;
+    if(gpuTiming && pending.gpuScopes < PROFILER_MAX_SCOPES) {
+        pair = pending.gpuScopes++;
+        glQueryCounter(pending.scopeQueries[2 * pair], GL_TIMESTAMP);
+    }
+    openScopes.push_back(pending.frame.scopes.size());
+    pending.frame.scopes.push_back(scope);
+    pending.scopeQueryPairs.push_back(pair);
+}
+
+void FrameProfiler::EndScope()
+{
+    if(!inFrame || openScopes.empty())
+        return;
+
+    PendingFrame &pending = frames[frame % PROFILER_LATENCY];
+    unsigned int index = openScopes.back();
+    openScopes.pop_back();
+    int pair = pending.scopeQueryPairs[index];
+    if(pair >= 0)
+        glQueryCounter(pending.scopeQueries[2 * pair + 1], GL_TIMESTAMP);
+    pending.frame.scopes[index].cpuEnd = Now();
+}
+
+void FrameProfiler::Collect(PendingFrame &pending, bool wait)
+{
+    pending.pending = false;
+    ProfiledFrame &result = pending.frame;
+
+    // The frame's last timestamp comes after all the others, and the GPU
+    // completes commands in order, so it is the one to poll
+    GLuint available = wait;
+    if(gpuTiming && !wait)
+        glGetQueryObjectuiv(pending.frameQueries[1], GL_QUERY_RESULT_AVAILABLE, &available);
+    if(gpuTiming && !available)
+        ++lateFrames;
+
+    if(gpuTiming && available) {
+        ReadTimestamps(pending.frameQueries, result.gpuStart, result.gpuEnd);
+        for(size_t i = 0; i < result.scopes.size(); ++i) {
+            int pair = pending.scopeQueryPairs[i];
+            if(pair >= 0)
+                ReadTimestamps(&pending.scopeQueries[2 * pair], result.scopes[i].gpuStart, result.scopes[i].gpuEnd);
+        }
+    }
+
+    int cpuBin = std::min((int)((result.cpuEnd - result.cpuStart) / PROFILER_BIN_MS), PROFILER_HISTOGRAM_BINS - 1);
+    ++cpuHistogram[cpuBin];
+    if(result.gpuStart >= 0) {
+        int gpuBin = std::min((int)((result.gpuEnd - result.gpuStart) / PROFILER_BIN_MS), PROFILER_HISTOGRAM_BINS - 1);
+        ++gpuHistogram[gpuBin];
+    }
+
+    if(history.size() < PROFILER_MAX_FRAMES)
+        history.push_back(result);
+}
+
+void FrameProfiler::ReadTimestamps(const GLuint *queries, double &startMs, double &endMs)
+{
+    GLuint64 timestamps[2] = {0, 0};
+    glGetQueryObjectui64v(queries[0], GL_QUERY_RESULT, &timestamps[0]);
+    glGetQueryObjectui64v(queries[1], GL_QUERY_RESULT, &timestamps[1]);
+    startMs = ((GLint64)timestamps[0] - gpuStart) / 1e6;
+    endMs = ((GLint64)timestamps[1] - gpuStart) / 1e6;
+}
+
+void FrameProfiler::Flush()
+{
+    // Oldest first, so the history stays in frame order
+    unsigned int first = frame >= PROFILER_LATENCY ? frame - PROFILER_LATENCY : 0;
+    for(unsigned int i = first; i < frame; ++i) {
+        PendingFrame &pending = frames[i % PROFILER_LATENCY];
+        if(pending.pending)
+            Collect(pending, true);
+    }
+}
+
+const std::vector<ProfiledFrame> &FrameProfiler::GetFrames()
+{
+    return history;
+}
+
+unsigned long long FrameProfiler::GetLateFrameCount()
+{
+    return lateFrames;
+}
+
+double FrameProfiler::Percentile(bool gpu, double fraction)
+{
+    std::vector<double> times;
+    for(size_t i = 0; i < history.size(); ++i) {
+        if(!gpu)
+            times.push_back(history[i].cpuEnd - history[i].cpuStart);
+        else if(history[i].gpuStart >= 0)
+            times.push_back(history[i].gpuEnd - history[i].gpuStart);
+    }
+    if(times.empty())
+        return -1;
+
+    size_t rank = std::min(times.size() - 1, (size_t)(fraction * times.size()));
+    std::nth_element(times.begin(), times.begin() + rank, times.end());
+    return times[rank];
+}
+
+void FrameProfiler::PrintSummary()
+{
+    printf("%zu frames profiled, %llu GPU results late\n", history.size(), lateFrames);
+    for(int gpu = 0; gpu < (gpuTiming ? 2 : 1); ++gpu) {
+        printf("%s frame   p50 %8.3f ms   p95 %8.3f ms   p99 %8.3f ms   max %8.3f ms\n", gpu ? "GPU" : "CPU",
+                Percentile(gpu, 0.5), Percentile(gpu, 0.95), Percentile(gpu, 0.99), Percentile(gpu, 1.0));
+    }
+
+    // Mean time of each scope name per frame it appears in; the GPU mean
+    // only over the frames its GPU time was measured in
+    std::map<std::string, double> cpuTotals, gpuTotals;
+    std::map<std::string, unsigned int> counts, gpuCounts;
+    for(size_t f = 0; f < history.size(); ++f) {
+        for(size_t s = 0; s < history[f].scopes.size(); ++s) {
+            const ProfiledScope &scope = history[f].scopes[s];
+            cpuTotals[scope.name] += scope.cpuEnd - scope.cpuStart;
+            if(scope.gpuStart >= 0) {
+                gpuTotals[scope.name] += scope.gpuEnd - scope.gpuStart;
+                ++gpuCounts[scope.name];
+            }
+            ++counts[scope.name];
+        }
+    }
+    for(auto it = counts.begin(); it != counts.end(); ++it) {
+        printf("  %-24s CPU %8.3f ms", it->first.c_str(), cpuTotals[it->first] / it->second);
+        unsigned int measured = gpuCounts[it->first];
+        if(measured > 0)
+            printf("   GPU %8.3f ms\n", gpuTotals[it->first] / measured);
+        else
+            printf("   GPU %8s ms\n", "-");
+    }
+
+    for(int gpu = 0; gpu < (gpuTiming ? 2 : 1); ++gpu) {
+        unsigned long long *histogram = gpu ? gpuHistogram : cpuHistogram;
+        unsigned long long most = *std::max_element(histogram, histogram + PROFILER_HISTOGRAM_BINS);
+        printf("%s frame time histogram\n", gpu ? "GPU" : "CPU");
+        for(int bin = 0; bin < PROFILER_HISTOGRAM_BINS; ++bin) {
+            if(histogram[bin] == 0)
+                continue;
+            int width = (int)(40 * histogram[bin] / most);
+            printf("  %6.1f ms%s %-40s %llu\n", bin * PROFILER_BIN_MS, bin == PROFILER_HISTOGRAM_BINS - 1 ? "+" : " ",
+                    std::string(std::max(width, 1), '#').c_str(), histogram[bin]);
+        }
+    }
+}
+
+static std::string Escape(const std::string &text)
+{
+    std::string escaped;
+    for(size_t i = 0; i < text.size(); ++i) {
+        if(text[i] == '"' || text[i] == '\\')
+            escaped += '\\';
+        if((unsigned char)text[i] >= 0x20)
+            escaped += text[i];
+    }
+    return escaped;
+}
+
+bool FrameProfiler::SaveJSON(const std::string &path)
+{
+    std::ofstream file(path);
+    if(!file.is_open()) {
+        std::cout << "Can't write profile " << path << std::endl;
+        return false;
+    }
+
+    // Unmeasured times are null
+    auto writeTime = [&file](bool measured, double ms) {
+        if(measured)
+            file << ms;
+        else
+            file << "null";
+    };
+
+    file << std::fixed << std::setprecision(4);
+    file << "{\n  \"binMs\": " << PROFILER_BIN_MS << ",\n  \"lateFrames\": " << lateFrames << ",\n";
+    for(int gpu = 0; gpu < 2; ++gpu) {
+        unsigned long long *histogram = gpu ? gpuHistogram : cpuHistogram;
+        const char *names[] = {"p50", "p95", "p99"};
+        double fractions[] = {0.5, 0.95, 0.99};
+        file << "  \"" << (gpu ? "gpu" : "cpu") << "\": {";
+        for(int p = 0; p < 3; ++p) {
+            double ms = Percentile(gpu, fractions[p]);
+            file << "\"" << names[p] << "\": ";
+            writeTime(ms >= 0, ms);
+            file << ", ";
+        }
+        file << "\"histogram\": [";
+        for(int bin = 0; bin < PROFILER_HISTOGRAM_BINS; ++bin)
+            file << (bin ? ", " : "") << histogram[bin];
+        file << "]},\n";
+    }
+
+    file << "  \"frames\": [";
+    for(size_t f = 0; f < history.size(); ++f) {
+        const ProfiledFrame &frame = history[f];
+        file << (f ? ",\n" : "\n") << "    {\"frame\": " << frame.index << ", \"cpuMs\": " << frame.cpuEnd - frame.cpuStart <<
+            ", \"gpuMs\": ";
+        writeTime(frame.gpuStart >= 0, frame.gpuEnd - frame.gpuStart);
+        file << ", \"scopes\": [";
+        for(size_t s = 0; s < frame.scopes.size(); ++s) {
+            const ProfiledScope &scope = frame.scopes[s];
+            file << (s ? ", " : "") << "{\"name\": \"" << Escape(scope.name) << "\", \"depth\": " << scope.depth <<
+                ", \"cpuMs\": " << scope.cpuEnd - scope.cpuStart << ", \"gpuMs\": ";
+            writeTime(scope.gpuStart >= 0, scope.gpuEnd - scope.gpuStart);
+            file << "}";
+        }
+        file << "]}";
+    }
+    file << "\n  ]\n}\n";
+    return (bool)file;
+}
+
+bool FrameProfiler::SaveChromeTrace(const std::string &path)
+{
+    std::ofstream file(path);
+    if(!file.is_open()) {
+        std::cout << "Can't write trace " << path << std::endl;
+        return false;
+    }
+
+    // Complete ("X") events in microseconds; thread 1 is the CPU, 2 the GPU
+    file << std::fixed << std::setprecision(3);
+    file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    file << "  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 1, \"args\": {\"name\": \"CPU\"}},\n";
+    file << "  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 2, \"args\": {\"name\": \"GPU\"}}";
+    auto event = [&file](const std::string &name, int thread, double startMs, double endMs) {
+        file << ",\n  {\"name\": \"" << Escape(name) << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << thread <<
+            ", \"ts\": " << startMs * 1000 << ", \"dur\": " << (endMs - startMs) * 1000 << "}";
+    };
+    for(size_t f = 0; f < history.size(); ++f) {
+        const ProfiledFrame &frame = history[f];
+        std::string name = "frame " + std::to_string(frame.index);
+        event(name, 1, frame.cpuStart, frame.cpuEnd);
+        if(frame.gpuStart >= 0)
+            event(name, 2, frame.gpuStart, frame.gpuEnd);
+        for(size_t s = 0; s < frame.scopes.size(); ++s) {
+            const ProfiledScope &scope = frame.scopes[s];
+            event(scope.name, 1, scope.cpuStart, scope.cpuEnd);
+            if(scope.gpuStart >= 0)
+                event(scope.name, 2, scope.gpuStart, scope.gpuEnd);
+        }
+    }
+    file << "\n]}\n";
+    return (bool)file;
+}
+
+void FrameProfiler::ClearProfiler()
+{
+    for(int i = 0; i < PROFILER_LATENCY; ++i) {
+        if(frames[i].frameQueries[0] != 0) {
+            glDeleteQueries(2, frames[i].frameQueries);
+            glDeleteQueries(2 * PROFILER_MAX_SCOPES, frames[i].scopeQueries);
+        }
+        frames[i].frameQueries[0] = 0;
+        frames[i].frameQueries[1] = 0;
+        for(int q = 0; q < 2 * PROFILER_MAX_SCOPES; ++q)
+            frames[i].scopeQueries[q] = 0;
+        frames[i].pending = false;
+    }
+    enabled = false;
+    gpuTiming = false;
+    frame = 0;
+    inFrame = false;
+    openScopes.clear();
+    history.clear();
+    for(int bin = 0; bin < PROFILER_HISTOGRAM_BINS; ++bin) {
+        cpuHistogram[bin] = 0;
+        gpuHistogram[bin] = 0;
+    }
+    lateFrames = 0;
+}
+
+FrameProfiler::~FrameProfiler()
+{
+    ClearProfiler();
+}
+
+ProfileScope::ProfileScope(FrameProfiler *profiler, const char *name)
+{
+    this->profiler = profiler;
+    if(profiler)
+        profiler->BeginScope(name);
+}
+
+ProfileScope::~ProfileScope()
+{
+    if(profiler)
+        profiler->EndScope();
+}
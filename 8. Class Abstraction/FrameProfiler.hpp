@@ -0,0 +1,125 @@
+#ifndef _FRAME_PROFILER_H_
+#define _FRAME_PROFILER_H_
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <GL/glew.h>
+
+// Frames between issuing a frame's GPU queries and reading them back; by
+// then the GPU has normally finished it, so reading never waits
+#define PROFILER_LATENCY 4
+
+// Scopes per frame that get GPU timestamps; later ones are CPU only
+#define PROFILER_MAX_SCOPES 32
+
+// Frames kept for SaveJSON and SaveChromeTrace; the histograms count all
+#define PROFILER_MAX_FRAMES 100000
+
+// Frame time histograms: bins of PROFILER_BIN_MS, the last one also
+// counting every longer frame
+#define PROFILER_HISTOGRAM_BINS 64
+#define PROFILER_BIN_MS 0.5
+
+// A timed scope; times are milliseconds since FrameProfiler::Create, on
+// the CPU clock. GPU times are -1 when they were not measured or their
+// queries were not ready in time
+class ProfiledScope {
+    public:
+        std::string name;
+        unsigned int depth;
+        double cpuStart, cpuEnd, gpuStart, gpuEnd;
+};
+
+class ProfiledFrame {
+    public:
+        unsigned int index;
+        double cpuStart, cpuEnd, gpuStart, gpuEnd;
+        std::vector<ProfiledScope> scopes;
+};
+
+// Measures frames and nested scopes within them on the CPU and, with
+// GL_TIMESTAMP queries, on the GPU. Queries sit in a ring of PROFILER_LATENCY frames
+// and are read when their slot comes round again, so the GL thread never
+// waits for the GPU; a frame whose queries are still not done is kept
+// with CPU times only and counted as late. Calls must come from the GL
+// thread. Results are a summary with percentiles and histograms, a JSON
+// file, or a Chrome trace (chrome://tracing, Perfetto) with the CPU and
+// the GPU as two threads. Timestamps are used rather than GL_TIME_ELAPSED
+// queries, which cannot nest.
+class FrameProfiler {
+    private:
+        class PendingFrame {
+            public:
+                ProfiledFrame frame;
+                // Start and end timestamp of the frame
+                GLuint frameQueries[2];
+                // Start and end timestamp of each GPU-timed scope
+                GLuint scopeQueries[2 * PROFILER_MAX_SCOPES];
+                // Pair of scopeQueries each scope uses, or -1
+                std::vector<int> scopeQueryPairs;
+                unsigned int gpuScopes;
+                bool pending;
+        };
+
+        bool enabled, gpuTiming;
+        std::chrono::steady_clock::time_point start;
+        GLint64 gpuStart;
+
+        PendingFrame frames[PROFILER_LATENCY];
+        unsigned int frame;
+        bool inFrame;
+        std::vector<unsigned int> openScopes;
+
+        std::vector<ProfiledFrame> history;
+        unsigned long long cpuHistogram[PROFILER_HISTOGRAM_BINS], gpuHistogram[PROFILER_HISTOGRAM_BINS];
+        unsigned long long lateFrames;
+
+        double Now();
+        void Collect(PendingFrame &pending, bool wait);
+        // Two timestamp queries, as milliseconds on the CPU timeline
+        void ReadTimestamps(const GLuint *queries, double &startMs, double &endMs);
+        double Percentile(bool gpu, double fraction);
+
+    public:
+        FrameProfiler();
+
+        // Until Create every call does nothing, so a render loop can be
+        // instrumented unconditionally. Without timer queries (or with
+        // gpuTiming off) only CPU times are measured
+        bool Create(bool gpuTiming = true);
+
+        void BeginFrame();
+        void EndFrame();
+        // Scopes nest, and must end in the frame they began in
+        void BeginScope(const char *name);
+        void EndScope();
+
+        // Waits for the frames still in the ring, for the final report
+        void Flush();
+
+        const std::vector<ProfiledFrame> &GetFrames();
+        unsigned long long GetLateFrameCount();
+
+        // Frame time percentiles and histograms, and the mean of each scope
+        void PrintSummary();
+        bool SaveJSON(const std::string &path);
+        bool SaveChromeTrace(const std::string &path);
+
+        void ClearProfiler();
+
+        ~FrameProfiler();
+};
+
+// Times the enclosing block; a null profiler does nothing
+class ProfileScope {
+    private:
+        FrameProfiler *profiler;
+
+    public:
+        ProfileScope(FrameProfiler *profiler, const char *name);
+        ~ProfileScope();
+};
+
+#endif
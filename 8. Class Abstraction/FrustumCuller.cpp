@@ -0,0 +1,226 @@
+#include "FrustumCuller.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <thread>
+
+#include <immintrin.h>
+
+FrustumCuller::FrustumCuller()
+{
+    for(int i = 0; i < 6; ++i)
+        planes[i] = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+    threads = 0;
+    threadsUsed = 0;
+    simd = true;
+    jobs = nullptr;
+}
+
+void FrustumCuller::SetFrustum(const glm::mat4 &viewProjection)
+{
+    ExtractPlanes(viewProjection, planes);
+}
+
+void FrustumCuller::ExtractPlanes(const glm::mat4 &viewProjection, glm::vec4 planes[6])
+{
+    // Gribb and Hartmann: each plane is the last row of the matrix plus or
+    // minus one of the others
+    glm::vec4 rows[4];
+    for(int row = 0; row < 4; ++row)
+        rows[row] = glm::vec4(viewProjection[0][row], viewProjection[1][row], viewProjection[2][row], viewProjection[3][row]);
+
+    for(int axis = 0; axis < 3; ++axis) {
+        planes[axis * 2] = rows[3] + rows[axis];
+        planes[axis * 2 + 1] = rows[3] - rows[axis];
+    }
+
+    // Normalised, so plane distances compare with box extents
+    for(int i = 0; i < 6; ++i) {
+        float length = glm::length(glm::vec3(planes[i].x, planes[i].y, planes[i].z));
+        if(length > 0)
+            planes[i] = planes[i] * (1.0f / length);
+    }
+}
+
+void FrustumCuller::SetThreadCount(unsigned int threads)
+{
+    this->threads = threads;
+}
+
+void FrustumCuller::SetJobSystem(JobSystem *jobs)
+{
+    this->jobs = jobs;
+}
+
+void FrustumCuller::SetSIMD(bool enabled)
+{
+    simd = enabled;
+}
+
+void FrustumCuller::Begin()
+{
+    centerX.clear();
+    centerY.clear();
+    centerZ.clear();
+    extentX.clear();
+    extentY.clear();
+    extentZ.clear();
+    visible.clear();
+}
+
+unsigned int FrustumCuller::Add(const Bounds &bounds, const glm::mat4 &model)
+{
+    Bounds world = bounds.Transform(model);
+    centerX.push_back(world.center.x);
+    centerY.push_back(world.center.y);
+    centerZ.push_back(world.center.z);
+    extentX.push_back(world.extents.x);
+    extentY.push_back(world.extents.y);
+    extentZ.push_back(world.extents.z);
+    return centerX.size() - 1;
+}
+
+// A box is outside a plane when even its corner farthest along the normal
+// is behind it: distance(center) + dot(|normal|, extents) < 0
+static bool BoxVisible(const glm::vec4 *planes, float cx, float cy, float cz, float ex, float ey, float ez)
+{
+    for(int i = 0; i < 6; ++i) {
+        const glm::vec4 &plane = planes[i];
+        float distance = plane.x * cx + plane.y * cy + plane.z * cz + plane.w;
+        float reach = std::fabs(plane.x) * ex + std::fabs(plane.y) * ey + std::fabs(plane.z) * ez;
+        if(distance + reach < 0)
+            return false;
+    }
+    return true;
+}
+
+__attribute__((target("avx")))
+static unsigned int CullAVX(const glm::vec4 *planes, const float *cx, const float *cy, const float *cz,
+        const float *ex, const float *ey, const float *ez, unsigned int first, unsigned int last,
+        std::vector<unsigned int> &output)
+{
+    __m256 zero = _mm256_setzero_ps();
+    unsigned int i = first;
+    for(; i + 8 <= last; i += 8) {
+        __m256 x = _mm256_loadu_ps(cx + i), y = _mm256_loadu_ps(cy + i), z = _mm256_loadu_ps(cz + i);
+        __m256 sx = _mm256_loadu_ps(ex + i), sy = _mm256_loadu_ps(ey + i), sz = _mm256_loadu_ps(ez + i);
+
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for(int p = 0; p < 6; ++p) {
+            const glm::vec4 &plane = planes[p];
+            __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(plane.x), x),
+                    _mm256_mul_ps(_mm256_set1_ps(plane.y), y)),
+                    _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(plane.z), z), _mm256_set1_ps(plane.w)));
+            __m256 reach = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(std::fabs(plane.x)), sx),
+                    _mm256_mul_ps(_mm256_set1_ps(std::fabs(plane.y)), sy)),
+                    _mm256_mul_ps(_mm256_set1_ps(std::fabs(plane.z)), sz));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(distance, reach), zero, _CMP_GE_OQ));
+        }
+
+        for(int mask = _mm256_movemask_ps(inside); mask; mask &= mask - 1)
+            output.push_back(i + __builtin_ctz(mask));
+    }
+    return i;
+}
+
+static unsigned int CullSSE(const glm::vec4 *planes, const float *cx, const float *cy, const float *cz,
+        const float *ex, const float *ey, const float *ez, unsigned int first, unsigned int last,
+        std::vector<unsigned int> &output)
+{
+    __m128 zero = _mm_setzero_ps();
+    unsigned int i = first;
+    for(; i + 4 <= last; i += 4) {
+        __m128 x = _mm_loadu_ps(cx + i), y = _mm_loadu_ps(cy + i), z = _mm_loadu_ps(cz + i);
+        __m128 sx = _mm_loadu_ps(ex + i), sy = _mm_loadu_ps(ey + i), sz = _mm_loadu_ps(ez + i);
+
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for(int p = 0; p < 6; ++p) {
+            const glm::vec4 &plane = planes[p];
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.x), x), _mm_mul_ps(_mm_set1_ps(plane.y), y)),
+                    _mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.z), z), _mm_set1_ps(plane.w)));
+            __m128 reach = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(std::fabs(plane.x)), sx),
+                    _mm_mul_ps(_mm_set1_ps(std::fabs(plane.y)), sy)), _mm_mul_ps(_mm_set1_ps(std::fabs(plane.z)), sz));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(distance, reach), zero));
+        }
+
+        for(int mask = _mm_movemask_ps(inside); mask; mask &= mask - 1)
+            output.push_back(i + __builtin_ctz(mask));
+    }
+    return i;
+}
+
+void FrustumCuller::CullRange(unsigned int first, unsigned int last, std::vector<unsigned int> &output)
+{
+    static const bool hasAVX = __builtin_cpu_supports("avx");
+
+    unsigned int i = first;
+    if(simd && hasAVX)
+        i = CullAVX(planes, centerX.data(), centerY.data(), centerZ.data(), extentX.data(), extentY.data(),
+                extentZ.data(), first, last, output);
+    else if(simd)
+        i = CullSSE(planes, centerX.data(), centerY.data(), centerZ.data(), extentX.data(), extentY.data(),
+                extentZ.data(), first, last, output);
+
+    // The tail, or everything on the scalar path
+    for(; i < last; ++i) {
+        if(BoxVisible(planes, centerX[i], centerY[i], centerZ[i], extentX[i], extentY[i], extentZ[i]))
+            output.push_back(i);
+    }
+}
+
+const std::vector<unsigned int> &FrustumCuller::Cull()
+{
+    unsigned int count = centerX.size();
+    unsigned int available = threads ? threads : jobs ? jobs->GetThreadCount() : std::max(1u, std::thread::hardware_concurrency());
+    threadsUsed = std::max(1u, std::min(available, count / CULL_OBJECTS_PER_THREAD));
+    visible.clear();
+
+    if(threadsUsed == 1) {
+        CullRange(0, count, visible);
+        return visible;
+    }
+
+    // Chunks are multiples of eight so only the last one has a scalar tail;
+    // the calling thread takes the first chunk
+    unsigned int chunk = (count / threadsUsed + 7) & ~7u;
+    std::vector<std::vector<unsigned int>> outputs(threadsUsed);
+    std::vector<std::thread> workers;
+    JobCounter counter;
+    for(unsigned int t = 1; t < threadsUsed; ++t) {
+        unsigned int first = std::min(count, t * chunk), last = t + 1 == threadsUsed ? count : std::min(count, (t + 1) * chunk);
+        if(jobs)
+            jobs->Run(counter, [this, first, last, &outputs, t]() { CullRange(first, last, outputs[t]); });
+        else
+            workers.emplace_back(&FrustumCuller::CullRange, this, first, last, std::ref(outputs[t]));
+    }
+    CullRange(0, std::min(count, chunk), visible);
+    if(jobs)
+        jobs->Wait(counter);
+    for(unsigned int t = 1; t < threadsUsed; ++t) {
+        if(!jobs)
+            workers[t - 1].join();
+        visible.insert(visible.end(), outputs[t].begin(), outputs[t].end());
+    }
+    return visible;
+}
+
+unsigned int FrustumCuller::GetTestedCount()
+{
+    return centerX.size();
+}
+
+unsigned int FrustumCuller::GetVisibleCount()
+{
+    return visible.size();
+}
+
+unsigned int FrustumCuller::GetCulledCount()
+{
+    return centerX.size() - visible.size();
+}
+
+unsigned int FrustumCuller::GetThreadsUsed()
+{
+    return threadsUsed;
+}
@@ -0,0 +1,60 @@
+#ifndef _FRUSTUM_CULLER_H_
+#define _FRUSTUM_CULLER_H_
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Bounds.hpp"
+#include "JobSystem.hpp"
+
+// Below this many objects per thread, splitting the work costs more than it
+// saves
+#define CULL_OBJECTS_PER_THREAD 16384
+
+// Tests world-space boxes against the six planes of a view frustum. Objects
+// are kept as structure-of-arrays so eight are tested per AVX iteration
+// (four per SSE one on CPUs without AVX, chosen at run time); large object
+// counts are split across threads, or across jobs of a JobSystem. Culling
+// is conservative: a box that straddles two planes outside a frustum
+// corner is kept.
+class FrustumCuller {
+    private:
+        glm::vec4 planes[6];
+        std::vector<float> centerX, centerY, centerZ, extentX, extentY, extentZ;
+        std::vector<unsigned int> visible;
+        unsigned int threads, threadsUsed;
+        bool simd;
+        JobSystem *jobs;
+
+        void CullRange(unsigned int first, unsigned int last, std::vector<unsigned int> &output);
+
+    public:
+        FrustumCuller();
+
+        // Planes of the clip volume of viewProjection, pointing inwards
+        void SetFrustum(const glm::mat4 &viewProjection);
+        // The planes SetFrustum uses, for culling elsewhere (GPUCuller)
+        static void ExtractPlanes(const glm::mat4 &viewProjection, glm::vec4 planes[6]);
+        // 0 uses every hardware thread
+        void SetThreadCount(unsigned int threads);
+        // Runs the chunks of a large Cull as jobs instead of on threads
+        // started for each call; nullptr goes back to threads
+        void SetJobSystem(JobSystem *jobs);
+        // Off forces the scalar path, for comparison
+        void SetSIMD(bool enabled);
+
+        void Begin();
+        // Returns the object's index, in the order added
+        unsigned int Add(const Bounds &bounds, const glm::mat4 &model);
+        // Indices of the objects inside or touching the frustum, ascending
+        const std::vector<unsigned int> &Cull();
+
+        unsigned int GetTestedCount();
+        unsigned int GetVisibleCount();
+        unsigned int GetCulledCount();
+        // Threads the last Cull ran on
+        unsigned int GetThreadsUsed();
+};
+
+#endif
@@ -0,0 +1,158 @@
+#include "GLState.hpp"
+
+#include <cstring>
+
+GLState::GLState()
+{
+    caching = true;
+    program = 0;
+    vertexArray = 0;
+    programKnown = false;
+    vertexArrayKnown = false;
+    issuedCalls = 0;
+    skippedCalls = 0;
+}
+
+GLState &GLState::Get()
+{
+    static GLState state;
+    return state;
+}
+
+bool GLState::Issue(bool redundant)
+{
+    if(caching && redundant) {
+        ++skippedCalls;
+        return false;
+    }
+    ++issuedCalls;
+    return true;
+}
+
+void GLState::UseProgram(GLuint program)
+{
+    if(!Issue(programKnown && this->program == program))
+        return;
+
+    glUseProgram(program);
+    this->program = program;
+    programKnown = true;
+}
+
+void GLState::BindVertexArray(GLuint vertexArray)
+{
+    if(!Issue(vertexArrayKnown && this->vertexArray == vertexArray))
+        return;
+
+    glBindVertexArray(vertexArray);
+    this->vertexArray = vertexArray;
+    vertexArrayKnown = true;
+}
+
+void GLState::BindBuffer(GLenum target, GLuint buffer)
+{
+    if(target == GL_ELEMENT_ARRAY_BUFFER) {
+        Issue(false);
+        glBindBuffer(target, buffer);
+        return;
+    }
+
+    auto it = buffers.find(target);
+    if(!Issue(it != buffers.end() && it->second == buffer))
+        return;
+
+    glBindBuffer(target, buffer);
+    buffers[target] = buffer;
+}
+
+void GLState::BindBufferBase(GLenum target, GLuint index, GLuint buffer)
+{
+    Issue(false);
+    glBindBufferBase(target, index, buffer);
+    buffers[target] = buffer;
+}
+
+void GLState::BindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+{
+    Issue(false);
+    glBindBufferRange(target, index, buffer, offset, size);
+    buffers[target] = buffer;
+}
+
+void GLState::UniformMatrix4fv(GLint location, const GLfloat *value)
+{
+    if(location < 0)
+        return;
+
+    // Uniforms live in the program object, so the cache is per program
+    uint64_t key = (uint64_t)program << 32 | (uint32_t)location;
+    auto it = matrices.find(key);
+    bool redundant = programKnown && it != matrices.end() && !memcmp(it->second.data(), value, sizeof(GLfloat) * 16);
+    if(!Issue(redundant))
+        return;
+
+    glUniformMatrix4fv(location, 1, GL_FALSE, value);
+    if(programKnown)
+        memcpy(matrices[key].data(), value, sizeof(GLfloat) * 16);
+}
+
+void GLState::DeleteProgram(GLuint program)
+{
+    glDeleteProgram(program);
+
+    // Deleting the current program only flags it; it stays bound
+    for(auto it = matrices.begin(); it != matrices.end();) {
+        if(it->first >> 32 == program)
+            it = matrices.erase(it);
+        else
+            ++it;
+    }
+}
+
+void GLState::DeleteVertexArray(GLuint vertexArray)
+{
+    glDeleteVertexArrays(1, &vertexArray);
+
+    if(this->vertexArray == vertexArray)
+        this->vertexArray = 0;
+}
+
+void GLState::DeleteBuffer(GLuint buffer)
+{
+    glDeleteBuffers(1, &buffer);
+
+    // GL unbinds a deleted buffer from every target of the context
+    for(auto it = buffers.begin(); it != buffers.end(); ++it) {
+        if(it->second == buffer)
+            it->second = 0;
+    }
+}
+
+void GLState::SetCaching(bool caching)
+{
+    this->caching = caching;
+}
+
+void GLState::Invalidate()
+{
+    programKnown = false;
+    vertexArrayKnown = false;
+    buffers.clear();
+    matrices.clear();
+}
+
+uint64_t GLState::GetIssuedCalls()
+{
+    return issuedCalls;
+}
+
+uint64_t GLState::GetSkippedCalls()
+{
+    return skippedCalls;
+}
+
+void GLState::ResetCounters()
+{
+    issuedCalls = 0;
+    skippedCalls = 0;
+}
@@ -0,0 +1,57 @@
+#ifndef _GL_STATE_H_
+#define _GL_STATE_H_
+
+#include <array>
+#include <cstdint>
+#include <unordered_map>
+
+#include <GL/glew.h>
+
+// Shadow copy of the GL bindings the render path touches. A call that would
+// set a value already in place is skipped and counted, so callers can bind
+// what they need before every draw without paying for it. Every bind of a
+// tracked kind must go through here, otherwise the copy goes stale; call
+// Invalidate after code that talks to GL directly.
+//
+// GL_ELEMENT_ARRAY_BUFFER is part of the bound VAO rather than global state,
+// so those binds are always issued.
+class GLState {
+    private:
+        bool caching;
+        GLuint program, vertexArray;
+        bool programKnown, vertexArrayKnown;
+        std::unordered_map<GLenum, GLuint> buffers;
+        // Last matrix set per (program << 32 | location)
+        std::unordered_map<uint64_t, std::array<GLfloat, 16>> matrices;
+        uint64_t issuedCalls, skippedCalls;
+
+        GLState();
+        bool Issue(bool redundant);
+
+    public:
+        static GLState &Get();
+
+        void UseProgram(GLuint program);
+        void BindVertexArray(GLuint vertexArray);
+        void BindBuffer(GLenum target, GLuint buffer);
+        // Always issued; these also set the generic binding
+        void BindBufferBase(GLenum target, GLuint index, GLuint buffer);
+        void BindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size);
+        // Sets a mat4 uniform of the current program
+        void UniformMatrix4fv(GLint location, const GLfloat *value);
+
+        // Delete through here so a recycled name is not mistaken for bound
+        void DeleteProgram(GLuint program);
+        void DeleteVertexArray(GLuint vertexArray);
+        void DeleteBuffer(GLuint buffer);
+
+        // With caching off every call is issued; the counters still run
+        void SetCaching(bool caching);
+        void Invalidate();
+
+        uint64_t GetIssuedCalls();
+        uint64_t GetSkippedCalls();
+        void ResetCounters();
+};
+
+#endif
@@ -0,0 +1,244 @@
+#include "GPUCuller.hpp"
+#include "BatchRenderer.hpp"
+#include "FrustumCuller.hpp"
+#include "MeshArena.hpp"
+#include "GLState.hpp"
+
+#include <algorithm>
+
+#include <glm/gtc/type_ptr.hpp>
+
+GPUCuller::GPUCuller()
+{
+    uniformObjectCount = -1;
+    uniformViewProjection = -1;
+    uniformVertexTransform = -1;
+    uniformPlanes = -1;
+
+    arena = nullptr;
+    dirty = false;
+    indirectCount = true;
+    viewProjection = glm::mat4(1.0f);
+    vertexTransform = glm::mat4(1.0f);
+    FrustumCuller::ExtractPlanes(viewProjection, planes);
+
+    objectBuffer = 0;
+    commandBuffer = 0;
+    modelBuffer = 0;
+    countBuffer = 0;
+    visibleBuffer = 0;
+    drawIndexBuffer = 0;
+    capacity = 0;
+}
+
+bool GPUCuller::Create()
+{
+    cullShader.CreateComputeFromFile("cullComputeShader.glsl");
+    uniformObjectCount = cullShader.GetUniformLocation("objectCount");
+    uniformViewProjection = cullShader.GetUniformLocation("viewProjection");
+    uniformVertexTransform = cullShader.GetUniformLocation("vertexTransform");
+    uniformPlanes = cullShader.GetUniformLocation("planes");
+    if(uniformObjectCount < 0 || uniformPlanes < 0) {
+        std::cout << "Culling compute shader did not build" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool GPUCuller::HasIndirectCount()
+{
+    static int supported = -1;
+    if(supported < 0)
+        supported = GLEW_ARB_indirect_parameters;
+    return supported;
+}
+
+void GPUCuller::SetIndirectCount(bool enabled)
+{
+    indirectCount = enabled;
+}
+
+void GPUCuller::SetFrustum(const glm::mat4 &viewProjection)
+{
+    this->viewProjection = viewProjection;
+    FrustumCuller::ExtractPlanes(viewProjection, planes);
+}
+
+void GPUCuller::SetVertexTransform(const glm::mat4 &transform)
+{
+    vertexTransform = transform;
+}
+
+void GPUCuller::Begin()
+{
+    objects.clear();
+    arena = nullptr;
+    dirty = true;
+}
+
+void GPUCuller::Add(Mesh *mesh, const glm::mat4 &model, unsigned int lod)
+{
+    Geometry *geometry = mesh->GetGeometry();
+    if(!geometry)
+        return;
+
+    // One multi-draw covers every object, so they share a vertex format
+    if(arena && geometry->arena != arena) {
+        std::cout << "GPUCuller objects must share an arena; skipping a mesh" << std::endl;
+        return;
+    }
+    arena = geometry->arena;
+
+    const Bounds &bounds = mesh->GetBounds();
+    const MeshLOD &range = mesh->GetLOD(lod);
+    GPUCullObject object;
+    object.model = model;
+    object.center = glm::vec4(bounds.center, 1.0f);
+    object.extents = glm::vec4(bounds.extents, 0.0f);
+    object.count = range.indexCount;
+    object.firstIndex = geometry->firstIndex + range.firstIndex;
+    object.baseVertex = geometry->baseVertex;
+    object.padding = 0;
+    objects.push_back(object);
+    dirty = true;
+}
+
+void GPUCuller::Allocate()
+{
+    if(objectBuffer == 0) {
+        GLuint buffers[6];
+        glGenBuffers(6, buffers);
+        objectBuffer = buffers[0];
+        commandBuffer = buffers[1];
+        modelBuffer = buffers[2];
+        countBuffer = buffers[3];
+        visibleBuffer = buffers[4];
+        drawIndexBuffer = buffers[5];
+
+        GLState::Get().BindBuffer(GL_SHADER_STORAGE_BUFFER, countBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint), NULL, GL_DYNAMIC_DRAW);
+    }
+
+    GLState::Get().BindBuffer(GL_SHADER_STORAGE_BUFFER, objectBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GPUCullObject) * objects.size(), objects.data(), GL_STATIC_DRAW);
+
+    // The outputs are written by the GPU only, and only ever grow
+    if(objects.size() > capacity) {
+        capacity = objects.size();
+        GLState::Get().BindBuffer(GL_SHADER_STORAGE_BUFFER, commandBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(DrawElementsIndirectCommand) * capacity, NULL, GL_DYNAMIC_COPY);
+        GLState::Get().BindBuffer(GL_SHADER_STORAGE_BUFFER, modelBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(glm::mat4) * capacity, NULL, GL_DYNAMIC_COPY);
+        GLState::Get().BindBuffer(GL_SHADER_STORAGE_BUFFER, visibleBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * capacity, NULL, GL_DYNAMIC_COPY);
+
+        std::vector<GLuint> drawIndices(capacity);
+        for(size_t i = 0; i < drawIndices.size(); ++i)
+            drawIndices[i] = i;
+        GLState::Get().BindBuffer(GL_ARRAY_BUFFER, drawIndexBuffer);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(GLuint) * drawIndices.size(), drawIndices.data(), GL_STATIC_DRAW);
+    }
+    dirty = false;
+}
+
+void GPUCuller::Cull()
+{
+    if(objects.empty())
+        return;
+    if(dirty)
+        Allocate();
+
+    GLuint zero = 0;
+    GLState::Get().BindBuffer(GL_SHADER_STORAGE_BUFFER, countBuffer);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint), &zero);
+    if(!indirectCount || !HasIndirectCount()) {
+        GLState::Get().BindBuffer(GL_SHADER_STORAGE_BUFFER, commandBuffer);
+        glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+    }
+
+    cullShader.UseShader();
+    glUniform1ui(uniformObjectCount, objects.size());
+    GLState::Get().UniformMatrix4fv(uniformViewProjection, glm::value_ptr(viewProjection));
+    GLState::Get().UniformMatrix4fv(uniformVertexTransform, glm::value_ptr(vertexTransform));
+    glUniform4fv(uniformPlanes, 6, glm::value_ptr(planes[0]));
+
+    GLState::Get().BindBufferBase(GL_SHADER_STORAGE_BUFFER, BATCH_MODEL_BINDING, modelBuffer);
+    GLState::Get().BindBufferBase(GL_SHADER_STORAGE_BUFFER, GPU_CULL_OBJECT_BINDING, objectBuffer);
+    GLState::Get().BindBufferBase(GL_SHADER_STORAGE_BUFFER, GPU_CULL_COMMAND_BINDING, commandBuffer);
+    GLState::Get().BindBufferBase(GL_SHADER_STORAGE_BUFFER, GPU_CULL_COUNT_BINDING, countBuffer);
+    GLState::Get().BindBufferBase(GL_SHADER_STORAGE_BUFFER, GPU_CULL_VISIBLE_BINDING, visibleBuffer);
+    glDispatchCompute((objects.size() + GPU_CULL_GROUP_SIZE - 1) / GPU_CULL_GROUP_SIZE, 1, 1);
+
+    // The draw reads the commands and count as indirect parameters and the
+    // matrices from a shader storage buffer
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void GPUCuller::Draw()
+{
+    if(objects.empty() || dirty)
+        return;
+
+    GLState::Get().BindBufferBase(GL_SHADER_STORAGE_BUFFER, BATCH_MODEL_BINDING, modelBuffer);
+    GLState::Get().BindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+    arena->Bind();
+    glBindVertexBuffer(ARENA_DRAW_ID_BINDING, drawIndexBuffer, 0, sizeof(GLuint));
+    glEnableVertexAttribArray(ARENA_DRAW_ID_LOCATION);
+
+    if(indirectCount && HasIndirectCount()) {
+        GLState::Get().BindBuffer(GL_PARAMETER_BUFFER_ARB, countBuffer);
+        glMultiDrawElementsIndirectCountARB(GL_TRIANGLES, arena->GetIndexType(), 0, 0, objects.size(), 0);
+    } else
+        glMultiDrawElementsIndirect(GL_TRIANGLES, arena->GetIndexType(), 0, objects.size(), 0);
+
+    glDisableVertexAttribArray(ARENA_DRAW_ID_LOCATION);
+    glBindVertexBuffer(ARENA_DRAW_ID_BINDING, 0, 0, sizeof(GLuint));
+}
+
+unsigned int GPUCuller::GetObjectCount()
+{
+    return objects.size();
+}
+
+unsigned int GPUCuller::ReadVisibleCount()
+{
+    if(countBuffer == 0)
+        return 0;
+
+    GLuint count = 0;
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    GLState::Get().BindBuffer(GL_SHADER_STORAGE_BUFFER, countBuffer);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint), &count);
+    return count;
+}
+
+std::vector<unsigned int> GPUCuller::ReadVisible()
+{
+    std::vector<unsigned int> visible(ReadVisibleCount());
+    if(visible.empty())
+        return visible;
+
+    GLState::Get().BindBuffer(GL_SHADER_STORAGE_BUFFER, visibleBuffer);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint) * visible.size(), visible.data());
+    std::sort(visible.begin(), visible.end());
+    return visible;
+}
+
+void GPUCuller::ClearCuller()
+{
+    GLuint *buffers[] = {&objectBuffer, &commandBuffer, &modelBuffer, &countBuffer, &visibleBuffer, &drawIndexBuffer};
+    for(int i = 0; i < 6; ++i) {
+        if(*buffers[i] != 0) {
+            GLState::Get().DeleteBuffer(*buffers[i]);
+            *buffers[i] = 0;
+        }
+    }
+    capacity = 0;
+
+    Begin();
+}
+
+GPUCuller::~GPUCuller()
+{
+    ClearCuller();
+}
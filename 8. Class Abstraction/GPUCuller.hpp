@@ -0,0 +1,98 @@
+#ifndef _GPU_CULLER_H_
+#define _GPU_CULLER_H_
+
+#include <vector>
+
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+
+#include "Mesh.hpp"
+#include "Shader.hpp"
+
+// Shader storage bindings of cullComputeShader.glsl; the visible model
+// matrices go to BATCH_MODEL_BINDING, where batchVertexShader reads them
+#define GPU_CULL_OBJECT_BINDING 1
+#define GPU_CULL_COMMAND_BINDING 2
+#define GPU_CULL_COUNT_BINDING 3
+#define GPU_CULL_VISIBLE_BINDING 4
+
+// Work group size of cullComputeShader.glsl
+#define GPU_CULL_GROUP_SIZE 64
+
+// One object as the compute shader reads it (std430)
+class GPUCullObject {
+    public:
+        glm::mat4 model;
+        glm::vec4 center, extents;
+        GLuint count, firstIndex;
+        GLint baseVertex;
+        GLuint padding;
+};
+
+// Frustum culling on the GPU. Objects, with their local bounds and draw
+// ranges, live in a shader storage buffer uploaded when the set changes; a
+// compute shader tests each against the frustum the way FrustumCuller does
+// and appends the visible ones to a compacted DrawElementsIndirectCommand
+// buffer, their viewProjection * model matrices to the Models buffer and
+// the count to a parameter buffer. Draw consumes the commands without the
+// CPU reading anything back, using glMultiDrawElementsIndirectCountARB
+// when GL_ARB_indirect_parameters is there; otherwise the unused commands
+// are zeroed and every slot is drawn. The order of the visible objects
+// depends on the GPU's scheduling. Every object must be in the same arena.
+class GPUCuller {
+    private:
+        Shader cullShader;
+        GLint uniformObjectCount, uniformViewProjection, uniformVertexTransform, uniformPlanes;
+
+        std::vector<GPUCullObject> objects;
+        MeshArena *arena;
+        bool dirty, indirectCount;
+        glm::mat4 viewProjection, vertexTransform;
+        glm::vec4 planes[6];
+
+        GLuint objectBuffer, commandBuffer, modelBuffer, countBuffer, visibleBuffer, drawIndexBuffer;
+        size_t capacity;
+
+        void Allocate();
+
+    public:
+        GPUCuller();
+
+        // Builds the compute program; false when it does not compile
+        bool Create();
+
+        static bool HasIndirectCount();
+        // Off zeroes and draws every slot even with the extension, for
+        // comparison
+        void SetIndirectCount(bool enabled);
+
+        void SetFrustum(const glm::mat4 &viewProjection);
+        // What the vertex shader applies to positions before the matrix from
+        // the Models buffer (batchVertexShader scales x and y by 0.4), so
+        // the bounds match what is drawn
+        void SetVertexTransform(const glm::mat4 &transform);
+
+        void Begin();
+        void Add(Mesh *mesh, const glm::mat4 &model, unsigned int lod = 0);
+
+        // Dispatches the compute shader; it leaves its own program bound
+        void Cull();
+        // Draws the visible objects of the last Cull with the current
+        // shader, which reads "layout(location = 5) in uint" and the Models
+        // buffer as with BatchRenderer
+        void Draw();
+
+        unsigned int GetObjectCount();
+        // Read back from the GPU, so these wait for the cull to finish; for
+        // statistics and validation only
+        unsigned int ReadVisibleCount();
+        // Indices of the visible objects in the order added, ascending
+        std::vector<unsigned int> ReadVisible();
+
+        void ClearCuller();
+
+        ~GPUCuller();
+};
+
+#endif
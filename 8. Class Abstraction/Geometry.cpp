@@ -0,0 +1,149 @@
+#include "Geometry.hpp"
+#include "MeshArena.hpp"
+
+#include <cstring>
+
+GeometryRegistry::GeometryRegistry()
+{
+    uploadedBytes = 0;
+    sharedBytes = 0;
+}
+
+GeometryRegistry &GeometryRegistry::Get()
+{
+    static GeometryRegistry registry;
+    return registry;
+}
+
+void GeometryRegistry::Hash(const void *vertices, size_t vertexBytes, const void *indices, size_t indexBytes,
+        uint64_t &hash, uint64_t &check)
+{
+    size_t counts[] = {vertexBytes, indexBytes};
+    const unsigned char *parts[] = {(const unsigned char *)counts, (const unsigned char *)vertices, (const unsigned char *)indices};
+    size_t sizes[] = {sizeof(counts), vertexBytes, indexBytes};
+
+    // FNV-1a over the sizes and the raw bytes of both arrays
+    hash = 0xCBF29CE484222325ull;
+    for(int part = 0; part < 3; ++part) {
+        for(size_t i = 0; i < sizes[part]; ++i) {
+            hash ^= parts[part][i];
+            hash *= 0x100000001B3ull;
+        }
+    }
+
+    // A different construction over the same input, so data colliding in
+    // one is not also likely to collide in the other. A short last word is
+    // zero padded; the sizes already tell the padding apart
+    check = 0x9E3779B97F4A7C15ull;
+    for(int part = 0; part < 3; ++part) {
+        for(size_t i = 0; i < sizes[part]; i += 8) {
+            uint64_t word = 0;
+            memcpy(&word, parts[part] + i, sizes[part] - i < 8 ? sizes[part] - i : 8);
+            check = (check ^ word) * 0xFF51AFD7ED558CCDull;
+            check ^= check >> 29;
+        }
+    }
+    check *= 0xC4CEB9FE1A85EC53ull;
+    check ^= check >> 32;
+}
+
+Geometry *GeometryRegistry::Find(MeshArena *arena, unsigned int vertexCount, unsigned int indexCount, uint64_t hash, uint64_t check)
+{
+    auto range = geometries.equal_range(hash);
+    for(auto it = range.first; it != range.second; ++it) {
+        Geometry *geometry = it->second;
+        if(geometry->arena == arena && geometry->vertexCount == vertexCount && geometry->indexCount == indexCount &&
+                geometry->check == check) {
+            ++geometry->refCount;
+            sharedBytes += (size_t)arena->GetLayout().stride * vertexCount + (size_t)arena->GetIndexSize() * indexCount;
+            return geometry;
+        }
+    }
+    return nullptr;
+}
+
+Geometry *GeometryRegistry::Insert(MeshArena *arena, unsigned int vertexCount, unsigned int indexCount, uint64_t hash, uint64_t check)
+{
+    Geometry *geometry = new Geometry();
+    geometry->arena = arena;
+    geometry->vertexCount = vertexCount;
+    geometry->indexCount = indexCount;
+    geometry->hash = hash;
+    geometry->check = check;
+    geometry->refCount = 1;
+
+    geometries.insert(std::make_pair(hash, geometry));
+    return geometry;
+}
+
+Geometry *GeometryRegistry::Acquire(MeshArena *arena, const void *vertices, unsigned int vertexCount, const void *indices, unsigned int indexCount)
+{
+    uint64_t hash, check;
+    Hash(vertices, (size_t)arena->GetLayout().stride * vertexCount, indices, (size_t)arena->GetIndexSize() * indexCount, hash, check);
+    Geometry *geometry = Find(arena, vertexCount, indexCount, hash, check);
+    if(geometry)
+        return geometry;
+
+    geometry = Insert(arena, vertexCount, indexCount, hash, check);
+    if(!arena->Allocate(geometry, vertices, indices)) {
+        Release(geometry);
+        return nullptr;
+    }
+    uploadedBytes += (size_t)arena->GetLayout().stride * vertexCount + (size_t)arena->GetIndexSize() * indexCount;
+    return geometry;
+}
+
+Geometry *GeometryRegistry::Acquire(MeshArena *arena, unsigned int vertexCount, unsigned int indexCount, uint64_t hash, uint64_t check,
+        GLuint source, GLintptr offset)
+{
+    Geometry *geometry = Find(arena, vertexCount, indexCount, hash, check);
+    if(geometry)
+        return geometry;
+
+    geometry = Insert(arena, vertexCount, indexCount, hash, check);
+    if(!arena->Allocate(geometry, source, offset)) {
+        Release(geometry);
+        return nullptr;
+    }
+    uploadedBytes += (size_t)arena->GetLayout().stride * vertexCount + (size_t)arena->GetIndexSize() * indexCount;
+    return geometry;
+}
+
+void GeometryRegistry::Release(Geometry *geometry)
+{
+    if(--geometry->refCount > 0)
+        return;
+
+    auto range = geometries.equal_range(geometry->hash);
+    for(auto it = range.first; it != range.second; ++it) {
+        if(it->second == geometry) {
+            geometries.erase(it);
+            break;
+        }
+    }
+
+    geometry->arena->Free(geometry);
+    delete geometry;
+}
+
+size_t GeometryRegistry::GetGeometryCount()
+{
+    return geometries.size();
+}
+
+size_t GeometryRegistry::GetUploadedBytes()
+{
+    return uploadedBytes;
+}
+
+size_t GeometryRegistry::GetSharedBytes()
+{
+    return sharedBytes;
+}
+
+GeometryRegistry::~GeometryRegistry()
+{
+    // Arena buffers still in use at exit go away with the context
+    for(auto it = geometries.begin(); it != geometries.end(); ++it)
+        delete it->second;
+}
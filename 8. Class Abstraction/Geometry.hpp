@@ -0,0 +1,67 @@
+#ifndef _GEOMETRY_H_
+#define _GEOMETRY_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <unordered_map>
+
+#include <GL/glew.h>
+
+class MeshArena;
+
+// Where one set of mesh data lives: the arena for its vertex layout and
+// index type, and its ranges there. baseVertex and firstIndex change when
+// the arena is compacted
+class Geometry {
+    public:
+        MeshArena *arena;
+        unsigned int baseVertex, firstIndex;
+        unsigned int vertexCount, indexCount;
+        // Two independent hashes of the data, see GeometryRegistry::Hash
+        uint64_t hash, check;
+        unsigned int refCount;
+};
+
+// Hands out shared Geometry for identical vertex/index data. Data is matched
+// within one arena by its counts and two independent 64-bit content hashes,
+// never by reading the arena back, and the arena range is freed when the
+// last Mesh using it releases its reference.
+class GeometryRegistry {
+    private:
+        std::unordered_multimap<uint64_t, Geometry *> geometries;
+        size_t uploadedBytes, sharedBytes;
+
+        GeometryRegistry();
+        // Shared geometry holding the same data, with its reference taken
+        Geometry *Find(MeshArena *arena, unsigned int vertexCount, unsigned int indexCount, uint64_t hash, uint64_t check);
+        Geometry *Insert(MeshArena *arena, unsigned int vertexCount, unsigned int indexCount, uint64_t hash, uint64_t check);
+
+    public:
+        static GeometryRegistry &Get();
+
+        // The two content hashes Acquire matches data by: FNV-1a over bytes
+        // and a multiply-xorshift over 8-byte words. Touches no GL state, so
+        // it can run on any thread
+        static void Hash(const void *vertices, size_t vertexBytes, const void *indices, size_t indexBytes,
+                uint64_t &hash, uint64_t &check);
+
+        // vertices are vertexCount vertices in the arena's layout, indices
+        // are indexCount indices of its index type. Null when the arena
+        // cannot hold them
+        Geometry *Acquire(MeshArena *arena, const void *vertices, unsigned int vertexCount, const void *indices, unsigned int indexCount);
+        // Same, for data already copied to a GL buffer at offset, vertices
+        // then indices, and hashed with Hash. New geometry is copied from
+        // there on the GPU
+        Geometry *Acquire(MeshArena *arena, unsigned int vertexCount, unsigned int indexCount, uint64_t hash, uint64_t check,
+                GLuint source, GLintptr offset);
+        void Release(Geometry *geometry);
+
+        size_t GetGeometryCount();
+        // Bytes actually uploaded, and bytes that reuse avoided uploading
+        size_t GetUploadedBytes();
+        size_t GetSharedBytes();
+
+        ~GeometryRegistry();
+};
+
+#endif
@@ -0,0 +1,143 @@
+#include "JobSystem.hpp"
+
+thread_local unsigned int JobSystem::queueIndex = 0;
+
+JobCounter::JobCounter()
+{
+    pending = 0;
+}
+
+JobSystem::JobSystem()
+{
+    queued = 0;
+    stopping = false;
+    steals = 0;
+}
+
+void JobSystem::Start(unsigned int threads)
+{
+    Stop();
+
+    if(threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    stopping = false;
+    steals = 0;
+    for(unsigned int i = 0; i < threads; ++i)
+        queues.emplace_back(new JobQueue());
+    for(unsigned int i = 1; i < threads; ++i)
+        workers.emplace_back(&JobSystem::WorkerLoop, this, i);
+}
+
+void JobSystem::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for(size_t i = 0; i < workers.size(); ++i)
+        workers[i].join();
+    workers.clear();
+
+    // Jobs nobody waited for still run, here, so their counters reach zero
+    // and a later Wait on them returns
+    while(RunOne(queueIndex))
+        ;
+    queues.clear();
+    queued = 0;
+}
+
+void JobSystem::Run(JobCounter &counter, std::function<void()> job)
+{
+    // Without Start the job simply runs now
+    if(queues.empty()) {
+        job();
+        return;
+    }
+
+    counter.pending.fetch_add(1);
+
+    // Counted before it is queued, so a thread that takes it at once never
+    // sees the count below the jobs queued. Taking sleepMutex orders the
+    // count with a worker about to sleep, so the wake-up cannot fall
+    // between its check and its wait
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        ++queued;
+    }
+
+    JobQueue &queue = *queues[queueIndex % queues.size()];
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.jobs.emplace_back(std::move(job), &counter);
+    }
+    wake.notify_one();
+}
+
+bool JobSystem::RunOne(unsigned int self)
+{
+    std::pair<std::function<void()>, JobCounter *> job;
+    bool found = false;
+
+    // Own queue newest first, then the oldest job of each other queue
+    for(size_t i = 0; i < queues.size() && !found; ++i) {
+        JobQueue &queue = *queues[(self + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if(queue.jobs.empty())
+            continue;
+
+        if(i == 0) {
+            job = std::move(queue.jobs.back());
+            queue.jobs.pop_back();
+        } else {
+            job = std::move(queue.jobs.front());
+            queue.jobs.pop_front();
+            ++steals;
+        }
+        found = true;
+    }
+    if(!found)
+        return false;
+
+    --queued;
+    job.first();
+    job.second->pending.fetch_sub(1);
+    return true;
+}
+
+void JobSystem::WorkerLoop(unsigned int index)
+{
+    queueIndex = index;
+    while(true) {
+        if(RunOne(index))
+            continue;
+
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wake.wait(lock, [this]() { return stopping || queued > 0; });
+        if(stopping)
+            return;
+    }
+}
+
+void JobSystem::Wait(JobCounter &counter)
+{
+    while(counter.pending > 0) {
+        if(!RunOne(queueIndex))
+            std::this_thread::yield();
+    }
+}
+
+unsigned int JobSystem::GetThreadCount()
+{
+    return std::max<size_t>(1, queues.size());
+}
+
+unsigned long long JobSystem::GetStealCount()
+{
+    return steals;
+}
+
+JobSystem::~JobSystem()
+{
+    Stop();
+}
@@ -0,0 +1,85 @@
+#ifndef _JOB_SYSTEM_H_
+#define _JOB_SYSTEM_H_
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Jobs still to finish in a group; Run adds to it and Wait drains it
+class JobCounter {
+    public:
+        std::atomic<unsigned int> pending;
+
+        JobCounter();
+};
+
+// A pool of worker threads with a job queue each. A thread pushes the jobs
+// it spawns onto its own queue and takes them back newest first, while
+// idle threads steal the oldest job from another queue, so a thread mostly
+// works on data it just touched and work spreads without a shared queue
+// to fight over. Threads that are not workers (the GL thread) share queue
+// 0, and Wait runs jobs rather than blocking, so the waiting thread works
+// too. Jobs must not make GL calls; they build data that the GL thread
+// then submits.
+class JobSystem {
+    private:
+        class JobQueue {
+            public:
+                std::mutex mutex;
+                std::deque<std::pair<std::function<void()>, JobCounter *>> jobs;
+        };
+
+        std::vector<std::unique_ptr<JobQueue>> queues;
+        std::vector<std::thread> workers;
+        std::mutex sleepMutex;
+        std::condition_variable wake;
+        std::atomic<unsigned int> queued;
+        bool stopping;
+        std::atomic<unsigned long long> steals;
+
+        static thread_local unsigned int queueIndex;
+
+        bool RunOne(unsigned int self);
+        void WorkerLoop(unsigned int index);
+
+    public:
+        JobSystem();
+
+        // threads counts the calling thread, so 1 starts no workers and
+        // runs every job inside Wait; 0 uses every hardware thread
+        void Start(unsigned int threads = 0);
+        // Joins the workers, then runs any jobs still queued on the calling
+        // thread
+        void Stop();
+
+        void Run(JobCounter &counter, std::function<void()> job);
+        // Runs queued jobs until every job of counter has finished
+        void Wait(JobCounter &counter);
+
+        // Splits [0, count) into ranges of up to grain items and runs
+        // function(first, last) on each
+        template<typename Function>
+        void ParallelFor(JobCounter &counter, unsigned int count, unsigned int grain, Function function)
+        {
+            grain = std::max(1u, grain);
+            for(unsigned int first = 0; first < count; first += grain) {
+                unsigned int last = std::min(count, first + grain);
+                Run(counter, [function, first, last]() { function(first, last); });
+            }
+        }
+
+        // Threads running jobs, the calling one included
+        unsigned int GetThreadCount();
+        // Jobs taken from another thread's queue since Start
+        unsigned long long GetStealCount();
+
+        ~JobSystem();
+};
+
+#endif
@@ -1,66 +1,217 @@
 #include "Mesh.hpp"
+#include "MeshArena.hpp"
+#include "GLState.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+bool Mesh::optimizeOnLoad = false, Mesh::generateLODs = false;
 
 Mesh::Mesh()
 {
-    VAO = 0;
-    VBO = 0;
-    IBO = 0;
-    indexCount = 0;
+    geometry = nullptr;
+
+    instanceVBO = 0;
+    instanceCount = 0;
+    instanceCapacity = 0;
 }
 
 void Mesh::CreateMesh(GLfloat *vertices, unsigned int *indices, unsigned int vertexCount, unsigned int indexCount)
 {
-    this->indexCount = indexCount;
+    CreateMesh(VertexLayout::Positions(), vertices, vertexCount / 3, indices, indexCount);
+}
 
-    glGenVertexArrays(1, &VAO);
-    glBindVertexArray(VAO);
+void Mesh::CreateMesh(const VertexLayout &layout, const void *vertexData, unsigned int vertexCount,
+        const unsigned int *indices, unsigned int indexCount)
+{
+    if(!optimizeOnLoad && !generateLODs) {
+        lods.assign(1, MeshLOD{0, indexCount, 0.0f});
+        AcquireGeometry(layout, vertexData, vertexCount, indices, indexCount);
+        return;
+    }
 
-    glGenBuffers(1, &IBO);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, IBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices[0]) * indexCount, indices, GL_STATIC_DRAW);
+    MeshData data(layout, vertexData, vertexCount, indices, indexCount);
+    if(optimizeOnLoad)
+        data.Optimize();
+    if(generateLODs)
+        data.GenerateLODs();
+    CreateMesh(data);
+}
 
-    glGenBuffers(1, &VBO);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices[0]) * vertexCount, vertices, GL_STATIC_DRAW);
+void Mesh::CreateMesh(const MeshData &data)
+{
+    lods = data.lods;
+    AcquireGeometry(data.layout, data.vertices.data(), data.vertexCount, data.indices.data(), data.indices.size());
+}
 
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), 0);
-    glEnableVertexAttribArray(0);
+bool Mesh::CreateFromFile(const std::string &path)
+{
+    MeshData data;
+    if(!data.Load(path))
+        return false;
+    CreateMesh(data);
+    return true;
+}
 
-    // Clear everything
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
+void Mesh::CreateMesh(Geometry *geometry, const std::vector<MeshLOD> &lods, const Bounds &bounds)
+{
+    // geometry arrives with its reference already taken, so this is right
+    // even when it is the geometry the mesh already had
+    if(this->geometry)
+        GeometryRegistry::Get().Release(this->geometry);
+    this->geometry = geometry;
+    this->lods = lods;
+    this->bounds = bounds;
 }
 
-void Mesh::RenderMesh()
+void Mesh::AcquireGeometry(const VertexLayout &layout, const void *vertexData, unsigned int vertexCount,
+        const unsigned int *indices, unsigned int indexCount)
 {
-    glBindVertexArray(VAO);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, IBO);
-    
-    glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0);
-    
-    glBindVertexArray(0);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    bounds.FromVertices(layout, vertexData, vertexCount);
+
+    // Indices are relative to the mesh, so the vertex count alone decides
+    GLenum indexType = IndexTypeFor(vertexCount);
+    MeshArena &arena = MeshArena::Get(layout, indexType);
+
+    // Released only after the new one is acquired, so recreating a mesh from
+    // the same data shares its range instead of freeing and uploading it again
+    Geometry *previous = geometry;
+    if(indexType == GL_UNSIGNED_SHORT) {
+        std::vector<GLushort> shortIndices(indices, indices + indexCount);
+        geometry = GeometryRegistry::Get().Acquire(&arena, vertexData, vertexCount, shortIndices.data(), indexCount);
+    } else
+        geometry = GeometryRegistry::Get().Acquire(&arena, vertexData, vertexCount, indices, indexCount);
+    if(previous)
+        GeometryRegistry::Get().Release(previous);
 }
 
-void Mesh::ClearMesh()
+void Mesh::SetOptimizeOnLoad(bool optimize)
 {
-    if(VBO != 0) {
-        glDeleteBuffers(1, &VBO);
-        VBO = 0;
+    optimizeOnLoad = optimize;
+}
+
+void Mesh::SetGenerateLODs(bool generate)
+{
+    generateLODs = generate;
+}
+
+void Mesh::RenderMesh(unsigned int lod)
+{
+    if(!geometry || lods.empty())
+        return;
+
+    MeshArena *arena = geometry->arena;
+    const MeshLOD &range = GetLOD(lod);
+    arena->Bind();
+
+    // Indices are relative to the mesh, baseVertex moves them into its range
+    glDrawElementsBaseVertex(GL_TRIANGLES, range.indexCount, arena->GetIndexType(),
+            (void *)((size_t)(geometry->firstIndex + range.firstIndex) * arena->GetIndexSize()), geometry->baseVertex);
+}
+
+void Mesh::SetInstances(const glm::mat4 *models, unsigned int count)
+{
+    if(instanceVBO == 0)
+        glGenBuffers(1, &instanceVBO);
+    GLState::Get().BindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+
+    // Grow by reallocating, otherwise overwrite in place
+    if(count > instanceCapacity) {
+        glBufferData(GL_ARRAY_BUFFER, sizeof(glm::mat4) * count, models, GL_DYNAMIC_DRAW);
+        instanceCapacity = count;
+    } else
+        glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(glm::mat4) * count, models);
+    instanceCount = count;
+}
+
+void Mesh::RenderMeshInstanced(unsigned int lod)
+{
+    if(!geometry || lods.empty())
+        return;
+
+    MeshArena *arena = geometry->arena;
+    const MeshLOD &range = GetLOD(lod);
+    arena->Bind();
+
+    // A mat4 attribute takes four consecutive locations, one per column
+    glBindVertexBuffer(ARENA_INSTANCE_BINDING, instanceVBO, 0, sizeof(glm::mat4));
+    for(int column = 0; column < 4; ++column)
+        glEnableVertexAttribArray(1 + column);
+
+    glDrawElementsInstancedBaseVertex(GL_TRIANGLES, range.indexCount, arena->GetIndexType(),
+            (void *)((size_t)(geometry->firstIndex + range.firstIndex) * arena->GetIndexSize()), instanceCount,
+            geometry->baseVertex);
+
+    // Other meshes draw with the same VAO and no instance buffer
+    for(int column = 0; column < 4; ++column)
+        glDisableVertexAttribArray(1 + column);
+    glBindVertexBuffer(ARENA_INSTANCE_BINDING, 0, 0, sizeof(glm::mat4));
+}
+
+unsigned int Mesh::GetLODCount()
+{
+    return lods.size();
+}
+
+const MeshLOD &Mesh::GetLOD(unsigned int lod)
+{
+    static const MeshLOD none{0, 0, 0.0f};
+    if(lods.empty())
+        return none;
+    return lods[std::min(lod, (unsigned int)lods.size() - 1)];
+}
+
+unsigned int Mesh::SelectLOD(const glm::mat4 &model, const glm::vec3 &camera, float pixelsPerUnit, float maxPixelError)
+{
+    if(lods.empty())
+        return 0;
+
+    glm::vec3 origin(model[3][0], model[3][1], model[3][2]);
+    float distance = glm::length(origin - camera);
+    float scale = std::max(std::max(glm::length(glm::vec3(model[0][0], model[0][1], model[0][2])),
+            glm::length(glm::vec3(model[1][0], model[1][1], model[1][2]))),
+            glm::length(glm::vec3(model[2][0], model[2][1], model[2][2])));
+
+    // error * scale * pixelsPerUnit / distance is the error in pixels
+    for(unsigned int lod = lods.size() - 1; lod > 0; --lod) {
+        if(lods[lod].error * scale * pixelsPerUnit <= maxPixelError * distance)
+            return lod;
     }
+    return 0;
+}
+
+float Mesh::GetPixelsPerUnit(float fieldOfView, int viewportHeight)
+{
+    return viewportHeight / (2 * tanf(fieldOfView / 2));
+}
+
+Geometry *Mesh::GetGeometry()
+{
+    return geometry;
+}
 
-    if(IBO != 0) {
-        glDeleteBuffers(1, &IBO);
-        IBO = 0;
+const Bounds &Mesh::GetBounds()
+{
+    return bounds;
+}
+
+void Mesh::ClearMesh()
+{
+    if(geometry) {
+        GeometryRegistry::Get().Release(geometry);
+        geometry = nullptr;
     }
 
-    if(VAO != 0) {
-        glDeleteVertexArrays(1, &VAO);
-        VAO = 0;
+    if(instanceVBO != 0) {
+        GLState::Get().DeleteBuffer(instanceVBO);
+        instanceVBO = 0;
     }
+    instanceCount = 0;
+    instanceCapacity = 0;
 
-    indexCount = 0;
+    lods.clear();
+    bounds = Bounds();
 }
 
 Mesh::~Mesh()
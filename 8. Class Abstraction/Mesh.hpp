@@ -1,18 +1,83 @@
 #ifndef _MESH_H_
 #define _MESH_H_
 
+#include <string>
+#include <vector>
+
 #include <GL/glew.h>
 
+#include <glm/glm.hpp>
+
+#include "Bounds.hpp"
+#include "Geometry.hpp"
+#include "MeshData.hpp"
+#include "VertexLayout.hpp"
+
 class Mesh {
     private:
-        GLuint VAO, VBO, IBO;
-        unsigned int indexCount;
+        // A range of the MeshArena for its format, shared with every Mesh
+        // created from the same data; only the instance data is per Mesh
+        Geometry *geometry;
+        // Index ranges within the geometry, the full mesh first; every LOD
+        // draws from the same vertices
+        std::vector<MeshLOD> lods;
+        // Of the vertices in model space, for culling
+        Bounds bounds;
+
+        // Per-instance model matrices, attribute locations 1-4 (one per
+        // column), bound to the arena VAO while drawing
+        GLuint instanceVBO;
+        unsigned int instanceCount, instanceCapacity;
+
+        static bool optimizeOnLoad, generateLODs;
+
+        void AcquireGeometry(const VertexLayout &layout, const void *vertexData, unsigned int vertexCount,
+                const unsigned int *indices, unsigned int indexCount);
 
     public:
         Mesh();
 
+        // vertexCount is the number of floats; positions only
         void CreateMesh(GLfloat *vertices, unsigned int *indices, unsigned int vertexCount, unsigned int indexCount);
-        void RenderMesh();
+        // vertexData holds vertexCount vertices already packed with
+        // layout; indices are stored as 16-bit when they fit
+        void CreateMesh(const VertexLayout &layout, const void *vertexData, unsigned int vertexCount,
+                const unsigned int *indices, unsigned int indexCount);
+        // Uploads prepared data with its LODs as they are
+        void CreateMesh(const MeshData &data);
+        // Loads a .mesh file written by MeshData::Save
+        bool CreateFromFile(const std::string &path);
+        // Takes over a reference to geometry acquired from the registry
+        // elsewhere, as MeshStreamer does, with its LODs and bounds
+        void CreateMesh(Geometry *geometry, const std::vector<MeshLOD> &lods, const Bounds &bounds);
+
+        // Runs OptimizeMesh on the data of every mesh created afterwards;
+        // off by default, so indices are used exactly as given
+        static void SetOptimizeOnLoad(bool optimize);
+        // Builds a LOD chain for every mesh created afterwards; off by default
+        static void SetGenerateLODs(bool generate);
+
+        // lod is clamped to the coarsest LOD. A mesh without geometry yet,
+        // such as one MeshStreamer has not uploaded, draws nothing
+        void RenderMesh(unsigned int lod = 0);
+
+        // Draws instanceCount copies in one call; the vertex shader reads the
+        // model matrix from "layout(location = 1) in mat4"
+        void SetInstances(const glm::mat4 *models, unsigned int count);
+        void RenderMeshInstanced(unsigned int lod = 0);
+
+        unsigned int GetLODCount();
+        // An empty range when the mesh has no LODs
+        const MeshLOD &GetLOD(unsigned int lod);
+        // Coarsest LOD whose error, projected at the distance from camera to
+        // the model's origin, stays within maxPixelError pixels
+        unsigned int SelectLOD(const glm::mat4 &model, const glm::vec3 &camera, float pixelsPerUnit, float maxPixelError);
+        // Pixels one unit covers at distance 1 for a perspective projection
+        static float GetPixelsPerUnit(float fieldOfView, int viewportHeight);
+
+        Geometry *GetGeometry();
+        const Bounds &GetBounds();
+
         void ClearMesh();
 
         ~Mesh();
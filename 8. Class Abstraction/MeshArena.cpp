@@ -0,0 +1,335 @@
+#include "MeshArena.hpp"
+#include "GLState.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+RangeAllocator::RangeAllocator()
+{
+    capacity = 0;
+    used = 0;
+}
+
+void RangeAllocator::Reset(unsigned int capacity, unsigned int used)
+{
+    this->capacity = capacity;
+    this->used = used;
+
+    freeRanges.clear();
+    if(used < capacity)
+        freeRanges[used] = capacity - used;
+}
+
+bool RangeAllocator::Allocate(unsigned int size, unsigned int &offset)
+{
+    if(size == 0) {
+        offset = 0;
+        return true;
+    }
+
+    for(auto it = freeRanges.begin(); it != freeRanges.end(); ++it) {
+        if(it->second < size)
+            continue;
+
+        offset = it->first;
+        if(it->second > size)
+            freeRanges[offset + size] = it->second - size;
+        freeRanges.erase(it);
+        used += size;
+        return true;
+    }
+    return false;
+}
+
+void RangeAllocator::Free(unsigned int offset, unsigned int size)
+{
+    if(size == 0)
+        return;
+    used -= size;
+
+    auto it = freeRanges.insert(std::make_pair(offset, size)).first;
+
+    // Merge with the following range, then with the preceding one
+    auto next = std::next(it);
+    if(next != freeRanges.end() && it->first + it->second == next->first) {
+        it->second += next->second;
+        freeRanges.erase(next);
+    }
+    if(it != freeRanges.begin()) {
+        auto previous = std::prev(it);
+        if(previous->first + previous->second == it->first) {
+            previous->second += it->second;
+            freeRanges.erase(it);
+        }
+    }
+}
+
+unsigned int RangeAllocator::GetCapacity()
+{
+    return capacity;
+}
+
+unsigned int RangeAllocator::GetUsed()
+{
+    return used;
+}
+
+unsigned int RangeAllocator::GetFreeRangeCount()
+{
+    return freeRanges.size();
+}
+
+bool RangeAllocator::IsPacked()
+{
+    return freeRanges.empty() || (freeRanges.size() == 1 && freeRanges.begin()->first == used);
+}
+
+std::map<std::pair<uint64_t, GLenum>, std::unique_ptr<MeshArena>> MeshArena::arenas;
+
+MeshArena::MeshArena(const VertexLayout &layout, GLenum indexType)
+{
+    this->layout = layout;
+    this->indexType = indexType;
+    indexSize = IndexSize(indexType);
+
+    VAO = 0;
+    VBO = 0;
+    IBO = 0;
+    relocations = 0;
+}
+
+MeshArena &MeshArena::Get(const VertexLayout &layout, GLenum indexType)
+{
+    std::unique_ptr<MeshArena> &arena = arenas[std::make_pair(layout.Hash(), indexType)];
+    if(!arena)
+        arena.reset(new MeshArena(layout, indexType));
+    return *arena;
+}
+
+void MeshArena::CreateVertexArray()
+{
+    glGenVertexArrays(1, &VAO);
+    GLState::Get().BindVertexArray(VAO);
+
+    // Vertex attributes come interleaved from the arena VBO
+    layout.Apply(ARENA_VERTEX_BINDING);
+
+    // Per-instance model matrices, attribute locations 1-4 (one per column).
+    // Mesh::RenderMeshInstanced binds its own buffer here and enables them
+    // only for the duration of the draw
+    for(int column = 0; column < 4; ++column) {
+        glVertexAttribFormat(1 + column, 4, GL_FLOAT, GL_FALSE, column * 4 * sizeof(GLfloat));
+        glVertexAttribBinding(1 + column, ARENA_INSTANCE_BINDING);
+    }
+    glVertexBindingDivisor(ARENA_INSTANCE_BINDING, 1);
+
+    // Index of the draw in a BatchRenderer batch, enabled the same way
+    glVertexAttribIFormat(ARENA_DRAW_ID_LOCATION, 1, GL_UNSIGNED_INT, 0);
+    glVertexAttribBinding(ARENA_DRAW_ID_LOCATION, ARENA_DRAW_ID_BINDING);
+    glVertexBindingDivisor(ARENA_DRAW_ID_BINDING, 1);
+}
+
+void MeshArena::Relocate(unsigned int vertexCapacity, unsigned int indexCapacity)
+{
+    GLuint newVBO, newIBO;
+    glGenBuffers(1, &newVBO);
+    GLState::Get().BindBuffer(GL_COPY_WRITE_BUFFER, newVBO);
+    glBufferStorage(GL_COPY_WRITE_BUFFER, (size_t)layout.stride * vertexCapacity, NULL, GL_DYNAMIC_STORAGE_BIT);
+
+    glGenBuffers(1, &newIBO);
+    GLState::Get().BindBuffer(GL_COPY_WRITE_BUFFER, newIBO);
+    glBufferStorage(GL_COPY_WRITE_BUFFER, (size_t)indexSize * indexCapacity, NULL, GL_DYNAMIC_STORAGE_BIT);
+
+    // Copying into new buffers means source and destination ranges never
+    // overlap; the current order of the ranges is kept
+    std::vector<Geometry *> live(geometries.begin(), geometries.end());
+    std::sort(live.begin(), live.end(), [](Geometry *a, Geometry *b) {
+        return a->baseVertex < b->baseVertex;
+    });
+
+    // The copies stay on the GPU; nothing is read back
+    unsigned int vertexOffset = 0, indexOffset = 0;
+    for(size_t i = 0; i < live.size(); ++i) {
+        Geometry *geometry = live[i];
+        unsigned int vertexCount = geometry->vertexCount;
+
+        if(vertexCount > 0) {
+            GLState::Get().BindBuffer(GL_COPY_READ_BUFFER, VBO);
+            GLState::Get().BindBuffer(GL_COPY_WRITE_BUFFER, newVBO);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, (size_t)layout.stride * geometry->baseVertex,
+                    (size_t)layout.stride * vertexOffset, (size_t)layout.stride * vertexCount);
+        }
+        if(geometry->indexCount > 0) {
+            GLState::Get().BindBuffer(GL_COPY_READ_BUFFER, IBO);
+            GLState::Get().BindBuffer(GL_COPY_WRITE_BUFFER, newIBO);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, (size_t)indexSize * geometry->firstIndex,
+                    (size_t)indexSize * indexOffset, (size_t)indexSize * geometry->indexCount);
+        }
+
+        geometry->baseVertex = vertexOffset;
+        geometry->firstIndex = indexOffset;
+        vertexOffset += vertexCount;
+        indexOffset += geometry->indexCount;
+    }
+
+    if(VBO != 0)
+        GLState::Get().DeleteBuffer(VBO);
+    if(IBO != 0)
+        GLState::Get().DeleteBuffer(IBO);
+    VBO = newVBO;
+    IBO = newIBO;
+    vertices.Reset(vertexCapacity, vertexOffset);
+    indices.Reset(indexCapacity, indexOffset);
+
+    if(VAO == 0)
+        CreateVertexArray();
+    GLState::Get().BindVertexArray(VAO);
+    glBindVertexBuffer(ARENA_VERTEX_BINDING, VBO, 0, layout.stride);
+    GLState::Get().BindBuffer(GL_ELEMENT_ARRAY_BUFFER, IBO);
+    ++relocations;
+}
+
+bool MeshArena::TryAllocate(Geometry *geometry)
+{
+    if(!vertices.Allocate(geometry->vertexCount, geometry->baseVertex))
+        return false;
+
+    if(!indices.Allocate(geometry->indexCount, geometry->firstIndex)) {
+        vertices.Free(geometry->baseVertex, geometry->vertexCount);
+        return false;
+    }
+    return true;
+}
+
+bool MeshArena::Place(Geometry *geometry)
+{
+    // Counted in 64 bits, so neither the sums nor the doubling below can wrap
+    uint64_t vertexNeed = (uint64_t)vertices.GetUsed() + geometry->vertexCount;
+    uint64_t indexNeed = (uint64_t)indices.GetUsed() + geometry->indexCount;
+    if(vertexNeed > ARENA_MAX_VERTICES || indexNeed > ARENA_MAX_INDICES) {
+        std::cout << "Mesh arena full, can't place " << geometry->vertexCount << " vertices and " <<
+            geometry->indexCount << " indices" << std::endl;
+        return false;
+    }
+
+    if(VAO == 0)
+        Relocate(std::max(geometry->vertexCount, (unsigned int)ARENA_VERTICES), std::max(geometry->indexCount, (unsigned int)ARENA_INDICES));
+
+    if(!TryAllocate(geometry)) {
+        // Compacting leaves all free space in one range; grow only if the
+        // total free space is not enough
+        uint64_t vertexCapacity = vertices.GetCapacity(), indexCapacity = indices.GetCapacity();
+        while(vertexCapacity < vertexNeed)
+            vertexCapacity *= 2;
+        while(indexCapacity < indexNeed)
+            indexCapacity *= 2;
+
+        Relocate((unsigned int)std::min<uint64_t>(vertexCapacity, ARENA_MAX_VERTICES),
+                (unsigned int)std::min<uint64_t>(indexCapacity, ARENA_MAX_INDICES));
+        if(!TryAllocate(geometry)) {
+            std::cout << "Mesh arena full, can't place " << geometry->vertexCount << " vertices and " <<
+                geometry->indexCount << " indices" << std::endl;
+            return false;
+        }
+    }
+    geometries.insert(geometry);
+    return true;
+}
+
+bool MeshArena::Allocate(Geometry *geometry, const void *vertexData, const void *indexData)
+{
+    if(!Place(geometry))
+        return false;
+
+    GLState::Get().BindBuffer(GL_COPY_WRITE_BUFFER, VBO);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, (size_t)layout.stride * geometry->baseVertex, (size_t)layout.stride * geometry->vertexCount, vertexData);
+    GLState::Get().BindBuffer(GL_COPY_WRITE_BUFFER, IBO);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, (size_t)indexSize * geometry->firstIndex, (size_t)indexSize * geometry->indexCount, indexData);
+    return true;
+}
+
+bool MeshArena::Allocate(Geometry *geometry, GLuint source, GLintptr offset)
+{
+    if(!Place(geometry))
+        return false;
+
+    size_t vertexBytes = (size_t)layout.stride * geometry->vertexCount;
+    GLState::Get().BindBuffer(GL_COPY_READ_BUFFER, source);
+    if(vertexBytes > 0) {
+        GLState::Get().BindBuffer(GL_COPY_WRITE_BUFFER, VBO);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, offset, (size_t)layout.stride * geometry->baseVertex, vertexBytes);
+    }
+    if(geometry->indexCount > 0) {
+        GLState::Get().BindBuffer(GL_COPY_WRITE_BUFFER, IBO);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, offset + vertexBytes, (size_t)indexSize * geometry->firstIndex,
+                (size_t)indexSize * geometry->indexCount);
+    }
+    return true;
+}
+
+void MeshArena::Free(Geometry *geometry)
+{
+    if(geometries.erase(geometry) == 0)
+        return;
+
+    vertices.Free(geometry->baseVertex, geometry->vertexCount);
+    indices.Free(geometry->firstIndex, geometry->indexCount);
+}
+
+void MeshArena::Defragment()
+{
+    if(VAO != 0 && (!vertices.IsPacked() || !indices.IsPacked()))
+        Relocate(vertices.GetCapacity(), indices.GetCapacity());
+}
+
+void MeshArena::Bind()
+{
+    GLState::Get().BindVertexArray(VAO);
+}
+
+const VertexLayout &MeshArena::GetLayout()
+{
+    return layout;
+}
+
+GLenum MeshArena::GetIndexType()
+{
+    return indexType;
+}
+
+GLuint MeshArena::GetIndexSize()
+{
+    return indexSize;
+}
+
+unsigned int MeshArena::GetVertexCapacity()
+{
+    return vertices.GetCapacity();
+}
+
+unsigned int MeshArena::GetIndexCapacity()
+{
+    return indices.GetCapacity();
+}
+
+unsigned int MeshArena::GetUsedVertices()
+{
+    return vertices.GetUsed();
+}
+
+unsigned int MeshArena::GetUsedIndices()
+{
+    return indices.GetUsed();
+}
+
+unsigned int MeshArena::GetFreeRangeCount()
+{
+    return vertices.GetFreeRangeCount() + indices.GetFreeRangeCount();
+}
+
+unsigned int MeshArena::GetRelocationCount()
+{
+    return relocations;
+}
@@ -0,0 +1,114 @@
+#ifndef _MESH_ARENA_H_
+#define _MESH_ARENA_H_
+
+#include <map>
+#include <memory>
+#include <unordered_set>
+#include <utility>
+
+#include <GL/glew.h>
+
+#include "Geometry.hpp"
+#include "VertexLayout.hpp"
+
+// Initial arena sizes, in vertices and indices; the arena doubles as needed
+#define ARENA_VERTICES 65536
+#define ARENA_INDICES 196608
+
+// Largest arena, in vertices and indices: baseVertex is a GLint, and every
+// range is an unsigned int
+#define ARENA_MAX_VERTICES 0x7FFFFFFFu
+#define ARENA_MAX_INDICES 0xFFFFFFFFu
+
+// Vertex buffer binding points of the arena VAO
+#define ARENA_VERTEX_BINDING 0
+#define ARENA_INSTANCE_BINDING 1
+#define ARENA_DRAW_ID_BINDING 2
+
+// Attribute location of the per-draw index used by BatchRenderer
+#define ARENA_DRAW_ID_LOCATION 5
+
+// First-fit suballocator over [0, capacity) that merges neighbouring free
+// ranges when they are released
+class RangeAllocator {
+    private:
+        std::map<unsigned int, unsigned int> freeRanges; // offset -> size
+        unsigned int capacity, used;
+
+    public:
+        RangeAllocator();
+
+        // Everything below used is taken, the rest is one free range
+        void Reset(unsigned int capacity, unsigned int used);
+        bool Allocate(unsigned int size, unsigned int &offset);
+        void Free(unsigned int offset, unsigned int size);
+
+        unsigned int GetCapacity();
+        unsigned int GetUsed();
+        unsigned int GetFreeRangeCount();
+        // True when all free space is one range at the end
+        bool IsPacked();
+};
+
+// One vertex buffer, one index buffer and one VAO shared by every mesh with
+// the same vertex layout and index type; there is one arena per such pair.
+// A Geometry is a (baseVertex, firstIndex, count) range inside them, drawn
+// with glDrawElementsBaseVertex, so indices stay relative to the mesh and
+// ranges can move. Ranges freed by released meshes are reused; when no
+// free range is big enough the arena is compacted, and grown if that is not
+// enough either.
+class MeshArena {
+    private:
+        VertexLayout layout;
+        GLenum indexType;
+        GLuint indexSize;
+
+        GLuint VAO, VBO, IBO;
+        RangeAllocator vertices, indices;
+        std::unordered_set<Geometry *> geometries;
+        unsigned int relocations;
+
+        static std::map<std::pair<uint64_t, GLenum>, std::unique_ptr<MeshArena>> arenas;
+
+        MeshArena(const VertexLayout &layout, GLenum indexType);
+        void CreateVertexArray();
+        // Moves every live range into new buffers of the given capacities,
+        // packed from the start in their current order
+        void Relocate(unsigned int vertexCapacity, unsigned int indexCapacity);
+        bool TryAllocate(Geometry *geometry);
+        // Finds or makes room for geometry and records it as live; false
+        // when the arena cannot grow enough to hold it
+        bool Place(Geometry *geometry);
+
+    public:
+        static MeshArena &Get(const VertexLayout &layout, GLenum indexType);
+
+        // Places geometry->vertexCount vertices in this arena's layout and
+        // geometry->indexCount indices of its index type, filling in
+        // baseVertex and firstIndex. False, with nothing placed, when the
+        // arena would outgrow ARENA_MAX_VERTICES or ARENA_MAX_INDICES
+        bool Allocate(Geometry *geometry, const void *vertexData, const void *indexData);
+        // Same, copying the data on the GPU from source at offset, where the
+        // vertices are followed directly by the indices
+        bool Allocate(Geometry *geometry, GLuint source, GLintptr offset);
+        void Free(Geometry *geometry);
+
+        // Packs all ranges to the start of the buffers, leaving one free range
+        void Defragment();
+
+        // Binds the VAO; every arena mesh draws with it bound
+        void Bind();
+
+        const VertexLayout &GetLayout();
+        GLenum GetIndexType();
+        GLuint GetIndexSize();
+
+        unsigned int GetVertexCapacity();
+        unsigned int GetIndexCapacity();
+        unsigned int GetUsedVertices();
+        unsigned int GetUsedIndices();
+        unsigned int GetFreeRangeCount();
+        unsigned int GetRelocationCount();
+};
+
+#endif
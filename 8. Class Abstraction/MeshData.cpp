@@ -0,0 +1,170 @@
+#include "MeshData.hpp"
+#include "MeshOptimizer.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <unistd.h>
+
+// Header of a .mesh file. It is followed by attributeCount (semantic,
+// encoding) pairs, lodCount MeshLODs, the packed vertices and the indices
+class MeshFileHeader {
+    public:
+        char magic[4];
+        uint32_t version;
+        uint32_t attributeCount, vertexCount, indexCount, lodCount;
+};
+
+MeshData::MeshData()
+{
+    vertexCount = 0;
+}
+
+MeshData::MeshData(const VertexLayout &layout, const void *vertexData, unsigned int vertexCount,
+        const unsigned int *indices, unsigned int indexCount)
+{
+    this->layout = layout;
+    this->vertexCount = vertexCount;
+    const unsigned char *bytes = (const unsigned char *)vertexData;
+    vertices.assign(bytes, bytes + (size_t)layout.stride * vertexCount);
+    this->indices.assign(indices, indices + indexCount);
+    lods.push_back(MeshLOD{0, indexCount, 0.0f});
+}
+
+void MeshData::Optimize()
+{
+    indices.resize(lods[0].indexCount);
+    vertexCount = OptimizeMesh(layout, vertices, indices);
+    lods.resize(1);
+}
+
+void MeshData::GenerateLODs(unsigned int minTriangles, float reduction)
+{
+    indices.resize(lods[0].indexCount);
+    lods.resize(1);
+
+    std::vector<GLfloat> positions(3 * vertexCount);
+    for(unsigned int v = 0; v < vertexCount; ++v) {
+        if(!layout.ReadPosition(&vertices[(size_t)layout.stride * v], &positions[3 * v])) {
+            std::cout << "LODs need a float or half-float position" << std::endl;
+            return;
+        }
+    }
+
+    // Each LOD simplifies the previous one, so the errors add up
+    std::vector<unsigned int> previous(indices), simplified;
+    while(lods.size() < MESH_MAX_LODS && previous.size() / 3 > minTriangles) {
+        unsigned int target = (unsigned int)(previous.size() / 3 * reduction) * 3;
+        float error;
+        unsigned int count = SimplifyMesh(simplified, previous.data(), previous.size(), positions.data(), vertexCount,
+                target, error);
+        if(count == 0 || count > previous.size() * 0.9f)
+            break;
+
+        OptimizeVertexCache(simplified.data(), count, vertexCount);
+        lods.push_back(MeshLOD{(unsigned int)indices.size(), count, lods.back().error + error});
+        indices.insert(indices.end(), simplified.begin(), simplified.end());
+        previous.swap(simplified);
+    }
+}
+
+bool MeshData::Save(const std::string &path)
+{
+    MeshFileHeader header;
+    memcpy(header.magic, "MESH", 4);
+    header.version = MESH_FILE_VERSION;
+    header.attributeCount = layout.attributes.size();
+    header.vertexCount = vertexCount;
+    header.indexCount = indices.size();
+    header.lodCount = lods.size();
+
+    // Written through a per-process temporary file, as the shader cache is
+    std::string temporary = path + ".tmp." + std::to_string(getpid());
+    std::ofstream file(temporary, std::ios::binary);
+    if(!file.is_open()) {
+        std::cout << "Can't write mesh " << temporary << std::endl;
+        return false;
+    }
+    file.write((const char *)&header, sizeof(header));
+    for(size_t i = 0; i < layout.attributes.size(); ++i) {
+        uint32_t attribute[2] = {(uint32_t)layout.attributes[i].semantic, (uint32_t)layout.attributes[i].encoding};
+        file.write((const char *)attribute, sizeof(attribute));
+    }
+    file.write((const char *)lods.data(), sizeof(MeshLOD) * lods.size());
+    file.write((const char *)vertices.data(), vertices.size());
+    file.write((const char *)indices.data(), sizeof(unsigned int) * indices.size());
+    file.close();
+
+    if(!file || std::rename(temporary.c_str(), path.c_str())) {
+        std::remove(temporary.c_str());
+        std::cout << "Can't write mesh " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool MeshData::Load(const std::string &path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if(!file.is_open()) {
+        std::cout << "Can't open mesh " << path << std::endl;
+        return false;
+    }
+
+    MeshFileHeader header;
+    if(!file.read((char *)&header, sizeof(header)) || memcmp(header.magic, "MESH", 4) ||
+            header.version != MESH_FILE_VERSION || header.lodCount == 0) {
+        std::cout << "Not a version " << MESH_FILE_VERSION << " mesh file: " << path << std::endl;
+        return false;
+    }
+
+    layout = VertexLayout();
+    for(uint32_t i = 0; i < header.attributeCount; ++i) {
+        uint32_t attribute[2];
+        if(!file.read((char *)attribute, sizeof(attribute)) || attribute[0] > VERTEX_UV || attribute[1] > ENCODING_UNORM16) {
+            std::cout << "Bad vertex layout in " << path << std::endl;
+            return false;
+        }
+        layout.Add((VertexSemantic)attribute[0], (VertexEncoding)attribute[1]);
+    }
+
+    // Checked before anything is sized from the header, so a corrupt count
+    // fails here rather than in a huge allocation
+    std::streamoff start = file.tellg();
+    file.seekg(0, std::ios::end);
+    uint64_t remaining = file.tellg() - start;
+    file.seekg(start);
+    uint64_t needed = (uint64_t)sizeof(MeshLOD) * header.lodCount + (uint64_t)layout.stride * header.vertexCount +
+            (uint64_t)sizeof(unsigned int) * header.indexCount;
+    if(needed > remaining) {
+        std::cout << "Truncated mesh file " << path << std::endl;
+        return false;
+    }
+
+    vertexCount = header.vertexCount;
+    lods.resize(header.lodCount);
+    vertices.resize((size_t)layout.stride * vertexCount);
+    indices.resize(header.indexCount);
+    file.read((char *)lods.data(), sizeof(MeshLOD) * lods.size());
+    file.read((char *)vertices.data(), vertices.size());
+    file.read((char *)indices.data(), sizeof(unsigned int) * indices.size());
+    if(!file) {
+        std::cout << "Truncated mesh file " << path << std::endl;
+        return false;
+    }
+
+    for(size_t i = 0; i < lods.size(); ++i) {
+        if((size_t)lods[i].firstIndex + lods[i].indexCount > indices.size()) {
+            std::cout << "Bad LOD table in " << path << std::endl;
+            return false;
+        }
+    }
+    for(size_t i = 0; i < indices.size(); ++i) {
+        if(indices[i] >= vertexCount) {
+            std::cout << "Index out of range in " << path << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,51 @@
+#ifndef _MESH_DATA_H_
+#define _MESH_DATA_H_
+
+#include <string>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "VertexLayout.hpp"
+
+#define MESH_FILE_VERSION 1
+
+// Most LODs GenerateLODs builds, the base mesh included
+#define MESH_MAX_LODS 8
+
+// One level of detail: a range of MeshData::indices over the shared vertex
+// buffer. error is how far, in model units, its surface may be from the
+// base mesh
+class MeshLOD {
+    public:
+        unsigned int firstIndex, indexCount;
+        float error;
+};
+
+// CPU-side mesh: vertices packed with a layout, and the index lists of every
+// LOD one after another, the base mesh first. This is what the binary mesh
+// format (.mesh) stores, so a loaded mesh needs no processing before upload.
+class MeshData {
+    public:
+        VertexLayout layout;
+        std::vector<unsigned char> vertices;
+        unsigned int vertexCount;
+        std::vector<unsigned int> indices;
+        std::vector<MeshLOD> lods;
+
+        MeshData();
+        MeshData(const VertexLayout &layout, const void *vertexData, unsigned int vertexCount,
+                const unsigned int *indices, unsigned int indexCount);
+
+        // Runs OptimizeMesh on the base mesh; drops any LODs
+        void Optimize();
+        // Replaces the LODs after the base with a chain that roughly halves
+        // the triangle count each step, until simplification stalls or
+        // minTriangles is reached. Each LOD is reordered for the vertex cache
+        void GenerateLODs(unsigned int minTriangles = 32, float reduction = 0.5f);
+
+        bool Save(const std::string &path);
+        bool Load(const std::string &path);
+};
+
+#endif
@@ -0,0 +1,540 @@
+#include "MeshOptimizer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+
+#include <glm/glm.hpp>
+
+VertexCacheStats AnalyzeVertexCache(const unsigned int *indices, unsigned int indexCount, unsigned int vertexCount,
+        unsigned int cacheSize)
+{
+    // A FIFO cache only changes on a miss: a vertex is still cached if fewer
+    // than cacheSize misses happened since it was loaded
+    std::vector<unsigned int> loadedAt(vertexCount, 0);
+    std::vector<bool> referenced(vertexCount, false);
+    unsigned int misses = 0, unique = 0;
+
+    for(unsigned int i = 0; i < indexCount; ++i) {
+        unsigned int vertex = indices[i];
+        if(loadedAt[vertex] == 0 || misses - loadedAt[vertex] >= cacheSize)
+            loadedAt[vertex] = ++misses;
+        if(!referenced[vertex]) {
+            referenced[vertex] = true;
+            ++unique;
+        }
+    }
+
+    VertexCacheStats stats;
+    stats.acmr = indexCount ? (float)misses / (indexCount / 3) : 0;
+    stats.atvr = unique ? (float)misses / unique : 0;
+    return stats;
+}
+
+static uint64_t HashVertex(const unsigned char *vertex, size_t stride)
+{
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for(size_t i = 0; i < stride; ++i) {
+        hash ^= vertex[i];
+        hash *= 0x100000001B3ull;
+    }
+    return hash;
+}
+
+unsigned int GenerateVertexRemap(std::vector<unsigned int> &remap, const void *vertices, unsigned int vertexCount,
+        size_t stride, const unsigned int *indices, unsigned int indexCount)
+{
+    const unsigned char *bytes = (const unsigned char *)vertices;
+    remap.assign(vertexCount, ~0u);
+
+    // Open addressing over the first vertex seen with each content
+    size_t tableSize = 1;
+    while(tableSize < (size_t)vertexCount * 2)
+        tableSize *= 2;
+    std::vector<unsigned int> table(tableSize, ~0u);
+
+    unsigned int next = 0;
+    for(unsigned int i = 0; i < indexCount; ++i) {
+        unsigned int vertex = indices[i];
+        if(remap[vertex] != ~0u)
+            continue;
+
+        const unsigned char *data = bytes + stride * vertex;
+        size_t slot = HashVertex(data, stride) & (tableSize - 1);
+        while(table[slot] != ~0u && memcmp(bytes + stride * table[slot], data, stride) != 0)
+            slot = (slot + 1) & (tableSize - 1);
+
+        if(table[slot] == ~0u) {
+            table[slot] = vertex;
+            remap[vertex] = next++;
+        } else
+            remap[vertex] = remap[table[slot]];
+    }
+    return next;
+}
+
+unsigned int GenerateVertexFetchRemap(std::vector<unsigned int> &remap, const unsigned int *indices,
+        unsigned int indexCount, unsigned int vertexCount)
+{
+    remap.assign(vertexCount, ~0u);
+    unsigned int next = 0;
+    for(unsigned int i = 0; i < indexCount; ++i) {
+        if(remap[indices[i]] == ~0u)
+            remap[indices[i]] = next++;
+    }
+    return next;
+}
+
+void RemapVertices(void *destination, const void *vertices, unsigned int vertexCount, size_t stride,
+        const std::vector<unsigned int> &remap)
+{
+    for(unsigned int i = 0; i < vertexCount; ++i) {
+        if(remap[i] != ~0u)
+            memcpy((unsigned char *)destination + stride * remap[i], (const unsigned char *)vertices + stride * i, stride);
+    }
+}
+
+void RemapIndices(unsigned int *indices, unsigned int indexCount, const std::vector<unsigned int> &remap)
+{
+    for(unsigned int i = 0; i < indexCount; ++i)
+        indices[i] = remap[indices[i]];
+}
+
+void OptimizeVertexCache(unsigned int *indices, unsigned int indexCount, unsigned int vertexCount,
+        unsigned int cacheSize)
+{
+    unsigned int triangleCount = indexCount / 3;
+
+    // Triangles around each vertex, as offsets into one array
+    std::vector<unsigned int> liveTriangles(vertexCount, 0), adjacencyOffsets(vertexCount + 1, 0);
+    for(unsigned int i = 0; i < indexCount; ++i)
+        ++liveTriangles[indices[i]];
+    for(unsigned int v = 0; v < vertexCount; ++v)
+        adjacencyOffsets[v + 1] = adjacencyOffsets[v] + liveTriangles[v];
+    std::vector<unsigned int> adjacency(indexCount), filled(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+    for(unsigned int i = 0; i < indexCount; ++i)
+        adjacency[filled[indices[i]]++] = i / 3;
+
+    std::vector<unsigned int> cacheTime(vertexCount, 0), deadEnds, candidates;
+    std::vector<bool> emitted(triangleCount, false);
+    std::vector<unsigned int> output;
+    output.reserve(indexCount);
+    unsigned int time = cacheSize + 1, cursor = 0;
+
+    // Fans out from one vertex at a time, emitting all its remaining
+    // triangles, then moves to the candidate that will stay in the cache
+    // longest; if none qualifies it falls back to recently used vertices
+    // (the dead-end stack) and finally to the next vertex in input order
+    int fanning = triangleCount ? (int)indices[0] : -1;
+    while(fanning >= 0) {
+        candidates.clear();
+        for(unsigned int a = adjacencyOffsets[fanning]; a < adjacencyOffsets[fanning + 1]; ++a) {
+            unsigned int triangle = adjacency[a];
+            if(emitted[triangle])
+                continue;
+
+            for(int corner = 0; corner < 3; ++corner) {
+                unsigned int vertex = indices[triangle * 3 + corner];
+                output.push_back(vertex);
+                deadEnds.push_back(vertex);
+                candidates.push_back(vertex);
+                --liveTriangles[vertex];
+                if(time - cacheTime[vertex] > cacheSize)
+                    cacheTime[vertex] = time++;
+            }
+            emitted[triangle] = true;
+        }
+
+        int best = -1, bestPriority = -1;
+        for(size_t c = 0; c < candidates.size(); ++c) {
+            unsigned int vertex = candidates[c];
+            if(liveTriangles[vertex] == 0)
+                continue;
+
+            // Still cached after fanning it out: prefer the oldest entry
+            int priority = 0;
+            if(time - cacheTime[vertex] + 2 * liveTriangles[vertex] <= cacheSize)
+                priority = time - cacheTime[vertex];
+            if(priority > bestPriority) {
+                bestPriority = priority;
+                best = vertex;
+            }
+        }
+
+        if(best < 0) {
+            while(!deadEnds.empty() && best < 0) {
+                unsigned int vertex = deadEnds.back();
+                deadEnds.pop_back();
+                if(liveTriangles[vertex] > 0)
+                    best = vertex;
+            }
+            while(best < 0 && cursor < indexCount) {
+                if(liveTriangles[indices[cursor]] > 0)
+                    best = indices[cursor];
+                ++cursor;
+            }
+        }
+        fanning = best;
+    }
+
+    std::copy(output.begin(), output.end(), indices);
+}
+
+// FIFO cache simulation that can be emptied in constant time: a vertex is
+// cached if it was loaded after the last Reset and fewer than cacheSize
+// misses ago
+class CacheSimulator {
+    public:
+        std::vector<unsigned int> loadedAt;
+        unsigned int misses, resetAt, cacheSize;
+
+        CacheSimulator(unsigned int vertexCount, unsigned int cacheSize)
+        {
+            loadedAt.assign(vertexCount, 0);
+            misses = 0;
+            resetAt = 0;
+            this->cacheSize = cacheSize;
+        }
+
+        void Reset()
+        {
+            resetAt = misses;
+        }
+
+        // Returns the number of the triangle's vertices that missed
+        int Triangle(const unsigned int *triangle)
+        {
+            int missed = 0;
+            for(int corner = 0; corner < 3; ++corner) {
+                unsigned int vertex = triangle[corner];
+                if(loadedAt[vertex] <= resetAt || misses - loadedAt[vertex] >= cacheSize) {
+                    loadedAt[vertex] = ++misses;
+                    ++missed;
+                }
+            }
+            return missed;
+        }
+};
+
+void OptimizeOverdraw(unsigned int *indices, unsigned int indexCount, const GLfloat *positions,
+        unsigned int vertexCount, float threshold, unsigned int cacheSize)
+{
+    unsigned int triangleCount = indexCount / 3;
+    if(triangleCount == 0)
+        return;
+
+    // Hard boundaries: triangles whose three vertices all miss, which is
+    // where the cache order restarted
+    CacheSimulator cache(vertexCount, cacheSize);
+    std::vector<unsigned int> hardStarts;
+    for(unsigned int triangle = 0; triangle < triangleCount; ++triangle) {
+        if(cache.Triangle(indices + triangle * 3) == 3 || triangle == 0)
+            hardStarts.push_back(triangle);
+    }
+    hardStarts.push_back(triangleCount);
+
+    // Soft boundaries: cut a hard cluster as soon as the ACMR of the part
+    // since the last cut, from an empty cache, is within threshold of the
+    // ACMR of the whole hard cluster
+    std::vector<unsigned int> starts;
+    for(size_t h = 0; h + 1 < hardStarts.size(); ++h) {
+        unsigned int first = hardStarts[h], last = hardStarts[h + 1];
+        cache.Reset();
+        unsigned int clusterMisses = 0;
+        for(unsigned int triangle = first; triangle < last; ++triangle)
+            clusterMisses += cache.Triangle(indices + triangle * 3);
+        float clusterACMR = (float)clusterMisses / (last - first);
+
+        starts.push_back(first);
+        cache.Reset();
+        unsigned int start = first, partMisses = 0;
+        for(unsigned int triangle = first; triangle + 1 < last; ++triangle) {
+            partMisses += cache.Triangle(indices + triangle * 3);
+            if((float)partMisses / (triangle - start + 1) <= threshold * clusterACMR) {
+                start = triangle + 1;
+                partMisses = 0;
+                starts.push_back(start);
+                cache.Reset();
+            }
+        }
+    }
+    starts.push_back(triangleCount);
+
+    // Area-weighted centroid and summed normal of each cluster; the
+    // cross product of two edges is both
+    glm::vec3 meshCentroid(0.0f);
+    float meshArea = 0;
+    size_t clusterCount = starts.size() - 1;
+    std::vector<float> sortKeys(clusterCount);
+    std::vector<glm::vec3> centroids(clusterCount), normals(clusterCount);
+    for(size_t c = 0; c < clusterCount; ++c) {
+        glm::vec3 centroid(0.0f), normal(0.0f);
+        float area = 0;
+        for(unsigned int triangle = starts[c]; triangle < starts[c + 1]; ++triangle) {
+            const GLfloat *p0 = positions + 3 * indices[triangle * 3];
+            const GLfloat *p1 = positions + 3 * indices[triangle * 3 + 1];
+            const GLfloat *p2 = positions + 3 * indices[triangle * 3 + 2];
+            glm::vec3 a(p0[0], p0[1], p0[2]), b(p1[0], p1[1], p1[2]), d(p2[0], p2[1], p2[2]);
+            glm::vec3 cross = glm::cross(b - a, d - a);
+            float triangleArea = glm::length(cross);
+            centroid += (a + b + d) * (triangleArea / 3);
+            normal += cross;
+            area += triangleArea;
+        }
+        centroids[c] = area > 0 ? centroid / area : centroid;
+        normals[c] = glm::length(normal) > 0 ? glm::normalize(normal) : normal;
+        meshCentroid += centroid;
+        meshArea += area;
+    }
+    if(meshArea > 0)
+        meshCentroid /= meshArea;
+
+    for(size_t c = 0; c < clusterCount; ++c)
+        sortKeys[c] = glm::dot(centroids[c] - meshCentroid, normals[c]);
+
+    // Outward-facing clusters first; ties keep the cache order
+    std::vector<unsigned int> order(clusterCount);
+    for(size_t c = 0; c < clusterCount; ++c)
+        order[c] = c;
+    std::stable_sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b) {
+        return sortKeys[a] > sortKeys[b];
+    });
+
+    std::vector<unsigned int> sorted;
+    sorted.reserve(triangleCount * 3);
+    for(size_t o = 0; o < clusterCount; ++o)
+        sorted.insert(sorted.end(), indices + starts[order[o]] * 3, indices + starts[order[o] + 1] * 3);
+    std::copy(sorted.begin(), sorted.end(), indices);
+}
+
+unsigned int OptimizeMesh(const VertexLayout &layout, std::vector<unsigned char> &vertices,
+        std::vector<unsigned int> &indices)
+{
+    unsigned int vertexCount = vertices.size() / layout.stride, indexCount = indices.size();
+    std::vector<unsigned int> remap;
+    std::vector<unsigned char> remapped;
+
+    vertexCount = GenerateVertexRemap(remap, vertices.data(), vertexCount, layout.stride, indices.data(), indexCount);
+    remapped.resize((size_t)layout.stride * vertexCount);
+    RemapVertices(remapped.data(), vertices.data(), remap.size(), layout.stride, remap);
+    RemapIndices(indices.data(), indexCount, remap);
+    vertices.swap(remapped);
+
+    OptimizeVertexCache(indices.data(), indexCount, vertexCount);
+
+    std::vector<GLfloat> positions(3 * vertexCount);
+    bool hasPositions = true;
+    for(unsigned int v = 0; v < vertexCount && hasPositions; ++v)
+        hasPositions = layout.ReadPosition(&vertices[(size_t)layout.stride * v], &positions[3 * v]);
+    if(hasPositions)
+        OptimizeOverdraw(indices.data(), indexCount, positions.data(), vertexCount);
+
+    GenerateVertexFetchRemap(remap, indices.data(), indexCount, vertexCount);
+    remapped.resize(vertices.size());
+    RemapVertices(remapped.data(), vertices.data(), vertexCount, layout.stride, remap);
+    RemapIndices(indices.data(), indexCount, remap);
+    vertices.swap(remapped);
+    return vertexCount;
+}
+
+// Sum of squared distances to a set of area-weighted planes, as the
+// symmetric 4x4 matrix of a plane's (n, d) outer product
+class Quadric {
+    public:
+        double xx, xy, xz, xw, yy, yz, yw, zz, zw, ww;
+        double weight;
+
+        Quadric()
+        {
+            xx = xy = xz = xw = yy = yz = yw = zz = zw = ww = 0;
+            weight = 0;
+        }
+
+        void AddPlane(const glm::vec3 &normal, float distance, float area)
+        {
+            double a = normal.x, b = normal.y, c = normal.z, d = distance;
+            xx += area * a * a; xy += area * a * b; xz += area * a * c; xw += area * a * d;
+            yy += area * b * b; yz += area * b * c; yw += area * b * d;
+            zz += area * c * c; zw += area * c * d;
+            ww += area * d * d;
+            weight += area;
+        }
+
+        void Add(const Quadric &other)
+        {
+            xx += other.xx; xy += other.xy; xz += other.xz; xw += other.xw;
+            yy += other.yy; yz += other.yz; yw += other.yw;
+            zz += other.zz; zw += other.zw;
+            ww += other.ww;
+            weight += other.weight;
+        }
+
+        // Mean squared distance of p to the planes
+        double Evaluate(const GLfloat *p) const
+        {
+            double x = p[0], y = p[1], z = p[2];
+            double sum = xx * x * x + yy * y * y + zz * z * z + ww +
+                2 * (xy * x * y + xz * x * z + yz * y * z + xw * x + yw * y + zw * z);
+            return weight > 0 ? std::max(sum, 0.0) / weight : 0;
+        }
+};
+
+static glm::vec3 Position(const GLfloat *positions, unsigned int vertex)
+{
+    return glm::vec3(positions[3 * vertex], positions[3 * vertex + 1], positions[3 * vertex + 2]);
+}
+
+unsigned int SimplifyMesh(std::vector<unsigned int> &destination, const unsigned int *indices, unsigned int indexCount,
+        const GLfloat *positions, unsigned int vertexCount, unsigned int targetIndexCount, float &error)
+{
+    destination.assign(indices, indices + indexCount);
+    error = 0;
+
+    // Vertices that share a position with another vertex sit on a UV or
+    // normal seam; moving only one of them would tear the surface
+    std::vector<unsigned int> welded;
+    GenerateVertexRemap(welded, positions, vertexCount, sizeof(GLfloat) * 3, indices, indexCount);
+    std::vector<unsigned int> weldedUses(vertexCount, 0);
+    std::vector<bool> locked(vertexCount, false), seen(vertexCount, false);
+    for(unsigned int i = 0; i < indexCount; ++i) {
+        if(!seen[indices[i]]) {
+            seen[indices[i]] = true;
+            ++weldedUses[welded[indices[i]]];
+        }
+    }
+    for(unsigned int v = 0; v < vertexCount; ++v)
+        locked[v] = welded[v] != ~0u && weldedUses[welded[v]] > 1;
+
+    // Border edges, used by one triangle, fix both their vertices
+    auto edgeKey = [&](unsigned int a, unsigned int b) {
+        return (uint64_t)std::min(welded[a], welded[b]) << 32 | std::max(welded[a], welded[b]);
+    };
+    std::unordered_map<uint64_t, int> edgeUses;
+    for(unsigned int i = 0; i < indexCount; i += 3) {
+        for(int e = 0; e < 3; ++e)
+            ++edgeUses[edgeKey(indices[i + e], indices[i + (e + 1) % 3])];
+    }
+    for(unsigned int i = 0; i < indexCount; i += 3) {
+        for(int e = 0; e < 3; ++e) {
+            unsigned int a = indices[i + e], b = indices[i + (e + 1) % 3];
+            if(edgeUses[edgeKey(a, b)] == 1) {
+                locked[a] = true;
+                locked[b] = true;
+            }
+        }
+    }
+
+    std::vector<Quadric> quadrics(vertexCount);
+    for(unsigned int i = 0; i < indexCount; i += 3) {
+        glm::vec3 p0 = Position(positions, indices[i]), p1 = Position(positions, indices[i + 1]);
+        glm::vec3 p2 = Position(positions, indices[i + 2]);
+        glm::vec3 cross = glm::cross(p1 - p0, p2 - p0);
+        float area = glm::length(cross);
+        if(area <= 0)
+            continue;
+
+        glm::vec3 normal = cross / area;
+        for(int corner = 0; corner < 3; ++corner)
+            quadrics[indices[i + corner]].AddPlane(normal, -glm::dot(normal, p0), area);
+    }
+
+    class Collapse {
+        public:
+            unsigned int from, to;
+            double cost;
+    };
+    std::vector<Collapse> collapses;
+    std::vector<unsigned int> collapseTo(vertexCount), adjacencyOffsets, adjacency;
+    std::vector<bool> touched(vertexCount);
+
+    // Each pass collapses a set of edges with disjoint neighbourhoods, so
+    // the flip test of one never goes stale because of another
+    while(destination.size() > targetIndexCount) {
+        unsigned int count = destination.size();
+        adjacencyOffsets.assign(vertexCount + 1, 0);
+        for(unsigned int i = 0; i < count; ++i)
+            ++adjacencyOffsets[destination[i] + 1];
+        for(unsigned int v = 0; v < vertexCount; ++v)
+            adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+        adjacency.resize(count);
+        std::vector<unsigned int> filled(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+        for(unsigned int i = 0; i < count; ++i)
+            adjacency[filled[destination[i]]++] = i / 3;
+
+        collapses.clear();
+        for(unsigned int i = 0; i < count; i += 3) {
+            for(int e = 0; e < 3; ++e) {
+                unsigned int a = destination[i + e], b = destination[i + (e + 1) % 3];
+                for(int direction = 0; direction < 2; ++direction) {
+                    if(!locked[a]) {
+                        Quadric merged = quadrics[a];
+                        merged.Add(quadrics[b]);
+                        collapses.push_back(Collapse{a, b, merged.Evaluate(positions + 3 * b)});
+                    }
+                    std::swap(a, b);
+                }
+            }
+        }
+        std::sort(collapses.begin(), collapses.end(), [](const Collapse &x, const Collapse &y) {
+            return x.cost < y.cost;
+        });
+
+        // About two triangles go per collapse
+        unsigned int wanted = (count - targetIndexCount) / 6 + 1, done = 0;
+        for(unsigned int v = 0; v < vertexCount; ++v)
+            collapseTo[v] = v;
+        std::fill(touched.begin(), touched.end(), false);
+
+        for(size_t c = 0; c < collapses.size() && done < wanted; ++c) {
+            unsigned int from = collapses[c].from, to = collapses[c].to;
+            if(touched[from] || touched[to])
+                continue;
+
+            // Moving from onto to must not turn any remaining triangle over
+            bool flips = false;
+            glm::vec3 target = Position(positions, to);
+            for(unsigned int a = adjacencyOffsets[from]; a < adjacencyOffsets[from + 1] && !flips; ++a) {
+                const unsigned int *triangle = &destination[adjacency[a] * 3];
+                if(triangle[0] == to || triangle[1] == to || triangle[2] == to)
+                    continue;
+
+                glm::vec3 corners[3], moved[3];
+                for(int corner = 0; corner < 3; ++corner) {
+                    corners[corner] = Position(positions, triangle[corner]);
+                    moved[corner] = triangle[corner] == from ? target : corners[corner];
+                }
+                glm::vec3 before = glm::cross(corners[1] - corners[0], corners[2] - corners[0]);
+                glm::vec3 after = glm::cross(moved[1] - moved[0], moved[2] - moved[0]);
+                flips = glm::dot(before, after) <= 0;
+            }
+            if(flips)
+                continue;
+
+            collapseTo[from] = to;
+            quadrics[to].Add(quadrics[from]);
+            error = std::max(error, (float)sqrt(collapses[c].cost));
+            for(unsigned int a = adjacencyOffsets[from]; a < adjacencyOffsets[from + 1]; ++a) {
+                for(int corner = 0; corner < 3; ++corner)
+                    touched[destination[adjacency[a] * 3 + corner]] = true;
+            }
+            ++done;
+        }
+        if(done == 0)
+            break;
+
+        // Remap and drop the triangles that collapsed to a line
+        unsigned int kept = 0;
+        for(unsigned int i = 0; i < count; i += 3) {
+            unsigned int a = collapseTo[destination[i]], b = collapseTo[destination[i + 1]];
+            unsigned int d = collapseTo[destination[i + 2]];
+            if(a == b || b == d || a == d)
+                continue;
+            destination[kept++] = a;
+            destination[kept++] = b;
+            destination[kept++] = d;
+        }
+        destination.resize(kept);
+    }
+    return destination.size();
+}
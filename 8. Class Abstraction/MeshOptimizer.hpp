@@ -0,0 +1,77 @@
+#ifndef _MESH_OPTIMIZER_H_
+#define _MESH_OPTIMIZER_H_
+
+#include <cstddef>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "VertexLayout.hpp"
+
+// Post-transform cache size the optimiser targets; small enough to be a
+// safe assumption for any GPU
+#define OPTIMIZER_CACHE_SIZE 16
+
+// Vertex shader work for an index order with a FIFO post-transform cache:
+// ACMR is transformed vertices per triangle (0.5 is ideal for a large grid,
+// 3 is no reuse), ATVR is transformed vertices per referenced vertex (1 is
+// ideal)
+class VertexCacheStats {
+    public:
+        float acmr, atvr;
+};
+
+VertexCacheStats AnalyzeVertexCache(const unsigned int *indices, unsigned int indexCount, unsigned int vertexCount,
+        unsigned int cacheSize = OPTIMIZER_CACHE_SIZE);
+
+// Functions that reorder vertices produce a remap table, remap[old] = new,
+// with ~0u for vertices that are dropped; the table is applied to every
+// vertex stream with RemapVertices and to the indices with RemapIndices.
+// Each returns the new vertex count.
+
+// Merges vertices whose stride bytes are identical. New vertices are
+// numbered in order of first reference; unreferenced vertices are dropped
+unsigned int GenerateVertexRemap(std::vector<unsigned int> &remap, const void *vertices, unsigned int vertexCount,
+        size_t stride, const unsigned int *indices, unsigned int indexCount);
+// Numbers vertices in the order the indices first use them, so the vertex
+// fetch walks the buffer forwards; run it last
+unsigned int GenerateVertexFetchRemap(std::vector<unsigned int> &remap, const unsigned int *indices,
+        unsigned int indexCount, unsigned int vertexCount);
+
+// destination holds the new vertex count; it must not alias vertices
+void RemapVertices(void *destination, const void *vertices, unsigned int vertexCount, size_t stride,
+        const std::vector<unsigned int> &remap);
+void RemapIndices(unsigned int *indices, unsigned int indexCount, const std::vector<unsigned int> &remap);
+
+// Reorders triangles for the post-transform cache with Tipsify (Sander,
+// Nehab and Barczak, "Fast Triangle Reordering for Vertex Locality and
+// Reduced Overdraw"), which runs in linear time
+void OptimizeVertexCache(unsigned int *indices, unsigned int indexCount, unsigned int vertexCount,
+        unsigned int cacheSize = OPTIMIZER_CACHE_SIZE);
+// Splits a cache-optimised order into clusters and sorts them so triangles
+// facing away from the mesh centre draw first, letting the depth test reject
+// more of what is behind them. positions are xyz floats. A cluster is cut
+// wherever the cache restarts, or where its own ACMR so far is within
+// threshold of the whole cluster's, which keeps the ACMR increase close to
+// threshold. Front faces are counter-clockwise, as GL defaults to
+void OptimizeOverdraw(unsigned int *indices, unsigned int indexCount, const GLfloat *positions,
+        unsigned int vertexCount, float threshold = 1.05f, unsigned int cacheSize = OPTIMIZER_CACHE_SIZE);
+
+// Quadric error metric edge collapse (Garland and Heckbert) that moves a
+// vertex onto a neighbour, so the result indexes the same vertex buffer and
+// only needs a new index list. Collapses the cheapest edges until at most
+// targetIndexCount indices remain or no edge can collapse without flipping
+// a triangle. Border vertices and vertices on attribute seams (another
+// vertex at the same position) never move. error is set to the largest
+// distance between the result and the planes of the input. Returns the
+// number of indices written to destination
+unsigned int SimplifyMesh(std::vector<unsigned int> &destination, const unsigned int *indices, unsigned int indexCount,
+        const GLfloat *positions, unsigned int vertexCount, unsigned int targetIndexCount, float &error);
+
+// Runs every stage on vertices packed with layout: deduplication, cache
+// order, overdraw order (skipped unless the position is float or half
+// float) and fetch order. Returns the new vertex count
+unsigned int OptimizeMesh(const VertexLayout &layout, std::vector<unsigned char> &vertices,
+        std::vector<unsigned int> &indices);
+
+#endif
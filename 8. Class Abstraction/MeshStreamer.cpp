@@ -0,0 +1,283 @@
+#include "MeshStreamer.hpp"
+#include "GLState.hpp"
+#include "Geometry.hpp"
+#include "MeshArena.hpp"
+
+#include <cstring>
+#include <iostream>
+
+MeshStreamer::MeshStreamer()
+{
+    buffer = 0;
+    mapped = nullptr;
+    ringSize = 0;
+    frameBudget = 0;
+    head = 0;
+    tail = 0;
+    stopping = false;
+    inFlight = 0;
+    stagedBytes = 0;
+    directBytes = 0;
+    ringWaits = 0;
+}
+
+bool MeshStreamer::Create(size_t ringSize, size_t frameBudget)
+{
+    ClearStreamer();
+    this->ringSize = (ringSize + STREAM_ALIGNMENT - 1) / STREAM_ALIGNMENT * STREAM_ALIGNMENT;
+    this->frameBudget = frameBudget;
+
+    // Only ever written by the CPU and read by copies on the GPU
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glGenBuffers(1, &buffer);
+    GLState::Get().BindBuffer(GL_COPY_READ_BUFFER, buffer);
+    glBufferStorage(GL_COPY_READ_BUFFER, this->ringSize, NULL, flags);
+    mapped = (unsigned char *)glMapBufferRange(GL_COPY_READ_BUFFER, 0, this->ringSize, flags);
+    if(!mapped) {
+        std::cout << "Staging ring mapping failed!" << std::endl;
+        ClearStreamer();
+        return false;
+    }
+
+    stopping = false;
+    loader = std::thread(&MeshStreamer::LoaderLoop, this);
+    return true;
+}
+
+void MeshStreamer::LoaderLoop()
+{
+    while(true) {
+        std::unique_ptr<StreamRequest> request;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this]() { return stopping || !requests.empty(); });
+            if(stopping)
+                return;
+            request = std::move(requests.front());
+            requests.pop_front();
+        }
+
+        Stage(*request);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ready.push_back(std::move(request));
+        }
+        staged.notify_one();
+    }
+}
+
+void MeshStreamer::Stage(StreamRequest &request)
+{
+    MeshData &data = request.data;
+    request.ringStart = 0;
+    request.ringEnd = 0;
+    request.loaded = data.Load(request.path);
+    if(!request.loaded)
+        return;
+
+    // Everything the GL thread would otherwise do to the data happens here
+    request.bounds.FromVertices(data.layout, data.vertices.data(), data.vertexCount);
+    request.indexType = IndexTypeFor(data.vertexCount);
+    request.indices.resize((size_t)IndexSize(request.indexType) * data.indices.size());
+    if(request.indexType == GL_UNSIGNED_SHORT) {
+        GLushort *shortIndices = (GLushort *)request.indices.data();
+        for(size_t i = 0; i < data.indices.size(); ++i)
+            shortIndices[i] = (GLushort)data.indices[i];
+    } else
+        memcpy(request.indices.data(), data.indices.data(), request.indices.size());
+
+    size_t vertexBytes = data.vertices.size(), indexBytes = request.indices.size();
+    GeometryRegistry::Hash(data.vertices.data(), vertexBytes, request.indices.data(), indexBytes, request.hash, request.check);
+
+    size_t size = (vertexBytes + indexBytes + STREAM_ALIGNMENT - 1) / STREAM_ALIGNMENT * STREAM_ALIGNMENT;
+    if(size == 0 || size > ringSize)
+        return;
+
+    uint64_t start;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        // A range never wraps around; the rest of the ring is skipped instead
+        start = head;
+        if(start % ringSize + size > ringSize)
+            start += ringSize - start % ringSize;
+        if(start + size - tail > ringSize) {
+            ++ringWaits;
+            wake.wait(lock, [&]() { return stopping || start + size - tail <= ringSize; });
+            if(stopping)
+                return;
+        }
+        head = start + size;
+    }
+
+    // The range is the loader's alone until it is handed to the GL thread
+    unsigned char *target = mapped + start % ringSize;
+    memcpy(target, data.vertices.data(), vertexBytes);
+    memcpy(target + vertexBytes, request.indices.data(), indexBytes);
+    request.ringStart = start;
+    request.ringEnd = start + size;
+}
+
+void MeshStreamer::Release(bool wait)
+{
+    bool released = false;
+    while(!fences.empty()) {
+        GLenum status = wait ? glClientWaitSync(fences.front().first, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) :
+            glClientWaitSync(fences.front().first, 0, 0);
+        if(status == GL_TIMEOUT_EXPIRED) {
+            if(wait)
+                continue;
+            break;
+        }
+
+        glDeleteSync(fences.front().first);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tail = fences.front().second;
+        }
+        fences.pop_front();
+        released = true;
+    }
+    if(released)
+        wake.notify_one();
+}
+
+unsigned int MeshStreamer::Upload(size_t budget)
+{
+    std::vector<std::unique_ptr<StreamRequest>> batch;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t bytes = 0;
+        while(!ready.empty()) {
+            size_t size = ready.front()->data.vertices.size() + ready.front()->indices.size();
+            if(!batch.empty() && bytes + size > budget)
+                break;
+            bytes += size;
+            batch.push_back(std::move(ready.front()));
+            ready.pop_front();
+        }
+    }
+
+    uint64_t copiedUpTo = 0;
+    for(size_t i = 0; i < batch.size(); ++i) {
+        StreamRequest &request = *batch[i];
+        MeshData &data = request.data;
+        --inFlight;
+        if(!request.loaded)
+            continue;
+
+        size_t bytes = data.vertices.size() + request.indices.size();
+        if(request.ringEnd == request.ringStart) {
+            request.mesh->CreateMesh(data);
+            directBytes += bytes;
+            continue;
+        }
+
+        MeshArena &arena = MeshArena::Get(data.layout, request.indexType);
+        Geometry *geometry = GeometryRegistry::Get().Acquire(&arena, data.vertexCount, data.indices.size(),
+                request.hash, request.check, buffer, request.ringStart % ringSize);
+        request.mesh->CreateMesh(geometry, data.lods, request.bounds);
+        stagedBytes += bytes;
+        copiedUpTo = request.ringEnd;
+    }
+
+    // Ranges are staged and uploaded in the same order, so one fence covers
+    // every copy so far
+    if(copiedUpTo > 0)
+        fences.push_back(std::make_pair(glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), copiedUpTo));
+    return batch.size();
+}
+
+void MeshStreamer::Load(const std::string &path, Mesh *mesh)
+{
+    if(buffer == 0) {
+        mesh->CreateFromFile(path);
+        return;
+    }
+
+    std::unique_ptr<StreamRequest> request(new StreamRequest());
+    request->path = path;
+    request->mesh = mesh;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        requests.push_back(std::move(request));
+    }
+    ++inFlight;
+    wake.notify_one();
+}
+
+unsigned int MeshStreamer::Update()
+{
+    if(buffer == 0)
+        return 0;
+
+    Release(false);
+    return Upload(frameBudget);
+}
+
+void MeshStreamer::Finish()
+{
+    while(inFlight > 0) {
+        // The loader may be waiting for ring space only the GPU can return
+        Release(true);
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            staged.wait(lock, [this]() { return !ready.empty(); });
+        }
+        Upload(SIZE_MAX);
+    }
+}
+
+unsigned int MeshStreamer::GetPendingCount()
+{
+    return inFlight;
+}
+
+size_t MeshStreamer::GetStagedBytes()
+{
+    return stagedBytes;
+}
+
+size_t MeshStreamer::GetDirectBytes()
+{
+    return directBytes;
+}
+
+uint64_t MeshStreamer::GetRingWaitCount()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return ringWaits;
+}
+
+void MeshStreamer::ClearStreamer()
+{
+    if(loader.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        loader.join();
+    }
+    requests.clear();
+    ready.clear();
+    inFlight = 0;
+
+    for(size_t i = 0; i < fences.size(); ++i)
+        glDeleteSync(fences[i].first);
+    fences.clear();
+
+    if(buffer != 0) {
+        // Deleting a buffer unmaps it; copies already issued still complete
+        GLState::Get().DeleteBuffer(buffer);
+        buffer = 0;
+    }
+    mapped = nullptr;
+    head = 0;
+    tail = 0;
+}
+
+MeshStreamer::~MeshStreamer()
+{
+    ClearStreamer();
+}
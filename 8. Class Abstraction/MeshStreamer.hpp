@@ -0,0 +1,114 @@
+#ifndef _MESH_STREAMER_H_
+#define _MESH_STREAMER_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "Bounds.hpp"
+#include "Mesh.hpp"
+#include "MeshData.hpp"
+
+// Default staging ring size and bytes uploaded per frame
+#define STREAM_RING_SIZE (64 << 20)
+#define STREAM_FRAME_BUDGET (8 << 20)
+
+// Staged meshes start on cache lines, so the loader never writes a line
+// the previous mesh is still in
+#define STREAM_ALIGNMENT 64
+
+// Loads .mesh files on a background thread and uploads them without
+// stalling the frame. The loader thread reads and decodes each file, then
+// copies its vertices and indices straight into a persistently mapped
+// staging ring. Once a frame, Update copies staged meshes into their arena
+// on the GPU with glCopyBufferSubData, up to a byte budget, and fences the
+// copies; ring space goes back to the loader once its fence has signalled,
+// and the loader only waits when the ring is full. A mesh has no geometry
+// until Update has uploaded it, and must outlive its request.
+class MeshStreamer {
+    private:
+        class StreamRequest {
+            public:
+                std::string path;
+                Mesh *mesh;
+                MeshData data;
+                bool loaded;
+                // Indices in the arena's index type, as staged
+                GLenum indexType;
+                std::vector<unsigned char> indices;
+                Bounds bounds;
+                uint64_t hash, check;
+                // Range of the ring, as running byte counts; empty when the
+                // mesh is bigger than the ring and is uploaded directly
+                uint64_t ringStart, ringEnd;
+        };
+
+        GLuint buffer;
+        unsigned char *mapped;
+        size_t ringSize, frameBudget;
+        // Running byte counts: the loader has taken the ring up to head,
+        // and the GPU has finished reading it up to tail
+        uint64_t head, tail;
+        // Fence after each frame's copies, with the head they cover
+        std::deque<std::pair<GLsync, uint64_t>> fences;
+
+        std::thread loader;
+        std::mutex mutex;
+        // wake is for the loader: new requests or ring space; staged is for
+        // Finish: a mesh is ready to upload
+        std::condition_variable wake, staged;
+        std::deque<std::unique_ptr<StreamRequest>> requests, ready;
+        bool stopping;
+        unsigned int inFlight;
+
+        size_t stagedBytes, directBytes;
+        uint64_t ringWaits;
+
+        void LoaderLoop();
+        // Runs on the loader thread
+        void Stage(StreamRequest &request);
+        // Hands back ring space whose copies have finished; with wait, blocks
+        // until every copy has
+        void Release(bool wait);
+        unsigned int Upload(size_t budget);
+
+    public:
+        MeshStreamer();
+
+        // ringSize bounds how far the loader runs ahead of the uploads
+        bool Create(size_t ringSize = STREAM_RING_SIZE, size_t frameBudget = STREAM_FRAME_BUDGET);
+
+        // Queues path to be loaded into mesh. Without Create it loads now
+        void Load(const std::string &path, Mesh *mesh);
+        // Call once a frame on the GL thread. Uploads staged meshes in the
+        // order they were queued until the budget is spent, though always at
+        // least one; returns how many meshes were finished, failed loads
+        // included
+        unsigned int Update();
+        // Uploads everything queued, ignoring the budget
+        void Finish();
+
+        // Meshes queued and not yet uploaded
+        unsigned int GetPendingCount();
+        // Bytes copied through the ring, and bytes of meshes too big for it
+        size_t GetStagedBytes();
+        size_t GetDirectBytes();
+        // Times the loader found the ring full
+        uint64_t GetRingWaitCount();
+
+        // Drops every request not yet uploaded
+        void ClearStreamer();
+
+        ~MeshStreamer();
+};
+
+#endif
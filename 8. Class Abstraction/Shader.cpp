@@ -1,16 +1,58 @@
 #include "Shader.hpp"
+#include "GLState.hpp"
+
+#include <cstdio>
+#include <vector>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SHADER_CACHE_VERSION 1
+
+// Header of a cached program binary file
+class ProgramBinaryHeader
+{
+public:
+    char magic[4];
+    uint32_t version;
+    uint64_t key;
+    uint32_t format, length;
+};
+
+std::string Shader::cacheDirectory;
+unsigned int Shader::cacheHits = 0, Shader::cacheMisses = 0;
 
 Shader::Shader()
 {
     shaderID = 0;
     uniformModel = 0;
+    stageIDs[0] = 0;
+    stageIDs[1] = 0;
+    pending = false;
+    cacheKey = 0;
+    next = nullptr;
 }
 
 void Shader::CreateFromFiles(const char *vertexFile, const char *fragmentFile)
 {
+    BeginCreateFromFiles(vertexFile, fragmentFile);
+    FinishCreate();
+}
+
+void Shader::BeginCreateFromFiles(const char *vertexFile, const char *fragmentFile)
+{
+    this->vertexFile = vertexFile;
+    this->fragmentFile = fragmentFile;
+
     std::string vShaderSrc = ReadFile(vertexFile);
     std::string fShaderSrc = ReadFile(fragmentFile);
-    CreateFromString(vShaderSrc.c_str(), fShaderSrc.c_str());
+    BeginCreateFromString(vShaderSrc.c_str(), fShaderSrc.c_str());
+}
+
+void Shader::CreateComputeFromFile(const char *computeFile)
+{
+    std::string source = ReadFile(computeFile);
+    BeginCompile(source.c_str(), nullptr);
+    FinishCompile();
 }
 
 std::string Shader::ReadFile(const char *filePath)
@@ -35,10 +77,52 @@ std::string Shader::ReadFile(const char *filePath)
 
 void Shader::CreateFromString(const char *vertexCode, const char *fragmentCode)
 {
-    CompileShader(vertexCode, fragmentCode);
+    BeginCompile(vertexCode, fragmentCode);
+    FinishCompile();
+}
+
+void Shader::BeginCreateFromString(const char *vertexCode, const char *fragmentCode)
+{
+    BeginCompile(vertexCode, fragmentCode);
+}
+
+bool Shader::IsReady()
+{
+    if(!pending)
+        return true;
+
+    // Without the extension any status query blocks, so report ready and
+    // let FinishCreate do the waiting
+    if(!HasParallelCompile())
+        return true;
+
+    GLint done = 0;
+    glGetProgramiv(shaderID, GL_COMPLETION_STATUS_KHR, &done);
+    return done;
+}
+
+bool Shader::FinishCreate()
+{
+    return FinishCompile();
+}
+
+bool Shader::HasParallelCompile()
+{
+    static int supported = -1;
+    if(supported < 0)
+        supported = GLEW_KHR_parallel_shader_compile || GLEW_ARB_parallel_shader_compile;
+    return supported;
+}
+
+void Shader::SetCompilerThreads(unsigned int count)
+{
+    if(GLEW_KHR_parallel_shader_compile)
+        glMaxShaderCompilerThreadsKHR(count);
+    else if(GLEW_ARB_parallel_shader_compile)
+        glMaxShaderCompilerThreadsARB(count);
 }
 
-void Shader::AddShader(GLuint theProgram, const char *shaderCode, GLenum shaderType)
+GLuint Shader::AddShader(GLuint theProgram, const char *shaderCode, GLenum shaderType)
 {
     GLuint theShader = glCreateShader(shaderType);
 
@@ -47,19 +131,99 @@ void Shader::AddShader(GLuint theProgram, const char *shaderCode, GLenum shaderT
     glShaderSource(theShader, 1, theCode, &codeLength);
     glCompileShader(theShader);
 
+    // The compile status is checked in FinishCompile, so the driver can
+    // keep compiling while the caller moves on
+    glAttachShader(theProgram, theShader);
+    return theShader;
+}
+
+uint64_t Shader::CacheKey(const char *vertexCode, const char *fragmentCode)
+{
+    // FNV-1a over the driver strings and both sources, each ended by its NUL
+    // so no two different inputs run together into the same bytes
+    const char *parts[] = {
+        (const char *)glGetString(GL_VENDOR),
+        (const char *)glGetString(GL_RENDERER),
+        (const char *)glGetString(GL_VERSION),
+        vertexCode,
+        fragmentCode
+    };
+
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for(int part = 0; part < 5; ++part) {
+        const char *c = parts[part] ? parts[part] : "";
+        do {
+            hash ^= (unsigned char)*c;
+            hash *= 0x100000001B3ull;
+        } while(*c++);
+    }
+    return hash;
+}
+
+bool Shader::LoadProgramBinary(const std::string &path, uint64_t key)
+{
+    std::ifstream file(path, std::ios::binary);
+    if(!file.is_open())
+        return false;
+
+    ProgramBinaryHeader header;
+    if(!file.read((char *)&header, sizeof(header)) || memcmp(header.magic, "GLPB", 4) ||
+            header.version != SHADER_CACHE_VERSION || header.key != key)
+        return false;
+
+    // A corrupt length must not size the allocation; the entry is simply
+    // rebuilt like any other miss
+    std::streamoff start = file.tellg();
+    file.seekg(0, std::ios::end);
+    std::streamoff remaining = file.tellg() - start;
+    file.seekg(start);
+    if(header.length == 0 || (std::streamoff)header.length > remaining)
+        return false;
+
+    std::vector<char> binary(header.length);
+    if(!file.read(binary.data(), binary.size()))
+        return false;
+
+    // The driver rejects binaries it can no longer use, e.g. after an update
+    glProgramBinary(shaderID, header.format, binary.data(), binary.size());
     GLint result = 0;
-    GLchar elog[1024] = { 0 };
-    glGetShaderiv(theShader, GL_COMPILE_STATUS, &result);
-    if(!result) {
-        glGetShaderInfoLog(theShader, sizeof(elog), NULL, elog);
-        std::cout << "Error compiling" << shaderType << "shader : " << elog << std::endl;
+    glGetProgramiv(shaderID, GL_LINK_STATUS, &result);
+    return result;
+}
+
+void Shader::SaveProgramBinary(const std::string &path, uint64_t key)
+{
+    GLint length = 0;
+    glGetProgramiv(shaderID, GL_PROGRAM_BINARY_LENGTH, &length);
+    if(length <= 0)
         return;
-    }
 
-    glAttachShader(theProgram, theShader);
+    ProgramBinaryHeader header;
+    memcpy(header.magic, "GLPB", 4);
+    header.version = SHADER_CACHE_VERSION;
+    header.key = key;
+    std::vector<char> binary(length);
+    GLsizei written = 0;
+    glGetProgramBinary(shaderID, length, &written, &header.format, binary.data());
+    header.length = written;
+
+    // Write to a temporary file and rename it, so a concurrent or crashed
+    // writer never leaves a truncated entry behind. The name is per process,
+    // so two processes saving the same entry never write the same file
+    std::string temporary = path + ".tmp." + std::to_string(getpid());
+    std::ofstream file(temporary, std::ios::binary);
+    if(!file.is_open()) {
+        std::cout << "Can't write shader cache " << temporary << std::endl;
+        return;
+    }
+    file.write((const char *)&header, sizeof(header));
+    file.write(binary.data(), written);
+    file.close();
+    if(!file || std::rename(temporary.c_str(), path.c_str()))
+        std::remove(temporary.c_str());
 }
 
-void Shader::CompileShader(const char *vertexCode, const char *fragmentCode)
+void Shader::BeginCompile(const char *vertexCode, const char *fragmentCode)
 {
     shaderID = glCreateProgram();
     if(!shaderID) {
@@ -67,18 +231,76 @@ void Shader::CompileShader(const char *vertexCode, const char *fragmentCode)
         return;
     }
 
-    AddShader(shaderID, vertexCode, GL_VERTEX_SHADER);
-    AddShader(shaderID, fragmentCode, GL_FRAGMENT_SHADER);
+    cachePath.clear();
+    if(!cacheDirectory.empty()) {
+        cacheKey = CacheKey(vertexCode, fragmentCode);
+        char name[32];
+        snprintf(name, sizeof(name), "/%016llx.bin", (unsigned long long)cacheKey);
+        cachePath = cacheDirectory + name;
+
+        if(LoadProgramBinary(cachePath, cacheKey)) {
+            ++cacheHits;
+            cachePath.clear();
+            uniformModel = glGetUniformLocation(shaderID, "model");
+            return;
+        }
+
+        // A failed glProgramBinary leaves the program unlinked; start over
+        ++cacheMisses;
+        glDeleteProgram(shaderID);
+        shaderID = glCreateProgram();
+        glProgramParameteri(shaderID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+
+    // No fragment code means a compute program
+    if(fragmentCode) {
+        stageIDs[0] = AddShader(shaderID, vertexCode, GL_VERTEX_SHADER);
+        stageIDs[1] = AddShader(shaderID, fragmentCode, GL_FRAGMENT_SHADER);
+    } else
+        stageIDs[0] = AddShader(shaderID, vertexCode, GL_COMPUTE_SHADER);
+
+    // A link of stages that failed to compile just fails; the compile log
+    // is reported first in FinishCompile
+    glLinkProgram(shaderID);
+    pending = true;
+}
+
+bool Shader::FinishCompile()
+{
+    if(!pending)
+        return shaderID != 0;
+    pending = false;
 
     GLint result = 0;
     GLchar elog[1024] = { 0 };
+    bool compiled = true;
+
+    for(int stage = 0; stage < 2; ++stage) {
+        if(stageIDs[stage] == 0)
+            continue;
+
+        glGetShaderiv(stageIDs[stage], GL_COMPILE_STATUS, &result);
+        if(!result) {
+            GLint stageType = 0;
+            glGetShaderiv(stageIDs[stage], GL_SHADER_TYPE, &stageType);
+            glGetShaderInfoLog(stageIDs[stage], sizeof(elog), NULL, elog);
+            std::cout << "Error compiling" << stageType << "shader : " << elog << std::endl;
+            compiled = false;
+        }
+
+        // The linked program no longer needs the stage objects
+        glDetachShader(shaderID, stageIDs[stage]);
+        glDeleteShader(stageIDs[stage]);
+        stageIDs[stage] = 0;
+    }
+    if(!compiled)
+        return false;
 
-    glLinkProgram(shaderID);
     glGetProgramiv(shaderID, GL_LINK_STATUS, &result);
     if(!result) {
         glGetProgramInfoLog(shaderID, sizeof(elog), NULL, elog);
         std::cout << "Error linking shader : " << elog << std::endl;
-        return;
+        return false;
     }
 
     glValidateProgram(shaderID);
@@ -86,32 +308,142 @@ void Shader::CompileShader(const char *vertexCode, const char *fragmentCode)
     if(!result) {
         glGetProgramInfoLog(shaderID, sizeof(elog), NULL, elog);
         std::cout << "Error validating shader : " << elog << std::endl;
-        return;
+        return false;
     }
 
     uniformModel = glGetUniformLocation(shaderID, "model");
+
+    if(!cachePath.empty())
+        SaveProgramBinary(cachePath, cacheKey);
+    return true;
 }
 
 GLuint Shader::GetModelLocation()
 {
+    if(pending)
+        FinishCreate();
     return uniformModel;
 }
 
+GLint Shader::GetUniformLocation(const char *name)
+{
+    if(pending)
+        FinishCreate();
+    return glGetUniformLocation(shaderID, name);
+}
+
+void Shader::BindUniformBlock(const char *blockName, GLuint binding)
+{
+    bool known = false;
+    for(size_t i = 0; i < blockBindings.size(); ++i) {
+        if(blockBindings[i].first == blockName) {
+            blockBindings[i].second = binding;
+            known = true;
+        }
+    }
+    if(!known)
+        blockBindings.push_back(std::make_pair(std::string(blockName), binding));
+
+    GLuint blockIndex = glGetUniformBlockIndex(shaderID, blockName);
+    if(blockIndex == GL_INVALID_INDEX) {
+        std::cout << "No uniform block " << blockName << " in shader" << std::endl;
+        return;
+    }
+
+    glUniformBlockBinding(shaderID, blockIndex, binding);
+}
+
 void Shader::UseShader()
 {
-    glUseProgram(shaderID);
+    if(pending)
+        FinishCreate();
+
+    GLState::Get().UseProgram(shaderID);
+}
+
+void Shader::BeginReload()
+{
+    if(vertexFile.empty())
+        return;
+
+    // A newer edit replaces a build that has not been swapped in yet
+    delete next;
+    next = new Shader();
+    next->BeginCreateFromFiles(vertexFile.c_str(), fragmentFile.c_str());
+}
+
+bool Shader::SwapIfReady()
+{
+    if(!next || !next->IsReady())
+        return false;
+
+    bool built = next->FinishCreate();
+    if(built) {
+        for(size_t i = 0; i < blockBindings.size(); ++i)
+            next->BindUniformBlock(blockBindings[i].first.c_str(), blockBindings[i].second);
+
+        // next takes the old program with it
+        std::swap(shaderID, next->shaderID);
+        std::swap(uniformModel, next->uniformModel);
+        std::cout << "Reloaded shader " << vertexFile << ", " << fragmentFile << std::endl;
+    } else
+        std::cout << "Keeping the previous " << vertexFile << ", " << fragmentFile << std::endl;
+
+    delete next;
+    next = nullptr;
+    return built;
+}
+
+const std::string &Shader::GetVertexFile()
+{
+    return vertexFile;
+}
+
+const std::string &Shader::GetFragmentFile()
+{
+    return fragmentFile;
 }
 
 void Shader::ClearShader()
 {
+    delete next;
+    next = nullptr;
+
+    for(int stage = 0; stage < 2; ++stage) {
+        if(stageIDs[stage] != 0) {
+            glDeleteShader(stageIDs[stage]);
+            stageIDs[stage] = 0;
+        }
+    }
+    pending = false;
+
     if(shaderID != 0) {
-        glDeleteProgram(shaderID);
+        GLState::Get().DeleteProgram(shaderID);
         shaderID = 0;
     }
     
     uniformModel = 0;
 }
 
+void Shader::SetCacheDirectory(const char *directory)
+{
+    cacheDirectory = directory ? directory : "";
+
+    // An existing directory is fine; any other failure shows up on save
+    if(directory)
+        mkdir(directory, 0755);
+}
+
+unsigned int Shader::GetCacheHits()
+{
+    return cacheHits;
+}
+
+unsigned int Shader::GetCacheMisses()
+{
+    return cacheMisses;
+}
+
 Shader::~Shader()
 {
     ClearShader();
@@ -1,7 +1,14 @@
+#ifndef _SHADER_H_
+#define _SHADER_H_
+
 #include <stdio.h>
 #include <cstring>
 #include <iostream>
 #include <fstream>
+#include <string>
+#include <cstdint>
+#include <utility>
+#include <vector>
 
 #include <GL/glew.h>
 
@@ -14,15 +21,71 @@ public:
     void CreateFromString(const char *vertexCode, const char *fragmentCode);
     void CreateFromFiles(const char *vertexFile, const char *fragmentFile);
     
+    // Asynchronous build: Begin* hands the sources to the driver without
+    // waiting on any status, so many programs can compile at once; IsReady
+    // polls without blocking and FinishCreate waits and reports errors.
+    // Without HasParallelCompile IsReady is always true and the compile and
+    // link happen in FinishCreate. UseShader finishes a pending build itself
+    void BeginCreateFromString(const char *vertexCode, const char *fragmentCode);
+    void BeginCreateFromFiles(const char *vertexFile, const char *fragmentFile);
+    bool IsReady();
+    bool FinishCreate();
+    
+    // A program with a single compute stage; it is not hot reloaded
+    void CreateComputeFromFile(const char *computeFile);
+    
+    // GL_KHR_parallel_shader_compile (or the ARB version): background
+    // compiler threads, and completion queries that do not block
+    static bool HasParallelCompile();
+    static void SetCompilerThreads(unsigned int count);
+    
     GLuint GetModelLocation();
+    GLint GetUniformLocation(const char *name);
+    // Points the named uniform block at a buffer binding (see UniformRing)
+    void BindUniformBlock(const char *blockName, GLuint binding);
     
     void UseShader();
     void ClearShader();
     
+    // Hot reload of a shader created from files: BeginReload builds a new
+    // program from the current files, SwapIfReady puts it in place once it
+    // is linked. The build only runs in the background with
+    // HasParallelCompile; without it SwapIfReady builds it on the spot. A
+    // build that fails keeps the old program
+    void BeginReload();
+    bool SwapIfReady();
+    const std::string &GetVertexFile();
+    const std::string &GetFragmentFile();
+    
+    // Linked programs are kept in directory as driver binaries, keyed by the
+    // sources and the driver, and reloaded instead of compiled when they
+    // match. nullptr (the default) turns the cache off
+    static void SetCacheDirectory(const char *directory);
+    static unsigned int GetCacheHits();
+    static unsigned int GetCacheMisses();
+    
 private:
     GLuint shaderID, uniformModel;
+    GLuint stageIDs[2];
+    bool pending;
+    std::string cachePath;
+    uint64_t cacheKey;
+    
+    std::string vertexFile, fragmentFile;
+    Shader *next;
+    // Block bindings to carry over to a reloaded program
+    std::vector<std::pair<std::string, GLuint>> blockBindings;
     
-    void CompileShader(const char *vertexCode, const char *fragmentCode);
-    void AddShader(GLuint theProgram, const char *shaderCode, GLenum shaderType);
+    static std::string cacheDirectory;
+    static unsigned int cacheHits, cacheMisses;
+    
+    void BeginCompile(const char *vertexCode, const char *fragmentCode);
+    bool FinishCompile();
+    uint64_t CacheKey(const char *vertexCode, const char *fragmentCode);
+    bool LoadProgramBinary(const std::string &path, uint64_t key);
+    void SaveProgramBinary(const std::string &path, uint64_t key);
+    GLuint AddShader(GLuint theProgram, const char *shaderCode, GLenum shaderType);
     std::string ReadFile(const char *filePath);
 };
+
+#endif
@@ -0,0 +1,95 @@
+#include "ShaderWatcher.hpp"
+
+#include <iostream>
+#include <set>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+ShaderWatcher::ShaderWatcher()
+{
+    inotifyFD = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(inotifyFD < 0)
+        std::cout << "inotify unavailable, shaders will not be reloaded" << std::endl;
+}
+
+bool ShaderWatcher::WatchFile(const std::string &path, Shader *shader)
+{
+    size_t slash = path.rfind('/');
+    std::string directory = slash == std::string::npos ? "." : path.substr(0, slash);
+    std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+
+    auto it = directories.find(directory);
+    if(it == directories.end()) {
+        // Not IN_CREATE: a new file is still empty then, and its closing
+        // write or rename follows anyway
+        int watch = inotify_add_watch(inotifyFD, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+        if(watch < 0) {
+            std::cout << "Can't watch " << directory << std::endl;
+            return false;
+        }
+        it = directories.insert(std::make_pair(directory, watch)).first;
+    }
+
+    WatchedFile file;
+    file.watch = it->second;
+    file.name = name;
+    file.shader = shader;
+    files.push_back(file);
+    return true;
+}
+
+bool ShaderWatcher::Watch(Shader *shader)
+{
+    if(inotifyFD < 0 || shader->GetVertexFile().empty())
+        return false;
+
+    if(!WatchFile(shader->GetVertexFile(), shader))
+        return false;
+    if(!WatchFile(shader->GetFragmentFile(), shader)) {
+        // The vertex file's entry would reload a shader nobody swaps in
+        files.pop_back();
+        return false;
+    }
+    shaders.push_back(shader);
+    return true;
+}
+
+int ShaderWatcher::Poll()
+{
+    if(inotifyFD < 0)
+        return 0;
+
+    // Several events for one save (a write, then a rename) start one rebuild
+    std::set<Shader *> changed;
+    alignas(inotify_event) char buffer[4096];
+    ssize_t length;
+    while((length = read(inotifyFD, buffer, sizeof(buffer))) > 0) {
+        for(char *p = buffer; p < buffer + length; p += sizeof(inotify_event) + ((inotify_event *)p)->len) {
+            inotify_event *event = (inotify_event *)p;
+            if(event->len == 0)
+                continue;
+
+            for(size_t i = 0; i < files.size(); ++i) {
+                if(files[i].watch == event->wd && files[i].name == event->name)
+                    changed.insert(files[i].shader);
+            }
+        }
+    }
+
+    for(auto it = changed.begin(); it != changed.end(); ++it)
+        (*it)->BeginReload();
+
+    int swapped = 0;
+    for(size_t i = 0; i < shaders.size(); ++i) {
+        if(shaders[i]->SwapIfReady())
+            ++swapped;
+    }
+    return swapped;
+}
+
+ShaderWatcher::~ShaderWatcher()
+{
+    // Closing the descriptor drops every watch
+    if(inotifyFD >= 0)
+        close(inotifyFD);
+}
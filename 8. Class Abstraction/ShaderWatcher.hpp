@@ -0,0 +1,45 @@
+#ifndef _SHADER_WATCHER_H_
+#define _SHADER_WATCHER_H_
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "Shader.hpp"
+
+// Watches the source files of shaders with inotify and hot-reloads them.
+// The directories are watched rather than the files, because editors often
+// save by writing a new file and renaming it over the old one. Poll is
+// called once per frame, before drawing: it starts a rebuild for every
+// shader whose files changed and swaps in the rebuilds that have finished,
+// so a frame always draws with one complete program. Poll only avoids a
+// hitch with Shader::HasParallelCompile; without it a changed shader is
+// compiled and linked inside that frame's Poll.
+class ShaderWatcher {
+    private:
+        class WatchedFile {
+            public:
+                int watch;
+                std::string name;
+                Shader *shader;
+        };
+
+        int inotifyFD;
+        std::map<std::string, int> directories;
+        std::vector<WatchedFile> files;
+        std::vector<Shader *> shaders;
+
+        bool WatchFile(const std::string &path, Shader *shader);
+
+    public:
+        ShaderWatcher();
+
+        // The shader must have been created from files
+        bool Watch(Shader *shader);
+        // Returns the number of shaders swapped in this frame
+        int Poll();
+
+        ~ShaderWatcher();
+};
+
+#endif
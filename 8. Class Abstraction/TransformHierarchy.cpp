@@ -0,0 +1,250 @@
+#include "TransformHierarchy.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+#include <immintrin.h>
+
+#define LOCAL_DIRTY 1
+#define WORLD_CHANGED 2
+
+TransformHierarchy::TransformHierarchy()
+{
+    firstDirty = 0;
+    simd = true;
+}
+
+unsigned int TransformHierarchy::AddNode(int parent)
+{
+    unsigned int node = parents.size();
+    if(parent >= (int)node) {
+        std::cout << "Transform parent " << parent << " does not exist yet; adding a root" << std::endl;
+        parent = TRANSFORM_NO_PARENT;
+    }
+
+    parents.push_back(parent);
+    firstChildren.push_back(TRANSFORM_NO_PARENT);
+    nextSiblings.push_back(TRANSFORM_NO_PARENT);
+    if(parent != TRANSFORM_NO_PARENT) {
+        nextSiblings[node] = firstChildren[parent];
+        firstChildren[parent] = node;
+    }
+    translations.push_back(glm::vec3(0.0f));
+    rotations.push_back(glm::quat());
+    scales.push_back(glm::vec3(1.0f));
+    locals.push_back(glm::mat4(1.0f));
+    worlds.push_back(glm::mat4(1.0f));
+    flags.push_back(0);
+    MarkDirty(node);
+    return node;
+}
+
+void TransformHierarchy::Clear()
+{
+    parents.clear();
+    firstChildren.clear();
+    nextSiblings.clear();
+    translations.clear();
+    rotations.clear();
+    scales.clear();
+    locals.clear();
+    worlds.clear();
+    flags.clear();
+    dirtyNodes.clear();
+    firstDirty = 0;
+}
+
+void TransformHierarchy::MarkDirty(unsigned int node)
+{
+    if(!(flags[node] & LOCAL_DIRTY))
+        dirtyNodes.push_back(node);
+    flags[node] |= LOCAL_DIRTY;
+    firstDirty = std::min(firstDirty, node);
+}
+
+void TransformHierarchy::SetTranslation(unsigned int node, const glm::vec3 &translation)
+{
+    translations[node] = translation;
+    MarkDirty(node);
+}
+
+void TransformHierarchy::SetRotation(unsigned int node, const glm::quat &rotation)
+{
+    rotations[node] = rotation;
+    MarkDirty(node);
+}
+
+void TransformHierarchy::SetScale(unsigned int node, const glm::vec3 &scale)
+{
+    scales[node] = scale;
+    MarkDirty(node);
+}
+
+const glm::vec3 &TransformHierarchy::GetTranslation(unsigned int node)
+{
+    return translations[node];
+}
+
+const glm::quat &TransformHierarchy::GetRotation(unsigned int node)
+{
+    return rotations[node];
+}
+
+const glm::vec3 &TransformHierarchy::GetScale(unsigned int node)
+{
+    return scales[node];
+}
+
+int TransformHierarchy::GetParent(unsigned int node)
+{
+    return parents[node];
+}
+
+void TransformHierarchy::SetSIMD(bool enabled)
+{
+    simd = enabled;
+}
+
+// Each column of parent * local is a sum of the parent's columns weighted
+// by the local column, added left to right as glm does
+static void MultiplyScalar(const glm::mat4 &parent, const glm::mat4 &local, glm::mat4 &world)
+{
+    world = parent * local;
+}
+
+static void MultiplySSE(const glm::mat4 &parent, const glm::mat4 &local, glm::mat4 &world)
+{
+    const float *a = &parent[0][0], *b = &local[0][0];
+    float *out = &world[0][0];
+    __m128 a0 = _mm_loadu_ps(a), a1 = _mm_loadu_ps(a + 4), a2 = _mm_loadu_ps(a + 8), a3 = _mm_loadu_ps(a + 12);
+    for(int column = 0; column < 4; ++column) {
+        const float *weights = b + 4 * column;
+        __m128 sum = _mm_add_ps(_mm_mul_ps(a0, _mm_set1_ps(weights[0])), _mm_mul_ps(a1, _mm_set1_ps(weights[1])));
+        sum = _mm_add_ps(sum, _mm_mul_ps(a2, _mm_set1_ps(weights[2])));
+        sum = _mm_add_ps(sum, _mm_mul_ps(a3, _mm_set1_ps(weights[3])));
+        _mm_storeu_ps(out + 4 * column, sum);
+    }
+}
+
+// Two columns at once: each parent column is repeated in both halves and
+// each half takes the weights of its own local column
+__attribute__((target("avx")))
+static void MultiplyAVX(const glm::mat4 &parent, const glm::mat4 &local, glm::mat4 &world)
+{
+    const float *a = &parent[0][0], *b = &local[0][0];
+    float *out = &world[0][0];
+    __m256 a0 = _mm256_broadcast_ps((const __m128 *)a), a1 = _mm256_broadcast_ps((const __m128 *)(a + 4));
+    __m256 a2 = _mm256_broadcast_ps((const __m128 *)(a + 8)), a3 = _mm256_broadcast_ps((const __m128 *)(a + 12));
+    for(int column = 0; column < 4; column += 2) {
+        const float *first = b + 4 * column, *second = first + 4;
+        __m256 sum = _mm256_add_ps(
+                _mm256_mul_ps(a0, _mm256_setr_m128(_mm_set1_ps(first[0]), _mm_set1_ps(second[0]))),
+                _mm256_mul_ps(a1, _mm256_setr_m128(_mm_set1_ps(first[1]), _mm_set1_ps(second[1]))));
+        sum = _mm256_add_ps(sum, _mm256_mul_ps(a2, _mm256_setr_m128(_mm_set1_ps(first[2]), _mm_set1_ps(second[2]))));
+        sum = _mm256_add_ps(sum, _mm256_mul_ps(a3, _mm256_setr_m128(_mm_set1_ps(first[3]), _mm_set1_ps(second[3]))));
+        _mm256_storeu_ps(out + 4 * column, sum);
+    }
+}
+
+void TransformHierarchy::CollectSubtrees()
+{
+    // A subtree already marked was reached from a dirty node inside it, or
+    // from an ancestor; either way all of it is collected
+    for(size_t i = 0; i < dirtyNodes.size(); ++i) {
+        stack.push_back(dirtyNodes[i]);
+        while(!stack.empty()) {
+            unsigned int node = stack.back();
+            stack.pop_back();
+            if(flags[node] & WORLD_CHANGED)
+                continue;
+
+            flags[node] |= WORLD_CHANGED;
+            changed.push_back(node);
+            for(int child = firstChildren[node]; child != TRANSFORM_NO_PARENT; child = nextSiblings[child])
+                stack.push_back(child);
+        }
+    }
+
+    // Parents before children
+    std::sort(changed.begin(), changed.end());
+}
+
+void TransformHierarchy::CollectForward()
+{
+    // Nodes before the first dirty one cannot change, since every parent
+    // comes before its children. A node changes when its own transform or
+    // its parent's world matrix did
+    unsigned int count = parents.size();
+    for(unsigned int node = firstDirty; node < count; ++node) {
+        int parent = parents[node];
+        if((flags[node] & LOCAL_DIRTY) || (parent >= (int)firstDirty && (flags[parent] & WORLD_CHANGED))) {
+            flags[node] |= WORLD_CHANGED;
+            changed.push_back(node);
+        }
+    }
+}
+
+void TransformHierarchy::Update()
+{
+    changed.clear();
+    unsigned int count = parents.size();
+    if(dirtyNodes.empty())
+        return;
+
+    // The walk touches only changed nodes but sorts them at the end; the
+    // forward pass reads every node after the first dirty one
+    if(dirtyNodes.size() * 16 < count - firstDirty)
+        CollectSubtrees();
+    else
+        CollectForward();
+
+    for(size_t i = 0; i < changed.size(); ++i) {
+        unsigned int node = changed[i];
+        if(!(flags[node] & LOCAL_DIRTY))
+            continue;
+
+        // Translation * rotation * scale
+        glm::mat4 &local = locals[node];
+        local = glm::mat4_cast(rotations[node]);
+        for(int axis = 0; axis < 3; ++axis)
+            local[axis] = local[axis] * scales[node][axis];
+        local[3] = glm::vec4(translations[node], 1.0f);
+    }
+
+    static const bool hasAVX = __builtin_cpu_supports("avx");
+    void (*multiply)(const glm::mat4 &, const glm::mat4 &, glm::mat4 &) =
+        !simd ? MultiplyScalar : hasAVX ? MultiplyAVX : MultiplySSE;
+    for(size_t i = 0; i < changed.size(); ++i) {
+        unsigned int node = changed[i];
+        int parent = parents[node];
+        if(parent == TRANSFORM_NO_PARENT)
+            worlds[node] = locals[node];
+        else
+            multiply(worlds[parent], locals[node], worlds[node]);
+    }
+
+    for(size_t i = 0; i < changed.size(); ++i)
+        flags[changed[i]] = 0;
+    dirtyNodes.clear();
+    firstDirty = count;
+}
+
+const glm::mat4 &TransformHierarchy::GetWorld(unsigned int node)
+{
+    return worlds[node];
+}
+
+const std::vector<glm::mat4> &TransformHierarchy::GetWorlds()
+{
+    return worlds;
+}
+
+unsigned int TransformHierarchy::GetNodeCount()
+{
+    return parents.size();
+}
+
+unsigned int TransformHierarchy::GetUpdatedCount()
+{
+    return changed.size();
+}
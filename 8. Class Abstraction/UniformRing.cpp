@@ -0,0 +1,108 @@
+#include "UniformRing.hpp"
+#include "GLState.hpp"
+
+#include <iostream>
+#include <cstring>
+
+UniformRing::UniformRing()
+{
+    buffer = 0;
+    mapped = nullptr;
+    frameSize = 0;
+    alignment = 0;
+    offset = 0;
+    frame = 0;
+    for(int i = 0; i < UNIFORM_RING_FRAMES; ++i)
+        fences[i] = 0;
+    stalls = 0;
+}
+
+bool UniformRing::Create(size_t frameSize)
+{
+    this->frameSize = GetPushSize(frameSize);
+
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glGenBuffers(1, &buffer);
+    GLState::Get().BindBuffer(GL_UNIFORM_BUFFER, buffer);
+    glBufferStorage(GL_UNIFORM_BUFFER, this->frameSize * UNIFORM_RING_FRAMES, NULL, flags);
+    mapped = (unsigned char *)glMapBufferRange(GL_UNIFORM_BUFFER, 0, this->frameSize * UNIFORM_RING_FRAMES, flags);
+    if(!mapped) {
+        std::cout << "Uniform ring mapping failed!" << std::endl;
+        ClearRing();
+        return false;
+    }
+    return true;
+}
+
+void UniformRing::BeginFrame()
+{
+    GLsync &fence = fences[frame % UNIFORM_RING_FRAMES];
+    if(fence) {
+        // Poll first so only a real wait counts as a stall
+        GLenum status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+        if(status == GL_TIMEOUT_EXPIRED) {
+            ++stalls;
+            while(status == GL_TIMEOUT_EXPIRED)
+                status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+        }
+        glDeleteSync(fence);
+        fence = 0;
+    }
+    offset = 0;
+}
+
+bool UniformRing::Push(GLuint binding, const void *data, size_t size)
+{
+    if(offset + size > frameSize)
+        return false;
+
+    size_t start = (frame % UNIFORM_RING_FRAMES) * frameSize + offset;
+    memcpy(mapped + start, data, size);
+    GLState::Get().BindBufferRange(GL_UNIFORM_BUFFER, binding, buffer, start, size);
+    offset += GetPushSize(size);
+    return true;
+}
+
+void UniformRing::EndFrame()
+{
+    fences[frame % UNIFORM_RING_FRAMES] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    ++frame;
+}
+
+size_t UniformRing::GetPushSize(size_t size)
+{
+    if(alignment == 0) {
+        GLint offsetAlignment = 0;
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &offsetAlignment);
+        alignment = offsetAlignment > 0 ? offsetAlignment : 256;
+    }
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+uint64_t UniformRing::GetStallCount()
+{
+    return stalls;
+}
+
+void UniformRing::ClearRing()
+{
+    for(int i = 0; i < UNIFORM_RING_FRAMES; ++i) {
+        if(fences[i]) {
+            glDeleteSync(fences[i]);
+            fences[i] = 0;
+        }
+    }
+
+    if(buffer != 0) {
+        // Deleting a buffer unmaps it
+        GLState::Get().DeleteBuffer(buffer);
+        buffer = 0;
+    }
+    mapped = nullptr;
+    offset = 0;
+}
+
+UniformRing::~UniformRing()
+{
+    ClearRing();
+}
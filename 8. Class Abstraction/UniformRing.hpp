@@ -0,0 +1,52 @@
+#ifndef _UNIFORM_RING_H_
+#define _UNIFORM_RING_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include <GL/glew.h>
+
+// Frames the CPU may run ahead of the GPU
+#define UNIFORM_RING_FRAMES 3
+
+// Uniform block bindings used by the samples' shaders
+#define UNIFORM_FRAME_BINDING 0
+#define UNIFORM_OBJECT_BINDING 1
+
+// A persistently mapped, coherent buffer split into one region per frame in
+// flight. Uniform data is copied straight into the current region and bound
+// with glBindBufferRange, so there is no glUniform* or glBufferSubData per
+// draw. Each region is fenced when its frame ends, and BeginFrame only
+// waits when the GPU still reads the region it is about to reuse.
+class UniformRing {
+    private:
+        GLuint buffer;
+        unsigned char *mapped;
+        size_t frameSize, alignment, offset;
+        unsigned int frame;
+        GLsync fences[UNIFORM_RING_FRAMES];
+        uint64_t stalls;
+
+    public:
+        UniformRing();
+
+        // frameSize is the most uniform data one frame writes
+        bool Create(size_t frameSize);
+
+        void BeginFrame();
+        // Copies data into this frame's region and binds it to the uniform
+        // block binding; false when the region is full
+        bool Push(GLuint binding, const void *data, size_t size);
+        void EndFrame();
+
+        // Bytes one Push of size takes, including alignment padding
+        size_t GetPushSize(size_t size);
+        // Frames that had to wait for the GPU
+        uint64_t GetStallCount();
+
+        void ClearRing();
+
+        ~UniformRing();
+};
+
+#endif
@@ -0,0 +1,246 @@
+#include "VertexLayout.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// Components each semantic has in its float form
+static const int semanticComponents[] = {3, 3, 2};
+static const GLuint semanticLocations[] = {VERTEX_POSITION_LOCATION, VERTEX_NORMAL_LOCATION, VERTEX_UV_LOCATION};
+
+static GLint EncodedComponents(const VertexAttribute &attribute)
+{
+    switch(attribute.encoding) {
+        case ENCODING_HALF:
+            return attribute.semantic == VERTEX_UV ? 2 : 4;
+        case ENCODING_OCTAHEDRAL:
+            return 4;
+        case ENCODING_UNORM16:
+            return 2;
+        default:
+            return semanticComponents[attribute.semantic];
+    }
+}
+
+static GLuint EncodedSize(const VertexAttribute &attribute)
+{
+    switch(attribute.encoding) {
+        case ENCODING_HALF:
+            return 2 * EncodedComponents(attribute);
+        case ENCODING_OCTAHEDRAL:
+        case ENCODING_UNORM16:
+            return 4;
+        default:
+            return 4 * EncodedComponents(attribute);
+    }
+}
+
+// Round to nearest even, with overflow to infinity and gradual underflow
+static uint16_t FloatToHalf(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint32_t sign = (bits >> 16) & 0x8000;
+    uint32_t mantissa = bits & 0x7FFFFF;
+    int exponent = (int)((bits >> 23) & 0xFF) - 127 + 15;
+
+    if(((bits >> 23) & 0xFF) == 0xFF)
+        return sign | 0x7C00 | (mantissa ? 0x200 : 0);
+    if(exponent >= 31)
+        return sign | 0x7C00;
+
+    int shift = 13;
+    uint32_t half;
+    if(exponent <= 0) {
+        if(exponent < -10)
+            return sign;
+        mantissa |= 0x800000;
+        shift = 14 - exponent;
+        half = mantissa >> shift;
+    } else
+        half = (exponent << 10) | (mantissa >> shift);
+
+    // A carry out of the mantissa correctly bumps the exponent
+    uint32_t rest = mantissa & ((1u << shift) - 1), halfway = 1u << (shift - 1);
+    if(rest > halfway || (rest == halfway && (half & 1)))
+        ++half;
+    return sign | half;
+}
+
+static float HalfToFloat(uint16_t half)
+{
+    uint32_t sign = (uint32_t)(half & 0x8000) << 16;
+    int exponent = (half >> 10) & 0x1F;
+    uint32_t mantissa = half & 0x3FF;
+
+    if(exponent == 0x1F)
+        return sign ? -INFINITY : (mantissa ? NAN : INFINITY);
+    float magnitude = exponent == 0 ? std::ldexp((float)mantissa, -24) : std::ldexp((float)(mantissa | 0x400), exponent - 25);
+    return sign ? -magnitude : magnitude;
+}
+
+static uint32_t Snorm10(float value)
+{
+    int quantised = (int)lroundf(std::min(std::max(value, -1.0f), 1.0f) * 511.0f);
+    return (uint32_t)quantised & 0x3FF;
+}
+
+// Projects the unit sphere onto an octahedron and unfolds it into a square,
+// so two components cover every direction evenly
+static uint32_t EncodeOctahedral(const GLfloat *normal)
+{
+    float sum = std::fabs(normal[0]) + std::fabs(normal[1]) + std::fabs(normal[2]);
+    float x = sum > 0 ? normal[0] / sum : 0, y = sum > 0 ? normal[1] / sum : 0;
+    if(normal[2] < 0) {
+        float foldedX = (1 - std::fabs(y)) * (x >= 0 ? 1 : -1);
+        float foldedY = (1 - std::fabs(x)) * (y >= 0 ? 1 : -1);
+        x = foldedX;
+        y = foldedY;
+    }
+    return Snorm10(x) | Snorm10(y) << 10;
+}
+
+VertexLayout::VertexLayout()
+{
+    stride = 0;
+}
+
+VertexLayout &VertexLayout::Add(VertexSemantic semantic, VertexEncoding encoding)
+{
+    VertexAttribute attribute;
+    attribute.semantic = semantic;
+    attribute.encoding = encoding;
+    attribute.offset = stride;
+    attributes.push_back(attribute);
+
+    // Every encoding is a multiple of 4 bytes, so attributes stay aligned
+    stride += EncodedSize(attribute);
+    return *this;
+}
+
+bool VertexLayout::Has(VertexSemantic semantic) const
+{
+    for(size_t i = 0; i < attributes.size(); ++i) {
+        if(attributes[i].semantic == semantic)
+            return true;
+    }
+    return false;
+}
+
+uint64_t VertexLayout::Hash() const
+{
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for(size_t i = 0; i < attributes.size(); ++i) {
+        hash ^= attributes[i].semantic << 8 | attributes[i].encoding;
+        hash *= 0x100000001B3ull;
+    }
+    return hash;
+}
+
+void VertexLayout::Apply(GLuint binding) const
+{
+    for(size_t i = 0; i < attributes.size(); ++i) {
+        const VertexAttribute &attribute = attributes[i];
+        GLuint location = semanticLocations[attribute.semantic];
+        GLint components = EncodedComponents(attribute);
+
+        switch(attribute.encoding) {
+            case ENCODING_HALF:
+                glVertexAttribFormat(location, components, GL_HALF_FLOAT, GL_FALSE, attribute.offset);
+                break;
+            case ENCODING_OCTAHEDRAL:
+                glVertexAttribFormat(location, components, GL_INT_2_10_10_10_REV, GL_TRUE, attribute.offset);
+                break;
+            case ENCODING_UNORM16:
+                glVertexAttribFormat(location, components, GL_UNSIGNED_SHORT, GL_TRUE, attribute.offset);
+                break;
+            default:
+                glVertexAttribFormat(location, components, GL_FLOAT, GL_FALSE, attribute.offset);
+                break;
+        }
+        glVertexAttribBinding(location, binding);
+        glEnableVertexAttribArray(location);
+    }
+}
+
+std::vector<unsigned char> VertexLayout::Pack(const GLfloat *positions, const GLfloat *normals, const GLfloat *uvs,
+        unsigned int count) const
+{
+    std::vector<unsigned char> packed((size_t)stride * count);
+    const GLfloat *sources[] = {positions, normals, uvs};
+
+    for(unsigned int v = 0; v < count; ++v) {
+        unsigned char *vertex = &packed[(size_t)stride * v];
+        for(size_t i = 0; i < attributes.size(); ++i) {
+            const VertexAttribute &attribute = attributes[i];
+            int components = semanticComponents[attribute.semantic];
+            const GLfloat *source = sources[attribute.semantic] + (size_t)components * v;
+            unsigned char *target = vertex + attribute.offset;
+
+            switch(attribute.encoding) {
+                case ENCODING_HALF: {
+                    uint16_t half[4] = {0, 0, 0, FloatToHalf(1.0f)};
+                    for(int c = 0; c < components; ++c)
+                        half[c] = FloatToHalf(source[c]);
+                    memcpy(target, half, EncodedSize(attribute));
+                    break;
+                }
+                case ENCODING_OCTAHEDRAL: {
+                    uint32_t octahedral = EncodeOctahedral(source);
+                    memcpy(target, &octahedral, sizeof(octahedral));
+                    break;
+                }
+                case ENCODING_UNORM16: {
+                    uint16_t unorm[2];
+                    for(int c = 0; c < 2; ++c)
+                        unorm[c] = (uint16_t)lroundf(std::min(std::max(source[c], 0.0f), 1.0f) * 65535.0f);
+                    memcpy(target, unorm, sizeof(unorm));
+                    break;
+                }
+                default:
+                    memcpy(target, source, sizeof(GLfloat) * components);
+                    break;
+            }
+        }
+    }
+    return packed;
+}
+
+bool VertexLayout::ReadPosition(const unsigned char *vertex, GLfloat *position) const
+{
+    for(size_t i = 0; i < attributes.size(); ++i) {
+        const VertexAttribute &attribute = attributes[i];
+        if(attribute.semantic != VERTEX_POSITION)
+            continue;
+
+        if(attribute.encoding == ENCODING_FLOAT) {
+            memcpy(position, vertex + attribute.offset, sizeof(GLfloat) * 3);
+            return true;
+        }
+        if(attribute.encoding == ENCODING_HALF) {
+            uint16_t half[3];
+            memcpy(half, vertex + attribute.offset, sizeof(half));
+            for(int c = 0; c < 3; ++c)
+                position[c] = HalfToFloat(half[c]);
+            return true;
+        }
+    }
+    return false;
+}
+
+VertexLayout VertexLayout::Positions()
+{
+    VertexLayout layout;
+    layout.Add(VERTEX_POSITION, ENCODING_FLOAT);
+    return layout;
+}
+
+GLenum IndexTypeFor(unsigned int vertexCount)
+{
+    return vertexCount <= 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+}
+
+GLuint IndexSize(GLenum indexType)
+{
+    return indexType == GL_UNSIGNED_SHORT ? 2 : 4;
+}
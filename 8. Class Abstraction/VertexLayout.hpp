@@ -0,0 +1,73 @@
+#ifndef _VERTEX_LAYOUT_H_
+#define _VERTEX_LAYOUT_H_
+
+#include <cstdint>
+#include <vector>
+
+#include <GL/glew.h>
+
+// Attribute locations; 1-5 belong to the arena's instance and draw data
+#define VERTEX_POSITION_LOCATION 0
+#define VERTEX_NORMAL_LOCATION 6
+#define VERTEX_UV_LOCATION 7
+
+enum VertexSemantic {
+    VERTEX_POSITION,
+    VERTEX_NORMAL,
+    VERTEX_UV
+};
+
+enum VertexEncoding {
+    // 32-bit floats, 3 components (2 for UVs)
+    ENCODING_FLOAT,
+    // 16-bit floats; positions get a fourth component so they stay 4-byte aligned
+    ENCODING_HALF,
+    // Normals only: octahedral x, y as signed normalised 10-bit values of a
+    // GL_INT_2_10_10_10_REV, decoded in the vertex shader
+    ENCODING_OCTAHEDRAL,
+    // UVs only: unsigned normalised 16-bit, for UVs in [0, 1]
+    ENCODING_UNORM16
+};
+
+class VertexAttribute {
+    public:
+        VertexSemantic semantic;
+        VertexEncoding encoding;
+        GLuint offset;
+};
+
+// Describes one interleaved vertex: which attributes it has, how each is
+// encoded and where it sits. Meshes with the same layout share an arena.
+class VertexLayout {
+    public:
+        std::vector<VertexAttribute> attributes;
+        GLuint stride;
+
+        VertexLayout();
+
+        // Appends an attribute after the existing ones
+        VertexLayout &Add(VertexSemantic semantic, VertexEncoding encoding);
+        bool Has(VertexSemantic semantic) const;
+        uint64_t Hash() const;
+
+        // Sets the attribute formats of the bound VAO for vertex buffer binding
+        void Apply(GLuint binding) const;
+
+        // Interleaves float source data into this layout: positions and
+        // normals are xyz, UVs are uv; arrays for attributes the layout
+        // lacks are ignored and may be nullptr
+        std::vector<unsigned char> Pack(const GLfloat *positions, const GLfloat *normals, const GLfloat *uvs,
+                unsigned int count) const;
+        // Decodes the xyz position of one packed vertex; false if the
+        // layout has no float or half-float position
+        bool ReadPosition(const unsigned char *vertex, GLfloat *position) const;
+
+        // Float positions only, the layout Mesh::CreateMesh(GLfloat *) uses
+        static VertexLayout Positions();
+};
+
+// Smallest index type that can address vertexCount vertices
+GLenum IndexTypeFor(unsigned int vertexCount);
+GLuint IndexSize(GLenum indexType);
+
+#endif
@@ -0,0 +1,15 @@
+#version 450
+layout(location = 0) in vec3 pos;
+layout(location = 5) in uint drawIndex;
+out vec4 vCol;
+
+layout(std430, binding = 0) readonly buffer Models
+{
+    mat4 models[];
+};
+
+void main()
+{
+    gl_Position = models[drawIndex] * vec4(pos.x * 0.4, pos.y * 0.4, pos.z, 1.0);
+    vCol = vec4(clamp(pos, 0.0, 1.0), 1.0);
+}
@@ -0,0 +1,1596 @@
+// Headless benchmarks for the Mesh and Shader classes. Run from this
+// directory so the shader files are found:
+//     ./benchmark.out instancing [objects] [frames]
+//     ./benchmark.out sharing [meshes]
+//     ./benchmark.out arena [meshes] [frames]
+//     ./benchmark.out batch [objects] [frames]
+//     ./benchmark.out state [objects] [frames]
+//     ./benchmark.out uniforms [objects] [frames]
+//     ./benchmark.out shadercache [variants] [directory]
+//     ./benchmark.out asynccompile [variants]
+//     ./benchmark.out formats [segments]
+//     ./benchmark.out optimize [segments]
+//     ./benchmark.out lod [objects] [file]
+//     ./benchmark.out cull [objects] [frames]
+//     ./benchmark.out gpucull [objects] [frames]
+//     ./benchmark.out jobs [objects] [frames]
+//     ./benchmark.out transforms [nodes] [animated] [frames]
+//     ./benchmark.out profile [objects] [frames] [prefix]
+//     ./benchmark.out streaming [meshes] [directory]
+//     ./benchmark.out dynamic [vertices] [frames]
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "BatchRenderer.hpp"
+#include "Context.hpp"
+#include "DynamicMesh.hpp"
+#include "FrameProfiler.hpp"
+#include "FrustumCuller.hpp"
+#include "GPUCuller.hpp"
+#include "GLState.hpp"
+#include "JobSystem.hpp"
+#include "Mesh.hpp"
+#include "MeshArena.hpp"
+#include "MeshOptimizer.hpp"
+#include "MeshStreamer.hpp"
+#include "Shader.hpp"
+#include "TransformHierarchy.hpp"
+#include "UniformRing.hpp"
+#include "VertexLayout.hpp"
+
+const int WIDTH = 800, HEIGHT = 600;
+const float pi = 3.14159265358979323846f;
+
+static GLfloat vertices[] = {
+    -1.0f, -1.0f, 0.0f,
+    0.0f, -1.0f, 1.0f,
+    1.0f, -1.0f, 0.0f,
+    0.0f, 1.0f, 0.0f
+};
+
+static unsigned int indices[] = {
+    0, 1, 2,
+    0, 2, 3,
+    1, 2, 3,
+    0, 1, 3
+};
+
+// Spreads count objects over a square grid that fills the viewport
+std::vector<glm::mat4> GridModels(unsigned int count)
+{
+    unsigned int side = 1;
+    while(side * side < count)
+        ++side;
+
+    std::vector<glm::mat4> models(count);
+    float cell = 2.0f / side;
+    for(unsigned int i = 0; i < count; ++i) {
+        glm::mat4 model{1.0f};
+        model = glm::translate(model, glm::vec3(-1 + cell * (i % side + 0.5f), -1 + cell * (i / side + 0.5f), 0));
+        model = glm::scale(model, glm::vec3(cell, cell, cell));
+        models[i] = model;
+    }
+    return models;
+}
+
+class Timing
+{
+    public:
+    double submitMs, frameMs;
+    uint64_t checksum;
+};
+
+// Runs frames of draw, measuring CPU submission and submission + glFinish
+template<typename Draw>
+Timing TimeFrames(Context &context, unsigned int frames, Draw draw)
+{
+    Timing timing{0, 0, 0};
+    for(unsigned int frame = 0; frame < frames; ++frame) {
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        auto start = std::chrono::steady_clock::now();
+        draw();
+        auto submitted = std::chrono::steady_clock::now();
+        glFinish();
+        auto finished = std::chrono::steady_clock::now();
+
+        timing.submitMs += std::chrono::duration<double, std::milli>(submitted - start).count();
+        timing.frameMs += std::chrono::duration<double, std::milli>(finished - start).count();
+    }
+    timing.submitMs /= frames;
+    timing.frameMs /= frames;
+    timing.checksum = Context::Checksum(context.ReadPixels());
+    return timing;
+}
+
+void PrintTiming(const char *name, Timing &timing)
+{
+    printf("%-24s submit %9.3f ms   frame %9.3f ms   image %016llx\n", name, timing.submitMs, timing.frameMs,
+            (unsigned long long)timing.checksum);
+}
+
+int BenchmarkInstancing(Context &context, unsigned int objects, unsigned int frames)
+{
+    Mesh mesh;
+    mesh.CreateMesh(vertices, indices, 12, 12);
+    std::vector<glm::mat4> models = GridModels(objects);
+
+    Shader shader, instancedShader;
+    shader.CreateFromFiles("vertexShader.glsl", "fragmentShader.glsl");
+    instancedShader.CreateFromFiles("instancedVertexShader.glsl", "fragmentShader.glsl");
+
+    // One uniform upload and one draw call per object
+    shader.UseShader();
+    GLuint uniformModel = shader.GetModelLocation();
+    Timing perObject = TimeFrames(context, frames, [&]() {
+        for(unsigned int i = 0; i < objects; ++i) {
+            GLState::Get().UniformMatrix4fv(uniformModel, glm::value_ptr(models[i]));
+            mesh.RenderMesh();
+        }
+    });
+
+    // Matrices uploaded once per frame, a single instanced draw
+    instancedShader.UseShader();
+    Timing instanced = TimeFrames(context, frames, [&]() {
+        mesh.SetInstances(models.data(), objects);
+        mesh.RenderMeshInstanced();
+    });
+    GLState::Get().UseProgram(0);
+
+    printf("%u objects, %u frames\n", objects, frames);
+    PrintTiming("per-object draws", perObject);
+    PrintTiming("instanced draw", instanced);
+    printf("speedup: submit %.1fx, frame %.1fx, images %s\n", perObject.submitMs / instanced.submitMs,
+            perObject.frameMs / instanced.frameMs, perObject.checksum == instanced.checksum ? "match" : "differ");
+    return perObject.checksum == instanced.checksum ? 0 : 1;
+}
+
+int BenchmarkSharing(unsigned int meshes)
+{
+    GeometryRegistry &registry = GeometryRegistry::Get();
+
+    // Half the meshes repeat the same data, the other half are all distinct
+    std::vector<GLfloat> distinct(sizeof(vertices) / sizeof(vertices[0]));
+    std::vector<Mesh *> meshList;
+    auto start = std::chrono::steady_clock::now();
+    for(unsigned int i = 0; i < meshes; ++i) {
+        Mesh *mesh = new Mesh();
+        if(i % 2 == 0)
+            mesh->CreateMesh(vertices, indices, 12, 12);
+        else {
+            std::copy(vertices, vertices + 12, distinct.begin());
+            distinct[0] = (GLfloat)i;
+            mesh->CreateMesh(distinct.data(), indices, 12, 12);
+        }
+        meshList.push_back(mesh);
+    }
+    glFinish();
+    double createMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    size_t uploaded = registry.GetUploadedBytes(), shared = registry.GetSharedBytes();
+    printf("%u meshes created in %.3f ms\n", meshes, createMs);
+    printf("unique geometries %zu, uploaded %zu bytes, shared %zu bytes (%.1f%% of requested)\n",
+            registry.GetGeometryCount(), uploaded, shared, 100.0 * shared / (uploaded + shared));
+
+    for(unsigned int i = 0; i < meshes; ++i)
+        delete meshList[i];
+    printf("after clearing: %zu geometries\n", registry.GetGeometryCount());
+    return registry.GetGeometryCount() == 0 ? 0 : 1;
+}
+
+void PrintArena(const char *when, MeshArena &arena)
+{
+    printf("%-24s vertices %u/%u   indices %u/%u   free ranges %u   relocations %u\n", when,
+            arena.GetUsedVertices(), arena.GetVertexCapacity(), arena.GetUsedIndices(), arena.GetIndexCapacity(),
+            arena.GetFreeRangeCount(), arena.GetRelocationCount());
+}
+
+int BenchmarkArena(Context &context, unsigned int meshes, unsigned int frames)
+{
+    // Every mesh gets its own data so nothing is shared through the registry;
+    // the apex height varies so a mesh drawn from the wrong range shows
+    std::vector<GLfloat> distinct(vertices, vertices + 12);
+    std::vector<Mesh *> meshList(meshes);
+    auto createMeshes = [&](unsigned int first, unsigned int step) {
+        for(unsigned int i = first; i < meshes; i += step) {
+            distinct[9] = i * 1e-6f;
+            distinct[10] = 1.0f - (i % 10) * 0.08f;
+            meshList[i] = new Mesh();
+            meshList[i]->CreateMesh(distinct.data(), indices, 12, 12);
+        }
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    createMeshes(0, 1);
+    glFinish();
+    double createMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    Shader shader;
+    shader.CreateFromFiles("vertexShader.glsl", "fragmentShader.glsl");
+    shader.UseShader();
+    GLuint uniformModel = shader.GetModelLocation();
+    std::vector<glm::mat4> models = GridModels(meshes);
+    auto draw = [&]() {
+        for(unsigned int i = 0; i < meshes; ++i) {
+            if(!meshList[i])
+                continue;
+            GLState::Get().UniformMatrix4fv(uniformModel, glm::value_ptr(models[i]));
+            meshList[i]->RenderMesh();
+        }
+    };
+
+    // All the meshes have the same format, so they share one arena
+    MeshArena &arena = *meshList[0]->GetGeometry()->arena;
+    printf("%u meshes created in %.3f ms\n", meshes, createMs);
+    PrintArena("after creation", arena);
+    Timing full = TimeFrames(context, frames, draw);
+    PrintTiming("all meshes", full);
+
+    // Free every other mesh, leaving a hole per mesh
+    for(unsigned int i = 1; i < meshes; i += 2) {
+        delete meshList[i];
+        meshList[i] = nullptr;
+    }
+    PrintArena("after freeing half", arena);
+    Timing fragmented = TimeFrames(context, frames, draw);
+    PrintTiming("fragmented", fragmented);
+
+    arena.Defragment();
+    PrintArena("after defragmenting", arena);
+    Timing packed = TimeFrames(context, frames, draw);
+    PrintTiming("packed", packed);
+
+    // Recreating the freed meshes must fit in the space the arena already has
+    unsigned int vertexCapacity = arena.GetVertexCapacity();
+    createMeshes(1, 2);
+    PrintArena("after recreating", arena);
+    Timing refilled = TimeFrames(context, frames, draw);
+    PrintTiming("recreated", refilled);
+    GLState::Get().UseProgram(0);
+
+    bool reused = arena.GetVertexCapacity() == vertexCapacity;
+    printf("defragmented image %s, recreated image %s, capacity %s\n",
+            fragmented.checksum == packed.checksum ? "matches" : "differs",
+            full.checksum == refilled.checksum ? "matches" : "differs", reused ? "reused" : "grew");
+
+    for(unsigned int i = 0; i < meshes; ++i)
+        delete meshList[i];
+    return fragmented.checksum == packed.checksum && full.checksum == refilled.checksum && reused ? 0 : 1;
+}
+
+int BenchmarkBatch(Context &context, unsigned int maxObjects, unsigned int frames)
+{
+    // Neighbouring objects use different shapes, so every object is its own
+    // indirect command rather than being merged into one
+    const unsigned int SHAPES = 16;
+    std::vector<Mesh> shapes(SHAPES);
+    std::vector<GLfloat> shape(vertices, vertices + 12);
+    for(unsigned int s = 0; s < SHAPES; ++s) {
+        shape[10] = 1.0f - s * 0.05f;
+        shapes[s].CreateMesh(shape.data(), indices, 12, 12);
+    }
+
+    Shader shader, batchShader;
+    shader.CreateFromFiles("vertexShader.glsl", "fragmentShader.glsl");
+    batchShader.CreateFromFiles("batchVertexShader.glsl", "fragmentShader.glsl");
+    GLuint uniformModel = shader.GetModelLocation();
+    BatchRenderer batch;
+
+    int result = 0;
+    printf("%-10s %-22s %12s %12s\n", "objects", "", "submit ms", "frame ms");
+    for(unsigned int objects = maxObjects / 100; objects <= maxObjects; objects *= 10) {
+        std::vector<glm::mat4> models = GridModels(objects);
+
+        // The current loop: a uniform upload and a RenderMesh per object
+        shader.UseShader();
+        Timing loop = TimeFrames(context, frames, [&]() {
+            for(unsigned int i = 0; i < objects; ++i) {
+                GLState::Get().UniformMatrix4fv(uniformModel, glm::value_ptr(models[i]));
+                shapes[i % SHAPES].RenderMesh();
+            }
+        });
+
+        // Building the batch is part of the submit time
+        batchShader.UseShader();
+        Timing batched = TimeFrames(context, frames, [&]() {
+            batch.Begin();
+            for(unsigned int i = 0; i < objects; ++i)
+                batch.Add(&shapes[i % SHAPES], models[i]);
+            batch.Submit();
+        });
+        GLState::Get().UseProgram(0);
+
+        printf("%-10u %-22s %12.3f %12.3f\n", objects, "RenderMesh loop", loop.submitMs, loop.frameMs);
+        printf("%-10u %-22s %12.3f %12.3f   %u commands, images %s\n", objects, "multi-draw indirect",
+                batched.submitMs, batched.frameMs, batch.GetCommandCount(), loop.checksum == batched.checksum ? "match" : "differ");
+        if(loop.checksum != batched.checksum)
+            result = 1;
+    }
+    return result;
+}
+
+int BenchmarkState(Context &context, unsigned int objects, unsigned int frames)
+{
+    // Each draw sets everything it needs, the way independent objects do;
+    // most of it is already in place from the previous draw
+    Mesh mesh;
+    mesh.CreateMesh(vertices, indices, 12, 12);
+    std::vector<glm::mat4> models = GridModels(objects);
+
+    Shader shader;
+    shader.CreateFromFiles("vertexShader.glsl", "fragmentShader.glsl");
+    GLuint uniformModel = shader.GetModelLocation();
+    auto draw = [&]() {
+        for(unsigned int i = 0; i < objects; ++i) {
+            shader.UseShader();
+            GLState::Get().UniformMatrix4fv(uniformModel, glm::value_ptr(models[i < objects / 2 ? 0 : i]));
+            mesh.RenderMesh();
+        }
+    };
+
+    GLState &state = GLState::Get();
+    Timing timings[2];
+    uint64_t issued[2], skipped[2];
+    for(int caching = 0; caching < 2; ++caching) {
+        state.SetCaching(caching);
+        state.Invalidate();
+        state.ResetCounters();
+        timings[caching] = TimeFrames(context, frames, draw);
+        issued[caching] = state.GetIssuedCalls() / frames;
+        skipped[caching] = state.GetSkippedCalls() / frames;
+    }
+    state.SetCaching(true);
+
+    printf("%u objects, %u frames, half of them drawn with the same matrix\n", objects, frames);
+    PrintTiming("every call issued", timings[0]);
+    PrintTiming("redundant calls skipped", timings[1]);
+    printf("per frame: %llu calls issued without caching, %llu issued and %llu skipped with it, images %s\n",
+            (unsigned long long)issued[0], (unsigned long long)issued[1], (unsigned long long)skipped[1],
+            timings[0].checksum == timings[1].checksum ? "match" : "differ");
+    return timings[0].checksum == timings[1].checksum ? 0 : 1;
+}
+
+int BenchmarkUniforms(Context &context, unsigned int objects, unsigned int frames)
+{
+    Mesh mesh;
+    mesh.CreateMesh(vertices, indices, 12, 12);
+    std::vector<glm::mat4> models = GridModels(objects);
+
+    // One glUniformMatrix4fv per object
+    Shader shader;
+    shader.CreateFromFiles("vertexShader.glsl", "fragmentShader.glsl");
+    GLuint uniformModel = shader.GetModelLocation();
+    shader.UseShader();
+    Timing perDraw = TimeFrames(context, frames, [&]() {
+        for(unsigned int i = 0; i < objects; ++i) {
+            GLState::Get().UniformMatrix4fv(uniformModel, glm::value_ptr(models[i]));
+            mesh.RenderMesh();
+        }
+    });
+
+    // Per-frame and per-object blocks copied into the mapped ring
+    Shader uboShader;
+    uboShader.CreateFromFiles("uboVertexShader.glsl", "fragmentShader.glsl");
+    uboShader.BindUniformBlock("Frame", UNIFORM_FRAME_BINDING);
+    uboShader.BindUniformBlock("Object", UNIFORM_OBJECT_BINDING);
+
+    UniformRing ring;
+    if(!ring.Create(ring.GetPushSize(sizeof(glm::mat4)) * (objects + 1)))
+        return 1;
+    glm::mat4 viewProjection{1.0f};
+    uboShader.UseShader();
+    Timing ringed = TimeFrames(context, frames, [&]() {
+        ring.BeginFrame();
+        ring.Push(UNIFORM_FRAME_BINDING, glm::value_ptr(viewProjection), sizeof(glm::mat4));
+        for(unsigned int i = 0; i < objects; ++i) {
+            ring.Push(UNIFORM_OBJECT_BINDING, glm::value_ptr(models[i]), sizeof(glm::mat4));
+            mesh.RenderMesh();
+        }
+        ring.EndFrame();
+    });
+    GLState::Get().UseProgram(0);
+
+    printf("%u objects, %u frames\n", objects, frames);
+    PrintTiming("glUniformMatrix4fv", perDraw);
+    PrintTiming("uniform ring", ringed);
+    printf("ring: %zu bytes per frame, %d frames, %llu stalled frames, images %s\n",
+            ring.GetPushSize(sizeof(glm::mat4)) * (objects + 1), UNIFORM_RING_FRAMES,
+            (unsigned long long)ring.GetStallCount(), perDraw.checksum == ringed.checksum ? "match" : "differ");
+    return perDraw.checksum == ringed.checksum ? 0 : 1;
+}
+
+// Builds variants programs, each a distinct source numbered from first,
+// and renders one frame with every one of them. Asynchronous builds are
+// all started before any is waited on
+Timing CompileVariants(Context &context, unsigned int first, unsigned int variants, const std::string &vertexCode,
+        const std::string &fragmentCode, bool async)
+{
+    Mesh mesh;
+    mesh.CreateMesh(vertices, indices, 12, 12);
+    std::vector<glm::mat4> models = GridModels(variants);
+    std::vector<Shader> shaders(variants);
+
+    Timing timing{0, 0, 0};
+    auto start = std::chrono::steady_clock::now();
+    for(unsigned int v = 0; v < variants; ++v) {
+        std::string variantCode = vertexCode;
+        variantCode.insert(variantCode.find('\n') + 1, "#define VARIANT " + std::to_string(first + v) + "\n");
+        if(async)
+            shaders[v].BeginCreateFromString(variantCode.c_str(), fragmentCode.c_str());
+        else
+            shaders[v].CreateFromString(variantCode.c_str(), fragmentCode.c_str());
+    }
+
+    // Poll the way a loading screen would, finishing whatever is done
+    unsigned int finished = async ? 0 : variants;
+    std::vector<bool> done(variants, !async);
+    while(finished < variants) {
+        for(unsigned int v = 0; v < variants; ++v) {
+            if(!done[v] && shaders[v].IsReady()) {
+                shaders[v].FinishCreate();
+                done[v] = true;
+                ++finished;
+            }
+        }
+    }
+    timing.submitMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    for(unsigned int v = 0; v < variants; ++v) {
+        shaders[v].UseShader();
+        GLState::Get().UniformMatrix4fv(shaders[v].GetModelLocation(), glm::value_ptr(models[v]));
+        mesh.RenderMesh();
+    }
+    GLState::Get().UseProgram(0);
+    timing.frameMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    timing.checksum = Context::Checksum(context.ReadPixels());
+    return timing;
+}
+
+int BenchmarkShaderCache(Context &context, unsigned int variants, const char *directory)
+{
+    std::ifstream vertexFile("vertexShader.glsl"), fragmentFile("fragmentShader.glsl");
+    std::string vertexCode((std::istreambuf_iterator<char>(vertexFile)), std::istreambuf_iterator<char>());
+    std::string fragmentCode((std::istreambuf_iterator<char>(fragmentFile)), std::istreambuf_iterator<char>());
+
+    Timing uncached = CompileVariants(context, 0, variants, vertexCode, fragmentCode, false);
+
+    // Start from an empty cache: the first pass fills it, the second loads it
+    Shader::SetCacheDirectory(directory);
+    if(DIR *dir = opendir(directory)) {
+        while(dirent *entry = readdir(dir)) {
+            std::string name = entry->d_name;
+            if(name.size() > 4 && name.compare(name.size() - 4, 4, ".bin") == 0)
+                unlink((std::string(directory) + "/" + name).c_str());
+        }
+        closedir(dir);
+    }
+    Timing cold = CompileVariants(context, 0, variants, vertexCode, fragmentCode, false);
+    unsigned int coldHits = Shader::GetCacheHits();
+    Timing warm = CompileVariants(context, 0, variants, vertexCode, fragmentCode, false);
+    unsigned int warmHits = Shader::GetCacheHits() - coldHits;
+    Shader::SetCacheDirectory(nullptr);
+
+    printf("%u program variants, cache in %s\n", variants, directory);
+    printf("%-24s create %9.3f ms   first frame %9.3f ms   image %016llx\n", "no cache", uncached.submitMs,
+            uncached.frameMs, (unsigned long long)uncached.checksum);
+    printf("%-24s create %9.3f ms   first frame %9.3f ms   image %016llx   %u hits\n", "cold cache", cold.submitMs,
+            cold.frameMs, (unsigned long long)cold.checksum, coldHits);
+    printf("%-24s create %9.3f ms   first frame %9.3f ms   image %016llx   %u hits\n", "warm cache", warm.submitMs,
+            warm.frameMs, (unsigned long long)warm.checksum, warmHits);
+    printf("speedup: create %.1fx, images %s\n", cold.submitMs / warm.submitMs,
+            cold.checksum == warm.checksum && uncached.checksum == warm.checksum ? "match" : "differ");
+    return cold.checksum == warm.checksum && uncached.checksum == warm.checksum ? 0 : 1;
+}
+
+int BenchmarkAsyncCompile(Context &context, unsigned int variants)
+{
+    std::ifstream vertexFile("vertexShader.glsl"), fragmentFile("fragmentShader.glsl");
+    std::string vertexCode((std::istreambuf_iterator<char>(vertexFile)), std::istreambuf_iterator<char>());
+    std::string fragmentCode((std::istreambuf_iterator<char>(fragmentFile)), std::istreambuf_iterator<char>());
+
+    // Different variant numbers, so neither pass reuses the other's work
+    // through a driver-side cache
+    Timing blocking = CompileVariants(context, 0, variants, vertexCode, fragmentCode, false);
+    Timing async = CompileVariants(context, variants, variants, vertexCode, fragmentCode, true);
+
+    printf("%u program variants, parallel compile extension %s\n", variants,
+            Shader::HasParallelCompile() ? "available" : "missing");
+    printf("%-24s create %9.3f ms   first frame %9.3f ms   image %016llx\n", "one after another",
+            blocking.submitMs, blocking.frameMs, (unsigned long long)blocking.checksum);
+    printf("%-24s create %9.3f ms   first frame %9.3f ms   image %016llx\n", "submitted together",
+            async.submitMs, async.frameMs, (unsigned long long)async.checksum);
+    printf("speedup: create %.1fx, first frame %.1fx, images %s\n", blocking.submitMs / async.submitMs,
+            blocking.frameMs / async.frameMs, blocking.checksum == async.checksum ? "match" : "differ");
+    return blocking.checksum == async.checksum ? 0 : 1;
+}
+
+// UV sphere with rings x segments quads; positions and normals are xyz,
+// UVs are in [0, 1]
+void BuildSphere(unsigned int segments, std::vector<GLfloat> &positions, std::vector<GLfloat> &normals,
+        std::vector<GLfloat> &uvs, std::vector<unsigned int> &sphereIndices)
+{
+    unsigned int rings = segments / 2;
+    for(unsigned int ring = 0; ring <= rings; ++ring) {
+        float theta = pi * ring / rings;
+        for(unsigned int segment = 0; segment <= segments; ++segment) {
+            float phi = 2 * pi * segment / segments;
+            glm::vec3 normal(sinf(theta) * cosf(phi), cosf(theta), sinf(theta) * sinf(phi));
+            positions.insert(positions.end(), {normal.x, normal.y, normal.z});
+            normals.insert(normals.end(), {normal.x, normal.y, normal.z});
+            uvs.insert(uvs.end(), {(float)segment / segments, (float)ring / rings});
+        }
+    }
+
+    for(unsigned int ring = 0; ring < rings; ++ring) {
+        for(unsigned int segment = 0; segment < segments; ++segment) {
+            unsigned int corner = ring * (segments + 1) + segment;
+            sphereIndices.insert(sphereIndices.end(), {corner, corner + segments + 1, corner + 1,
+                    corner + 1, corner + segments + 1, corner + segments + 2});
+        }
+    }
+}
+
+int BenchmarkFormats(Context &context, unsigned int segments)
+{
+    std::vector<GLfloat> positions, normals, uvs;
+    std::vector<unsigned int> sphereIndices;
+    BuildSphere(segments, positions, normals, uvs, sphereIndices);
+    unsigned int vertexCount = positions.size() / 3, indexCount = sphereIndices.size();
+
+    VertexLayout floatLayout, compactLayout;
+    floatLayout.Add(VERTEX_POSITION, ENCODING_FLOAT).Add(VERTEX_NORMAL, ENCODING_FLOAT).Add(VERTEX_UV, ENCODING_FLOAT);
+    compactLayout.Add(VERTEX_POSITION, ENCODING_HALF).Add(VERTEX_NORMAL, ENCODING_OCTAHEDRAL).Add(VERTEX_UV, ENCODING_UNORM16);
+
+    // The float mesh keeps 32-bit indices, as every mesh had before layouts
+    std::vector<unsigned char> floatData = floatLayout.Pack(positions.data(), normals.data(), uvs.data(), vertexCount);
+    std::vector<unsigned char> compactData = compactLayout.Pack(positions.data(), normals.data(), uvs.data(), vertexCount);
+    size_t floatVertexBytes = floatData.size(), floatIndexBytes = sizeof(unsigned int) * indexCount;
+    size_t compactVertexBytes = compactData.size(), compactIndexBytes = IndexSize(IndexTypeFor(vertexCount)) * indexCount;
+
+    Mesh compactMesh;
+    compactMesh.CreateMesh(compactLayout, compactData.data(), vertexCount, sphereIndices.data(), indexCount);
+    Geometry *floatGeometry = GeometryRegistry::Get().Acquire(&MeshArena::Get(floatLayout, GL_UNSIGNED_INT),
+            floatData.data(), vertexCount, sphereIndices.data(), indexCount);
+
+    std::ifstream vertexFile("formatsVertexShader.glsl"), fragmentFile("fragmentShader.glsl");
+    std::string vertexCode((std::istreambuf_iterator<char>(vertexFile)), std::istreambuf_iterator<char>());
+    std::string fragmentCode((std::istreambuf_iterator<char>(fragmentFile)), std::istreambuf_iterator<char>());
+    std::string octahedralCode = vertexCode;
+    octahedralCode.insert(octahedralCode.find('\n') + 1, "#define OCTAHEDRAL_NORMALS\n");
+
+    Shader floatShader, compactShader;
+    floatShader.CreateFromString(vertexCode.c_str(), fragmentCode.c_str());
+    compactShader.CreateFromString(octahedralCode.c_str(), fragmentCode.c_str());
+
+    glm::mat4 model = glm::rotate(glm::scale(glm::mat4(1.0f), glm::vec3(0.9f)), 0.5f, glm::vec3(1, 1, 0));
+    auto render = [&](Shader &shader, auto draw) {
+        shader.UseShader();
+        GLState::Get().UniformMatrix4fv(shader.GetModelLocation(), glm::value_ptr(model));
+        Timing timing = TimeFrames(context, 3, draw);
+        return std::make_pair(timing, context.ReadPixels());
+    };
+    auto floatImage = render(floatShader, [&]() {
+        MeshArena *arena = floatGeometry->arena;
+        arena->Bind();
+        glDrawElementsBaseVertex(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT,
+                (void *)((size_t)floatGeometry->firstIndex * arena->GetIndexSize()), floatGeometry->baseVertex);
+    });
+    auto compactImage = render(compactShader, [&]() {
+        compactMesh.RenderMesh();
+    });
+    GLState::Get().UseProgram(0);
+    GeometryRegistry::Get().Release(floatGeometry);
+
+    // Half-float positions and 10-bit normals shift colours and edges a little
+    unsigned int differing = 0, maxDifference = 0;
+    for(size_t i = 0; i < floatImage.second.size(); ++i) {
+        unsigned int difference = abs(floatImage.second[i] - compactImage.second[i]);
+        if(difference > 2)
+            ++differing;
+        maxDifference = std::max(maxDifference, difference);
+    }
+    double differingPercent = 100.0 * differing / floatImage.second.size();
+
+    printf("sphere of %u vertices, %u indices\n", vertexCount, indexCount);
+    printf("%-24s vertex %2u bytes   vertices %8zu   indices %8zu   total %8zu bytes\n", "float, 32-bit indices",
+            floatLayout.stride, floatVertexBytes, floatIndexBytes, floatVertexBytes + floatIndexBytes);
+    printf("%-24s vertex %2u bytes   vertices %8zu   indices %8zu   total %8zu bytes\n", "compact",
+            compactLayout.stride, compactVertexBytes, compactIndexBytes, compactVertexBytes + compactIndexBytes);
+    PrintTiming("float draw", floatImage.first);
+    PrintTiming("compact draw", compactImage.first);
+    printf("size %.1fx smaller, %.3f%% of channels differ by more than 2, max difference %u\n",
+            (double)(floatVertexBytes + floatIndexBytes) / (compactVertexBytes + compactIndexBytes),
+            differingPercent, maxDifference);
+    return differingPercent < 1.0 ? 0 : 1;
+}
+
+// Torus around the y axis with segments x segments / 4 quads; positions and
+// normals are xyz, UVs are in [0, 1], front faces are counter-clockwise
+void BuildTorus(unsigned int segments, std::vector<GLfloat> &positions, std::vector<GLfloat> &normals,
+        std::vector<GLfloat> &uvs, std::vector<unsigned int> &torusIndices)
+{
+    unsigned int tubeSegments = segments / 4;
+    for(unsigned int ring = 0; ring <= segments; ++ring) {
+        float phi = 2 * pi * ring / segments;
+        for(unsigned int tube = 0; tube <= tubeSegments; ++tube) {
+            float theta = 2 * pi * tube / tubeSegments;
+            glm::vec3 normal(cosf(theta) * cosf(phi), sinf(theta), cosf(theta) * sinf(phi));
+            glm::vec3 position = glm::vec3(0.6f * cosf(phi), 0, 0.6f * sinf(phi)) + 0.3f * normal;
+            positions.insert(positions.end(), {position.x, position.y, position.z});
+            normals.insert(normals.end(), {normal.x, normal.y, normal.z});
+            uvs.insert(uvs.end(), {(float)ring / segments, (float)tube / tubeSegments});
+        }
+    }
+
+    for(unsigned int ring = 0; ring < segments; ++ring) {
+        for(unsigned int tube = 0; tube < tubeSegments; ++tube) {
+            unsigned int corner = ring * (tubeSegments + 1) + tube;
+            torusIndices.insert(torusIndices.end(), {corner, corner + 1, corner + tubeSegments + 1,
+                    corner + 1, corner + tubeSegments + 2, corner + tubeSegments + 1});
+        }
+    }
+}
+
+void PrintCacheStats(const char *stage, unsigned int vertexCount, const std::vector<unsigned int> &meshIndices)
+{
+    VertexCacheStats stats = AnalyzeVertexCache(meshIndices.data(), meshIndices.size(), vertexCount);
+    printf("%-24s vertices %7u   ACMR %.3f   ATVR %.3f\n", stage, vertexCount, stats.acmr, stats.atvr);
+}
+
+int BenchmarkOptimize(Context &context, unsigned int segments)
+{
+    // A torus as an exporter without indexing might write it: every triangle
+    // has its own three vertices, in random order
+    std::vector<GLfloat> gridPositions, gridNormals, gridUVs;
+    std::vector<unsigned int> triangles;
+    BuildTorus(segments, gridPositions, gridNormals, gridUVs, triangles);
+    std::vector<unsigned int> order(triangles.size() / 3);
+    for(size_t i = 0; i < order.size(); ++i)
+        order[i] = i;
+    std::shuffle(order.begin(), order.end(), std::mt19937(42));
+
+    std::vector<GLfloat> positions, normals, uvs;
+    for(size_t i = 0; i < order.size(); ++i) {
+        for(int corner = 0; corner < 3; ++corner) {
+            unsigned int vertex = triangles[order[i] * 3 + corner];
+            positions.insert(positions.end(), &gridPositions[3 * vertex], &gridPositions[3 * vertex + 3]);
+            normals.insert(normals.end(), &gridNormals[3 * vertex], &gridNormals[3 * vertex + 3]);
+            uvs.insert(uvs.end(), &gridUVs[2 * vertex], &gridUVs[2 * vertex + 2]);
+        }
+    }
+
+    VertexLayout layout;
+    layout.Add(VERTEX_POSITION, ENCODING_FLOAT).Add(VERTEX_NORMAL, ENCODING_FLOAT).Add(VERTEX_UV, ENCODING_FLOAT);
+    unsigned int vertexCount = positions.size() / 3, indexCount = vertexCount;
+    std::vector<unsigned char> originalVertices = layout.Pack(positions.data(), normals.data(), uvs.data(), vertexCount);
+    std::vector<unsigned int> originalIndices(indexCount);
+    for(unsigned int i = 0; i < indexCount; ++i)
+        originalIndices[i] = i;
+
+    // Each stage separately, to report what it contributes
+    printf("torus of %u triangles\n", indexCount / 3);
+    PrintCacheStats("input", vertexCount, originalIndices);
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<unsigned int> remap, optimizedIndices = originalIndices;
+    unsigned int optimizedCount = GenerateVertexRemap(remap, originalVertices.data(), vertexCount, layout.stride,
+            optimizedIndices.data(), indexCount);
+    std::vector<unsigned char> optimizedVertices((size_t)layout.stride * optimizedCount), fetchOrdered(optimizedVertices.size());
+    RemapVertices(optimizedVertices.data(), originalVertices.data(), vertexCount, layout.stride, remap);
+    RemapIndices(optimizedIndices.data(), indexCount, remap);
+    PrintCacheStats("deduplicated", optimizedCount, optimizedIndices);
+
+    OptimizeVertexCache(optimizedIndices.data(), indexCount, optimizedCount);
+    VertexCacheStats cacheOrdered = AnalyzeVertexCache(optimizedIndices.data(), indexCount, optimizedCount);
+    PrintCacheStats("vertex cache order", optimizedCount, optimizedIndices);
+    std::vector<unsigned int> cacheIndices = optimizedIndices;
+    std::vector<unsigned char> cacheVertices = optimizedVertices;
+
+    std::vector<GLfloat> optimizedPositions(3 * optimizedCount);
+    for(unsigned int v = 0; v < optimizedCount; ++v)
+        layout.ReadPosition(&optimizedVertices[(size_t)layout.stride * v], &optimizedPositions[3 * v]);
+    OptimizeOverdraw(optimizedIndices.data(), indexCount, optimizedPositions.data(), optimizedCount);
+    VertexCacheStats overdrawOrdered = AnalyzeVertexCache(optimizedIndices.data(), indexCount, optimizedCount);
+    PrintCacheStats("overdraw order", optimizedCount, optimizedIndices);
+
+    GenerateVertexFetchRemap(remap, optimizedIndices.data(), indexCount, optimizedCount);
+    RemapVertices(fetchOrdered.data(), optimizedVertices.data(), optimizedCount, layout.stride, remap);
+    RemapIndices(optimizedIndices.data(), indexCount, remap);
+    optimizedVertices.swap(fetchOrdered);
+    PrintCacheStats("vertex fetch order", optimizedCount, optimizedIndices);
+    double optimizeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    Mesh original, cacheOnly, optimized;
+    original.CreateMesh(layout, originalVertices.data(), vertexCount, originalIndices.data(), indexCount);
+    cacheOnly.CreateMesh(layout, cacheVertices.data(), optimizedCount, cacheIndices.data(), indexCount);
+    optimized.CreateMesh(layout, optimizedVertices.data(), optimizedCount, optimizedIndices.data(), indexCount);
+
+    // Optimising at load runs the same stages, so the registry hands back
+    // the geometry optimised above
+    Mesh loaded;
+    Mesh::SetOptimizeOnLoad(true);
+    loaded.CreateMesh(layout, originalVertices.data(), vertexCount, originalIndices.data(), indexCount);
+    Mesh::SetOptimizeOnLoad(false);
+    bool sameAsLoaded = loaded.GetGeometry() == optimized.GetGeometry();
+
+    // Fragments that pass the depth test over six views, against the pixels
+    // the torus covers, is the overdraw
+    Shader shader;
+    shader.CreateFromFiles("formatsVertexShader.glsl", "fragmentShader.glsl");
+    shader.UseShader();
+    GLuint uniformModel = shader.GetModelLocation(), query;
+    glGenQueries(1, &query);
+    auto measure = [&](Mesh &mesh, GLuint &samples, unsigned int &covered) {
+        samples = 0;
+        covered = 0;
+        for(int view = 0; view < 6; ++view) {
+            glm::mat4 model = glm::rotate(glm::mat4(1.0f), view * pi / 3, glm::vec3(1, 0.5f, 0.25f));
+            GLState::Get().UniformMatrix4fv(uniformModel, glm::value_ptr(model));
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            glBeginQuery(GL_SAMPLES_PASSED, query);
+            mesh.RenderMesh();
+            glEndQuery(GL_SAMPLES_PASSED);
+
+            GLuint viewSamples = 0;
+            glGetQueryObjectuiv(query, GL_QUERY_RESULT, &viewSamples);
+            samples += viewSamples;
+            std::vector<unsigned char> pixels = context.ReadPixels();
+            for(size_t i = 0; i < pixels.size(); i += 3)
+                covered += pixels[i] || pixels[i + 1] || pixels[i + 2];
+        }
+    };
+    GLuint originalSamples, cacheSamples, optimizedSamples;
+    unsigned int originalCovered, cacheCovered, optimizedCovered;
+    measure(original, originalSamples, originalCovered);
+    measure(cacheOnly, cacheSamples, cacheCovered);
+    measure(optimized, optimizedSamples, optimizedCovered);
+    glDeleteQueries(1, &query);
+
+    glm::mat4 model = glm::rotate(glm::mat4(1.0f), pi / 3, glm::vec3(1, 0.5f, 0.25f));
+    GLState::Get().UniformMatrix4fv(uniformModel, glm::value_ptr(model));
+    Timing originalTiming = TimeFrames(context, 10, [&]() {
+        original.RenderMesh();
+    });
+    Timing optimizedTiming = TimeFrames(context, 10, [&]() {
+        optimized.RenderMesh();
+    });
+    GLState::Get().UseProgram(0);
+
+    printf("optimised in %.3f ms, overdraw ordering changed ACMR by %+.1f%%\n", optimizeMs,
+            100.0 * (overdrawOrdered.acmr / cacheOrdered.acmr - 1));
+    printf("%-24s overdraw %.3f\n", "input", (double)originalSamples / originalCovered);
+    printf("%-24s overdraw %.3f\n", "vertex cache order", (double)cacheSamples / cacheCovered);
+    printf("%-24s overdraw %.3f\n", "optimised", (double)optimizedSamples / optimizedCovered);
+    PrintTiming("input draw", originalTiming);
+    PrintTiming("optimised draw", optimizedTiming);
+    printf("images %s, optimising at load gives %s geometry\n",
+            originalTiming.checksum == optimizedTiming.checksum ? "match" : "differ", sameAsLoaded ? "the same" : "different");
+    return originalCovered == optimizedCovered && originalTiming.checksum == optimizedTiming.checksum && sameAsLoaded ? 0 : 1;
+}
+
+int BenchmarkLOD(Context &context, unsigned int objects, const char *path)
+{
+    std::vector<GLfloat> positions, normals, uvs;
+    std::vector<unsigned int> torusIndices;
+    BuildTorus(256, positions, normals, uvs, torusIndices);
+    VertexLayout layout;
+    layout.Add(VERTEX_POSITION, ENCODING_FLOAT).Add(VERTEX_NORMAL, ENCODING_FLOAT).Add(VERTEX_UV, ENCODING_FLOAT);
+    std::vector<unsigned char> packed = layout.Pack(positions.data(), normals.data(), uvs.data(), positions.size() / 3);
+
+    MeshData data(layout, packed.data(), positions.size() / 3, torusIndices.data(), torusIndices.size());
+    data.Optimize();
+    auto start = std::chrono::steady_clock::now();
+    data.GenerateLODs();
+    double generateMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    printf("torus LOD chain built in %.3f ms\n", generateMs);
+    for(size_t i = 0; i < data.lods.size(); ++i)
+        printf("LOD %zu   triangles %6u   error %.5f\n", i, data.lods[i].indexCount / 3, data.lods[i].error);
+
+    // The chain goes to disk with the mesh and comes back without any work
+    if(!data.Save(path))
+        return 1;
+    start = std::chrono::steady_clock::now();
+    MeshData loaded;
+    bool read = loaded.Load(path);
+    double loadMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    bool same = read && loaded.vertices == data.vertices && loaded.indices == data.indices &&
+        loaded.lods.size() == data.lods.size() &&
+        !memcmp(loaded.lods.data(), data.lods.data(), sizeof(MeshLOD) * data.lods.size());
+    printf("%s loaded in %.3f ms, %s\n", path, loadMs, same ? "identical" : "different");
+
+    Mesh mesh;
+    if(!mesh.CreateFromFile(path))
+        return 1;
+
+    // Rows of objects from near the camera to far away
+    const float fieldOfView = glm::radians(45.0f);
+    glm::vec3 camera(0, 1.5f, 0);
+    glm::mat4 viewProjection = glm::perspective(fieldOfView, (float)WIDTH / HEIGHT, 0.1f, 500.0f) *
+        glm::lookAt(camera, glm::vec3(0, 1.0f, -10), glm::vec3(0, 1, 0));
+    unsigned int columns = 10;
+    std::vector<glm::mat4> models(objects), transforms(objects);
+    for(unsigned int i = 0; i < objects; ++i) {
+        glm::vec3 position((i % columns - (columns - 1) * 0.5f) * 2.5f, 0, -3.0f - 2.5f * (i / columns));
+        models[i] = glm::rotate(glm::translate(glm::mat4(1.0f), position), 0.7f * i, glm::vec3(0.3f, 1, 0.2f));
+        transforms[i] = viewProjection * models[i];
+    }
+
+    float pixelsPerUnit = Mesh::GetPixelsPerUnit(fieldOfView, HEIGHT);
+    std::vector<unsigned int> selected(objects);
+    std::vector<unsigned int> perLOD(mesh.GetLODCount(), 0);
+    unsigned long long fullTriangles = 0, selectedTriangles = 0;
+    start = std::chrono::steady_clock::now();
+    for(unsigned int i = 0; i < objects; ++i)
+        selected[i] = mesh.SelectLOD(models[i], camera, pixelsPerUnit, 1.0f);
+    double selectMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    for(unsigned int i = 0; i < objects; ++i) {
+        ++perLOD[selected[i]];
+        fullTriangles += mesh.GetLOD(0).indexCount / 3;
+        selectedTriangles += mesh.GetLOD(selected[i]).indexCount / 3;
+    }
+
+    Shader shader;
+    shader.CreateFromFiles("formatsVertexShader.glsl", "fragmentShader.glsl");
+    shader.UseShader();
+    GLuint uniformModel = shader.GetModelLocation();
+    auto draw = [&](bool useLODs) {
+        for(unsigned int i = 0; i < objects; ++i) {
+            GLState::Get().UniformMatrix4fv(uniformModel, glm::value_ptr(transforms[i]));
+            mesh.RenderMesh(useLODs ? selected[i] : 0);
+        }
+    };
+    Timing full = TimeFrames(context, 2, [&]() { draw(false); });
+    std::vector<unsigned char> fullImage = context.ReadPixels();
+    Timing lod = TimeFrames(context, 2, [&]() { draw(true); });
+    std::vector<unsigned char> lodImage = context.ReadPixels();
+    GLState::Get().UseProgram(0);
+
+    unsigned int differing = 0;
+    for(size_t i = 0; i < fullImage.size(); i += 3) {
+        for(int c = 0; c < 3; ++c) {
+            if(abs(fullImage[i + c] - lodImage[i + c]) > 16) {
+                ++differing;
+                break;
+            }
+        }
+    }
+
+    printf("%u objects, LOD selected in %.3f ms for a 1 pixel error:", objects, selectMs);
+    for(size_t i = 0; i < perLOD.size(); ++i)
+        printf(" %u", perLOD[i]);
+    printf("\n");
+    PrintTiming("full detail", full);
+    PrintTiming("selected LODs", lod);
+    printf("triangles %llu -> %llu (%.1f%%), %.3f%% of pixels visibly differ\n", fullTriangles, selectedTriangles,
+            100.0 * selectedTriangles / fullTriangles, 100.0 * differing / (fullImage.size() / 3));
+    return same && selectedTriangles < fullTriangles ? 0 : 1;
+}
+
+// Objects scattered all around a camera with a 60 degree view
+std::vector<glm::mat4> ScatteredModels(unsigned int objects)
+{
+    std::mt19937 random(7);
+    std::uniform_real_distribution<float> coordinate(-100.0f, 100.0f), unit(0.0f, 1.0f);
+    std::vector<glm::mat4> models(objects);
+    for(unsigned int i = 0; i < objects; ++i) {
+        glm::vec3 position(coordinate(random), coordinate(random), coordinate(random));
+        models[i] = glm::rotate(glm::translate(glm::mat4(1.0f), position), unit(random) * 2 * pi, glm::vec3(0, 1, 0));
+    }
+    return models;
+}
+
+glm::mat4 ScatteredViewProjection()
+{
+    return glm::perspective(glm::radians(60.0f), (float)WIDTH / HEIGHT, 0.1f, 150.0f) *
+        glm::lookAt(glm::vec3(0, 0, 0), glm::vec3(0, 0, -1), glm::vec3(0, 1, 0));
+}
+
+// batchVertexShader scales x and y by 0.4 before the model matrix
+const glm::mat4 shaderScale = glm::scale(glm::mat4(1.0f), glm::vec3(0.4f, 0.4f, 1.0f));
+
+int BenchmarkCull(Context &context, unsigned int objects, unsigned int frames)
+{
+    Mesh mesh;
+    mesh.CreateMesh(vertices, indices, 12, 12);
+    std::vector<glm::mat4> models = ScatteredModels(objects);
+    glm::mat4 viewProjection = ScatteredViewProjection();
+
+    FrustumCuller culler;
+    culler.SetFrustum(viewProjection);
+    std::vector<unsigned int> reference;
+    auto timeCulling = [&](const char *name, bool simd, unsigned int threads) {
+        culler.SetSIMD(simd);
+        culler.SetThreadCount(threads);
+        double addMs = 0, cullMs = 0;
+        for(unsigned int frame = 0; frame < frames; ++frame) {
+            auto start = std::chrono::steady_clock::now();
+            culler.Begin();
+            for(unsigned int i = 0; i < objects; ++i)
+                culler.Add(mesh.GetBounds(), models[i] * shaderScale);
+            auto added = std::chrono::steady_clock::now();
+            culler.Cull();
+            auto culled = std::chrono::steady_clock::now();
+            addMs += std::chrono::duration<double, std::milli>(added - start).count();
+            cullMs += std::chrono::duration<double, std::milli>(culled - added).count();
+        }
+
+        std::vector<unsigned int> visible = culler.Cull();
+        if(reference.empty())
+            reference = visible;
+        printf("%-24s bounds %8.3f ms   test %8.3f ms   %u threads   visible %u   culled %u   %s\n", name,
+                addMs / frames, cullMs / frames, culler.GetThreadsUsed(), culler.GetVisibleCount(),
+                culler.GetCulledCount(), visible == reference ? "same set" : "DIFFERENT set");
+        return visible == reference;
+    };
+
+    printf("%u objects, %u frames\n", objects, frames);
+    bool same = timeCulling("scalar", false, 1);
+    same = timeCulling("SIMD", true, 1) && same;
+    same = timeCulling("SIMD, all threads", true, 0) && same;
+    same = timeCulling("SIMD, 4 threads", true, 4) && same;
+
+    Shader shader;
+    shader.CreateFromFiles("batchVertexShader.glsl", "fragmentShader.glsl");
+    shader.UseShader();
+    BatchRenderer batch;
+    Timing all = TimeFrames(context, frames, [&]() {
+        batch.Begin();
+        for(unsigned int i = 0; i < objects; ++i)
+            batch.Add(&mesh, viewProjection * models[i]);
+        batch.Submit();
+    });
+    Timing culled = TimeFrames(context, frames, [&]() {
+        culler.Begin();
+        for(unsigned int i = 0; i < objects; ++i)
+            culler.Add(mesh.GetBounds(), models[i] * shaderScale);
+        const std::vector<unsigned int> &visible = culler.Cull();
+        batch.Begin();
+        for(size_t i = 0; i < visible.size(); ++i)
+            batch.Add(&mesh, viewProjection * models[visible[i]]);
+        batch.Submit();
+    });
+    GLState::Get().UseProgram(0);
+
+    PrintTiming("all objects", all);
+    PrintTiming("visible objects", culled);
+    printf("speedup: submit %.1fx, frame %.1fx, images %s\n", all.submitMs / culled.submitMs, all.frameMs / culled.frameMs,
+            all.checksum == culled.checksum ? "match" : "differ");
+    return same && all.checksum == culled.checksum ? 0 : 1;
+}
+
+int BenchmarkGPUCull(Context &context, unsigned int objects, unsigned int frames)
+{
+    Mesh mesh;
+    mesh.CreateMesh(vertices, indices, 12, 12);
+    std::vector<glm::mat4> models = ScatteredModels(objects);
+    glm::mat4 viewProjection = ScatteredViewProjection();
+
+    FrustumCuller culler;
+    culler.SetFrustum(viewProjection);
+    culler.Begin();
+    for(unsigned int i = 0; i < objects; ++i)
+        culler.Add(mesh.GetBounds(), models[i] * shaderScale);
+    std::vector<unsigned int> reference = culler.Cull();
+
+    GPUCuller gpuCuller;
+    if(!gpuCuller.Create())
+        return 1;
+    gpuCuller.SetFrustum(viewProjection);
+    gpuCuller.SetVertexTransform(shaderScale);
+    gpuCuller.Begin();
+    for(unsigned int i = 0; i < objects; ++i)
+        gpuCuller.Add(&mesh, models[i]);
+
+    // The compacted output, sorted back into object order, against the CPU
+    gpuCuller.Cull();
+    std::vector<unsigned int> visible = gpuCuller.ReadVisible();
+    unsigned int missing = 0, extra = 0;
+    for(size_t i = 0, j = 0; i < reference.size() || j < visible.size();) {
+        if(j == visible.size() || (i < reference.size() && reference[i] < visible[j]))
+            ++missing, ++i;
+        else if(i == reference.size() || visible[j] < reference[i])
+            ++extra, ++j;
+        else
+            ++i, ++j;
+    }
+    printf("%u objects, %u frames, GL_ARB_indirect_parameters %s\n", objects, frames,
+            GPUCuller::HasIndirectCount() ? "yes" : "no");
+    printf("CPU visible %zu, GPU visible %zu, %u missing, %u extra: %s\n", reference.size(), visible.size(), missing,
+            extra, missing == 0 && extra == 0 ? "same set" : "DIFFERENT set");
+
+    Shader shader;
+    shader.CreateFromFiles("batchVertexShader.glsl", "fragmentShader.glsl");
+    BatchRenderer batch;
+    Timing cpu = TimeFrames(context, frames, [&]() {
+        shader.UseShader();
+        culler.Begin();
+        for(unsigned int i = 0; i < objects; ++i)
+            culler.Add(mesh.GetBounds(), models[i] * shaderScale);
+        const std::vector<unsigned int> &visible = culler.Cull();
+        batch.Begin();
+        for(size_t i = 0; i < visible.size(); ++i)
+            batch.Add(&mesh, viewProjection * models[visible[i]]);
+        batch.Submit();
+    });
+    auto timeGPU = [&](bool indirectCount) {
+        gpuCuller.SetIndirectCount(indirectCount);
+        return TimeFrames(context, frames, [&]() {
+            gpuCuller.Cull();
+            shader.UseShader();
+            gpuCuller.Draw();
+        });
+    };
+    Timing gpu = timeGPU(true);
+    Timing gpuAll = timeGPU(false);
+    GLState::Get().UseProgram(0);
+
+    PrintTiming("CPU cull + batch", cpu);
+    PrintTiming("GPU cull, indirect count", gpu);
+    PrintTiming("GPU cull, zeroed slots", gpuAll);
+    printf("speedup: submit %.1fx, frame %.1fx, images %s\n", cpu.submitMs / gpu.submitMs, cpu.frameMs / gpu.frameMs,
+            cpu.checksum == gpu.checksum && cpu.checksum == gpuAll.checksum ? "match" : "differ");
+    return missing == 0 && extra == 0 && cpu.checksum == gpu.checksum && cpu.checksum == gpuAll.checksum ? 0 : 1;
+}
+
+int BenchmarkJobs(Context &context, unsigned int objects, unsigned int frames)
+{
+    Mesh mesh;
+    mesh.CreateMesh(vertices, indices, 12, 12);
+    std::vector<glm::mat4> placements = ScatteredModels(objects);
+    glm::mat4 viewProjection = ScatteredViewProjection();
+    std::vector<glm::mat4> models(objects);
+
+    Shader shader;
+    shader.CreateFromFiles("batchVertexShader.glsl", "fragmentShader.glsl");
+    shader.UseShader();
+    BatchRenderer batch;
+
+    // Every object spins about its own y axis, as in main.cpp
+    auto update = [&](unsigned int first, unsigned int last, float angle) {
+        for(unsigned int i = first; i < last; ++i)
+            models[i] = glm::rotate(placements[i], angle * pi / 180, glm::vec3(0, 1, 0));
+    };
+    auto printTiming = [&](const char *name, double buildMs, Timing &timing) {
+        printf("%-24s build %9.3f ms   submit %9.3f ms   frame %9.3f ms   image %016llx\n", name, buildMs,
+                timing.submitMs - buildMs, timing.frameMs, (unsigned long long)timing.checksum);
+    };
+
+    // Everything on the GL thread
+    FrustumCuller culler;
+    culler.SetFrustum(viewProjection);
+    culler.SetThreadCount(1);
+    DrawList drawList;
+    float angle = 0;
+    double buildMs = 0;
+    auto serialFrame = [&]() {
+        auto start = std::chrono::steady_clock::now();
+        angle += 0.5f;
+        update(0, objects, angle);
+        culler.Begin();
+        for(unsigned int i = 0; i < objects; ++i)
+            culler.Add(mesh.GetBounds(), models[i] * shaderScale);
+        const std::vector<unsigned int> &visible = culler.Cull();
+        drawList.Begin();
+        for(size_t i = 0; i < visible.size(); ++i)
+            drawList.Add(&mesh, viewProjection * models[visible[i]]);
+        buildMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        batch.Submit(drawList);
+    };
+
+    // Each run starts with an untimed frame, so none of them pays for first
+    // use of the shader, buffers and caches, and restarts the animation
+    auto warmUp = [&](auto &frame) {
+        frame();
+        glFinish();
+        angle = 0;
+        buildMs = 0;
+    };
+    warmUp(serialFrame);
+    Timing serial = TimeFrames(context, frames, serialFrame);
+    double serialBuildMs = buildMs / frames;
+    printf("%u objects, %u frames, %u hardware threads\n", objects, frames, std::thread::hardware_concurrency());
+    printTiming("serial", serialBuildMs, serial);
+
+    // Chunks of objects are updated, culled and recorded by jobs; the GL
+    // thread joins the chunk lists in order and submits
+    const unsigned int grain = 4096;
+    unsigned int chunks = (objects + grain - 1) / grain;
+    std::vector<FrustumCuller> chunkCullers(chunks);
+    std::vector<DrawList> chunkLists(chunks);
+    for(unsigned int c = 0; c < chunks; ++c) {
+        chunkCullers[c].SetFrustum(viewProjection);
+        chunkCullers[c].SetThreadCount(1);
+    }
+
+    bool same = true;
+    unsigned int threadCounts[] = {1, 2, 4, 0};
+    for(unsigned int t = 0; t < 4; ++t) {
+        JobSystem jobs;
+        jobs.Start(threadCounts[t]);
+        auto jobFrame = [&]() {
+            auto start = std::chrono::steady_clock::now();
+            angle += 0.5f;
+            JobCounter counter;
+            jobs.ParallelFor(counter, objects, grain, [&](unsigned int first, unsigned int last) {
+                update(first, last, angle);
+                FrustumCuller &chunkCuller = chunkCullers[first / grain];
+                chunkCuller.Begin();
+                for(unsigned int i = first; i < last; ++i)
+                    chunkCuller.Add(mesh.GetBounds(), models[i] * shaderScale);
+                const std::vector<unsigned int> &visible = chunkCuller.Cull();
+                DrawList &list = chunkLists[first / grain];
+                list.Begin();
+                for(size_t i = 0; i < visible.size(); ++i)
+                    list.Add(&mesh, viewProjection * models[first + visible[i]]);
+            });
+            jobs.Wait(counter);
+
+            drawList.Begin();
+            for(unsigned int c = 0; c < chunks; ++c)
+                drawList.Append(chunkLists[c]);
+            buildMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            batch.Submit(drawList);
+        };
+        warmUp(jobFrame);
+        Timing timing = TimeFrames(context, frames, jobFrame);
+
+        char name[32];
+        snprintf(name, sizeof(name), "jobs, %u thread%s", jobs.GetThreadCount(), jobs.GetThreadCount() == 1 ? "" : "s");
+        printTiming(name, buildMs / frames, timing);
+        printf("%-24s %llu steals, build speedup %.1fx, image %s\n", "", jobs.GetStealCount(),
+                serialBuildMs * frames / buildMs, timing.checksum == serial.checksum ? "matches" : "DIFFERS");
+        same = same && timing.checksum == serial.checksum;
+    }
+    GLState::Get().UseProgram(0);
+    return same ? 0 : 1;
+}
+
+int BenchmarkTransforms(unsigned int nodes, unsigned int animated, unsigned int frames)
+{
+    // Objects of 16 nodes, each node hanging off the object's root or one
+    // of the few nodes added just before it
+    std::mt19937 random(11);
+    std::uniform_real_distribution<float> coordinate(-10.0f, 10.0f), unit(0.0f, 1.0f);
+    TransformHierarchy scene;
+    for(unsigned int i = 0; i < nodes; ++i) {
+        unsigned int root = i - i % 16;
+        int parent = i == root ? TRANSFORM_NO_PARENT : std::max(root, i - 1 - (unsigned int)(unit(random) * 4));
+        unsigned int node = scene.AddNode(parent);
+        scene.SetTranslation(node, glm::vec3(coordinate(random), coordinate(random), coordinate(random)));
+        scene.SetRotation(node, glm::angleAxis(unit(random) * 2 * pi, glm::vec3(0, 1, 0)));
+        scene.SetScale(node, glm::vec3(0.5f + unit(random)));
+    }
+    scene.Update();
+
+    std::vector<unsigned int> moving(animated);
+    for(unsigned int i = 0; i < animated; ++i)
+        moving[i] = random() % nodes;
+
+    // What main.cpp did before: every matrix rebuilt from scratch each frame
+    std::vector<glm::mat4> rebuilt(nodes);
+    auto rebuild = [&]() {
+        for(unsigned int i = 0; i < nodes; ++i) {
+            glm::mat4 local = glm::translate(glm::mat4(1.0f), scene.GetTranslation(i)) * glm::mat4_cast(scene.GetRotation(i));
+            local = glm::scale(local, scene.GetScale(i));
+            int parent = scene.GetParent(i);
+            rebuilt[i] = parent == TRANSFORM_NO_PARENT ? local : rebuilt[parent] * local;
+        }
+    };
+
+    auto time = [&](const char *name, const std::vector<unsigned int> &animate, bool simd, bool fromScratch) {
+        scene.SetSIMD(simd);
+        double updateMs = 0;
+        unsigned long long updated = 0;
+        for(unsigned int frame = 0; frame < frames; ++frame) {
+            glm::quat spin = glm::angleAxis(frame * 0.01f, glm::vec3(0, 1, 0));
+            for(size_t i = 0; i < animate.size(); ++i)
+                scene.SetRotation(animate[i], spin * scene.GetRotation(animate[i]));
+
+            auto start = std::chrono::steady_clock::now();
+            if(fromScratch)
+                rebuild();
+            else
+                scene.Update();
+            updateMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            updated += fromScratch ? nodes : scene.GetUpdatedCount();
+        }
+
+        // Rebuilding from scratch must give the same matrices, bit for bit
+        if(fromScratch)
+            scene.Update();
+        else
+            rebuild();
+        bool same = rebuilt == scene.GetWorlds();
+        printf("%-32s update %9.3f ms   %9llu matrices per frame   %s\n", name, updateMs / frames, updated / frames,
+                same ? "same matrices" : "DIFFERENT matrices");
+        return same;
+    };
+
+    std::vector<unsigned int> everything(nodes);
+    for(unsigned int i = 0; i < nodes; ++i)
+        everything[i] = i;
+
+    printf("%u nodes, %u animated, %u frames\n", nodes, animated, frames);
+    bool same = time("rebuild all, glm", moving, false, true);
+    same = time("dirty subtrees, scalar", moving, false, false) && same;
+    same = time("dirty subtrees, SIMD", moving, true, false) && same;
+    same = time("every node dirty, scalar", everything, false, false) && same;
+    same = time("every node dirty, SIMD", everything, true, false) && same;
+    return same ? 0 : 1;
+}
+
+int BenchmarkProfile(Context &context, unsigned int objects, unsigned int frames, const char *prefix)
+{
+    Mesh mesh;
+    mesh.CreateMesh(vertices, indices, 12, 12);
+    std::vector<glm::mat4> models = ScatteredModels(objects);
+    glm::mat4 viewProjection = ScatteredViewProjection();
+
+    Shader shader;
+    shader.CreateFromFiles("batchVertexShader.glsl", "fragmentShader.glsl");
+    shader.UseShader();
+    FrustumCuller culler;
+    culler.SetFrustum(viewProjection);
+    BatchRenderer batch;
+
+    auto draw = [&](FrameProfiler &profiler) {
+        profiler.BeginFrame();
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        profiler.BeginScope("cull");
+        culler.Begin();
+        for(unsigned int i = 0; i < objects; ++i)
+            culler.Add(mesh.GetBounds(), models[i] * shaderScale);
+        const std::vector<unsigned int> &visible = culler.Cull();
+        profiler.EndScope();
+
+        profiler.BeginScope("record");
+        batch.Begin();
+        for(size_t i = 0; i < visible.size(); ++i)
+            batch.Add(&mesh, viewProjection * models[visible[i]]);
+        profiler.EndScope();
+
+        profiler.BeginScope("submit");
+        batch.Submit();
+        profiler.EndScope();
+
+        profiler.EndFrame();
+    };
+
+    // Frames are only flushed, not finished, so the GPU runs behind and the
+    // query ring is what keeps the profiler from waiting on it. Each run
+    // starts with an untimed, unprofiled frame, so the unprofiled run does
+    // not pay alone for first use of the shader and buffers
+    auto run = [&](FrameProfiler &profiler) {
+        FrameProfiler idle;
+        draw(idle);
+        glFinish();
+
+        auto start = std::chrono::steady_clock::now();
+        for(unsigned int frame = 0; frame < frames; ++frame) {
+            draw(profiler);
+            glFlush();
+        }
+        glFinish();
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / frames;
+    };
+
+    FrameProfiler off, on;
+    double offMs = run(off);
+    on.Create();
+    double onMs = run(on);
+    on.Flush();
+    GLState::Get().UseProgram(0);
+
+    printf("%u objects, %u frames: %.3f ms per frame unprofiled, %.3f ms profiled\n", objects, frames, offMs, onMs);
+    on.PrintSummary();
+    bool saved = on.SaveJSON(std::string(prefix) + ".json") && on.SaveChromeTrace(std::string(prefix) + ".trace.json");
+    if(saved)
+        printf("wrote %s.json and %s.trace.json\n", prefix, prefix);
+    return saved && on.GetFrames().size() == frames ? 0 : 1;
+}
+
+// Writes meshes distinct spheres as .mesh files, then loads them all while
+// drawing frames of a fixed light scene: first synchronously inside one
+// frame, then through MeshStreamer with its default budget. The loaded
+// spheres are drawn once at the end, and both ways must give the same image
+int BenchmarkStreaming(Context &context, unsigned int meshes, const char *directory)
+{
+    std::vector<GLfloat> positions, normals, uvs;
+    std::vector<unsigned int> sphereIndices;
+    BuildSphere(192, positions, normals, uvs, sphereIndices);
+    unsigned int vertexCount = positions.size() / 3;
+    VertexLayout layout;
+    layout.Add(VERTEX_POSITION, ENCODING_FLOAT).Add(VERTEX_NORMAL, ENCODING_FLOAT).Add(VERTEX_UV, ENCODING_FLOAT);
+
+    // Each sphere is a little bigger than the last, so none is shared
+    mkdir(directory, 0755);
+    std::vector<std::string> paths(meshes);
+    size_t totalBytes = 0;
+    for(unsigned int i = 0; i < meshes; ++i) {
+        std::vector<GLfloat> scaled(positions);
+        for(size_t v = 0; v < scaled.size(); ++v)
+            scaled[v] *= 1.0f + 0.001f * i;
+        std::vector<unsigned char> packed = layout.Pack(scaled.data(), normals.data(), uvs.data(), vertexCount);
+        MeshData data(layout, packed.data(), vertexCount, sphereIndices.data(), sphereIndices.size());
+        paths[i] = std::string(directory) + "/sphere" + std::to_string(i) + ".mesh";
+        if(!data.Save(paths[i]))
+            return 1;
+        totalBytes += packed.size() + IndexSize(IndexTypeFor(vertexCount)) * sphereIndices.size();
+    }
+
+    std::vector<glm::mat4> models = GridModels(meshes);
+    for(unsigned int i = 0; i < meshes; ++i)
+        models[i] = glm::scale(models[i], glm::vec3(0.45f));
+
+    Mesh pyramid;
+    pyramid.CreateMesh(vertices, indices, 12, 12);
+    std::vector<glm::mat4> pyramidModels = GridModels(100);
+
+    Shader shader;
+    shader.CreateFromFiles("formatsVertexShader.glsl", "fragmentShader.glsl");
+    shader.UseShader();
+    GLuint uniformModel = shader.GetModelLocation();
+
+    class LoadTiming {
+        public:
+            double worstMs, meanMs;
+            unsigned int frames;
+            uint64_t checksum;
+    };
+
+    // Loading starts on frame 1, after a frame with nothing to load
+    auto run = [&](MeshStreamer *streamer) {
+        std::vector<Mesh> loaded(meshes);
+        LoadTiming timing{0, 0, 0, 0};
+        unsigned int frame = 0, drawable = 0;
+        while(frame < 2 || drawable < meshes) {
+            auto start = std::chrono::steady_clock::now();
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            for(unsigned int i = 0; frame == 1 && i < meshes; ++i) {
+                if(streamer)
+                    streamer->Load(paths[i], &loaded[i]);
+                else
+                    loaded[i].CreateFromFile(paths[i]);
+            }
+            if(streamer)
+                streamer->Update();
+
+            for(size_t i = 0; i < pyramidModels.size(); ++i) {
+                GLState::Get().UniformMatrix4fv(uniformModel, glm::value_ptr(pyramidModels[i]));
+                pyramid.RenderMesh();
+            }
+            glFinish();
+
+            drawable = 0;
+            for(unsigned int i = 0; i < meshes; ++i)
+                drawable += loaded[i].GetGeometry() ? 1 : 0;
+
+            double frameMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            timing.worstMs = std::max(timing.worstMs, frameMs);
+            timing.meanMs += frameMs;
+            ++frame;
+        }
+        timing.frames = frame - 1;
+        timing.meanMs /= frame;
+
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        for(unsigned int i = 0; i < meshes; ++i) {
+            GLState::Get().UniformMatrix4fv(uniformModel, glm::value_ptr(models[i]));
+            loaded[i].RenderMesh();
+        }
+        glFinish();
+        timing.checksum = Context::Checksum(context.ReadPixels());
+        return timing;
+    };
+
+    // The synchronous meshes are released before streaming, so the streamed
+    // ones are uploaded again rather than shared
+    LoadTiming blocking = run(nullptr);
+    MeshStreamer streamer;
+    if(!streamer.Create())
+        return 1;
+    LoadTiming streamed = run(&streamer);
+    GLState::Get().UseProgram(0);
+
+    for(unsigned int i = 0; i < meshes; ++i)
+        unlink(paths[i].c_str());
+    rmdir(directory);
+
+    printf("%u meshes, %.1f MB of geometry, %d MB budget per frame\n", meshes, totalBytes / 1048576.0,
+            STREAM_FRAME_BUDGET >> 20);
+    printf("%-24s worst frame %9.3f ms   mean %9.3f ms   %3u frames to load   image %016llx\n", "synchronous",
+            blocking.worstMs, blocking.meanMs, blocking.frames, (unsigned long long)blocking.checksum);
+    printf("%-24s worst frame %9.3f ms   mean %9.3f ms   %3u frames to load   image %016llx\n", "streamed",
+            streamed.worstMs, streamed.meanMs, streamed.frames, (unsigned long long)streamed.checksum);
+    printf("%.1f MB staged, %.1f MB uploaded directly, loader waited for the ring %llu times\n",
+            streamer.GetStagedBytes() / 1048576.0, streamer.GetDirectBytes() / 1048576.0,
+            (unsigned long long)streamer.GetRingWaitCount());
+    return blocking.checksum == streamed.checksum ? 0 : 1;
+}
+
+// A grid of about vertices vertices whose heights move every frame, either
+// all of them or a band of a tenth of the rows. Compares re-creating a Mesh
+// each frame with each DynamicMesh update mode. Frames are only flushed, so
+// an upload that waits for the GPU shows up in its time; every way must end
+// on the same image
+int BenchmarkDynamic(Context &context, unsigned int vertices, unsigned int frames)
+{
+    unsigned int side = 2;
+    while((side + 1) * (side + 1) <= vertices)
+        ++side;
+    unsigned int vertexCount = side * side;
+    std::vector<GLfloat> positions(3 * vertexCount);
+    std::vector<unsigned int> gridIndices;
+    for(unsigned int y = 0; y < side; ++y) {
+        for(unsigned int x = 0; x < side; ++x) {
+            unsigned int v = y * side + x;
+            positions[3 * v] = -1 + 2.0f * x / (side - 1);
+            positions[3 * v + 1] = -1 + 2.0f * y / (side - 1);
+            if(x + 1 < side && y + 1 < side)
+                gridIndices.insert(gridIndices.end(), {v, v + 1, v + side, v + 1, v + side + 1, v + side});
+        }
+    }
+    VertexLayout layout = VertexLayout::Positions();
+
+    // Moves rows [first, last) to their heights for frame
+    auto animate = [&](unsigned int frame, unsigned int first, unsigned int last) {
+        for(unsigned int v = first * side; v < last * side; ++v)
+            positions[3 * v + 2] = 0.5f * sinf(8 * positions[3 * v] + 0.3f * frame) * cosf(6 * positions[3 * v + 1]);
+    };
+
+    Shader shader;
+    shader.CreateFromFiles("vertexShader.glsl", "fragmentShader.glsl");
+    shader.UseShader();
+    GLuint uniformModel = shader.GetModelLocation();
+    glm::mat4 model = glm::scale(glm::mat4(1.0f), glm::vec3(2.4f, 2.4f, 1.0f));
+
+    class UpdateTiming {
+        public:
+            double uploadMs, frameMs;
+            double uploadedMB;
+            uint64_t stalls, checksum;
+    };
+
+    // mode < 0 re-creates a Mesh instead
+    auto run = [&](int mode, bool partial) {
+        animate(0, 0, side);
+
+        Mesh mesh;
+        DynamicMesh dynamic;
+        if(mode < 0)
+            mesh.CreateMesh(layout, positions.data(), vertexCount, gridIndices.data(), gridIndices.size());
+        else
+            dynamic.CreateMesh(layout, positions.data(), vertexCount, gridIndices.data(), gridIndices.size(), (DynamicUpdate)mode);
+
+        UpdateTiming timing{0, 0, 0, 0, 0};
+        glFinish();
+        auto start = std::chrono::steady_clock::now();
+        for(unsigned int frame = 1; frame <= frames; ++frame) {
+            unsigned int band = std::max(1u, side / 10);
+            unsigned int first = partial ? (frame - 1) * band % side : 0;
+            unsigned int last = partial ? std::min(side, first + band) : side;
+            animate(frame, first, last);
+
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            auto uploadStart = std::chrono::steady_clock::now();
+            if(mode < 0) {
+                mesh.ClearMesh();
+                mesh.CreateMesh(layout, positions.data(), vertexCount, gridIndices.data(), gridIndices.size());
+                timing.uploadedMB += 12.0 * vertexCount / 1048576;
+            } else {
+                dynamic.UpdateVertices(first * side, (last - first) * side, &positions[3 * first * side]);
+                dynamic.Upload();
+                timing.uploadedMB += dynamic.GetUploadedBytes() / 1048576.0;
+            }
+            timing.uploadMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - uploadStart).count();
+
+            GLState::Get().UniformMatrix4fv(uniformModel, glm::value_ptr(model));
+            if(mode < 0)
+                mesh.RenderMesh();
+            else
+                dynamic.RenderMesh();
+            glFlush();
+        }
+        glFinish();
+        timing.frameMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / frames;
+        timing.uploadMs /= frames;
+        timing.uploadedMB /= frames;
+        timing.stalls = dynamic.GetStallCount();
+        timing.checksum = Context::Checksum(context.ReadPixels());
+        return timing;
+    };
+
+    const char *names[] = {"re-create Mesh", "glBufferSubData", "orphaning", "persistent x3"};
+    printf("%u vertices, %zu triangles, %u frames\n", vertexCount, gridIndices.size() / 3, frames);
+    uint64_t expected = 0;
+    bool same = true;
+    for(int partial = 0; partial < 2; ++partial) {
+        for(int mode = -1; mode <= DYNAMIC_PERSISTENT; ++mode) {
+            UpdateTiming timing = run(mode, partial);
+            if(mode < 0)
+                expected = timing.checksum;
+            same = same && timing.checksum == expected;
+            printf("%-10s %-18s upload %9.3f ms   frame %9.3f ms   %7.2f MB per frame   %2llu stalls   image %016llx\n",
+                    partial ? "band" : "all rows", names[mode + 1], timing.uploadMs, timing.frameMs, timing.uploadedMB,
+                    (unsigned long long)timing.stalls, (unsigned long long)timing.checksum);
+        }
+    }
+    GLState::Get().UseProgram(0);
+    return same ? 0 : 1;
+}
+
+int main(int argc, char **argv)
+{
+    if(argc < 2) {
+        std::cout << "Usage: " << argv[0] << " instancing [objects] [frames] | sharing [meshes] | arena [meshes] [frames] | batch [objects] [frames] | state [objects] [frames] | uniforms [objects] [frames] | shadercache [variants] [directory] | asynccompile [variants] | formats [segments] | optimize [segments] | lod [objects] [file] | cull [objects] [frames] | gpucull [objects] [frames] | jobs [objects] [frames] | transforms [nodes] [animated] [frames] | profile [objects] [frames] [prefix] | streaming [meshes] [directory] | dynamic [vertices] [frames]" << std::endl;
+        return 1;
+    }
+
+    Context context;
+    if(!context.CreateHeadless(WIDTH, HEIGHT, 0))
+        return 1;
+
+    glEnable(GL_DEPTH_TEST);
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+
+    if(!strcmp(argv[1], "instancing"))
+        return BenchmarkInstancing(context, argc > 2 ? atoi(argv[2]) : 100000, argc > 3 ? atoi(argv[3]) : 10);
+    if(!strcmp(argv[1], "sharing"))
+        return BenchmarkSharing(argc > 2 ? atoi(argv[2]) : 10000);
+    if(!strcmp(argv[1], "arena"))
+        return BenchmarkArena(context, argc > 2 ? atoi(argv[2]) : 10000, argc > 3 ? atoi(argv[3]) : 10);
+    if(!strcmp(argv[1], "batch"))
+        return BenchmarkBatch(context, argc > 2 ? atoi(argv[2]) : 100000, argc > 3 ? atoi(argv[3]) : 10);
+    if(!strcmp(argv[1], "state"))
+        return BenchmarkState(context, argc > 2 ? atoi(argv[2]) : 100000, argc > 3 ? atoi(argv[3]) : 10);
+    if(!strcmp(argv[1], "uniforms"))
+        return BenchmarkUniforms(context, argc > 2 ? atoi(argv[2]) : 100000, argc > 3 ? atoi(argv[3]) : 10);
+    if(!strcmp(argv[1], "shadercache"))
+        return BenchmarkShaderCache(context, argc > 2 ? atoi(argv[2]) : 100, argc > 3 ? argv[3] : "shader_cache");
+    if(!strcmp(argv[1], "asynccompile"))
+        return BenchmarkAsyncCompile(context, argc > 2 ? atoi(argv[2]) : 100);
+    if(!strcmp(argv[1], "formats"))
+        return BenchmarkFormats(context, argc > 2 ? atoi(argv[2]) : 128);
+    if(!strcmp(argv[1], "optimize"))
+        return BenchmarkOptimize(context, argc > 2 ? atoi(argv[2]) : 256);
+    if(!strcmp(argv[1], "lod"))
+        return BenchmarkLOD(context, argc > 2 ? atoi(argv[2]) : 1000, argc > 3 ? argv[3] : "torus.mesh");
+    if(!strcmp(argv[1], "cull"))
+        return BenchmarkCull(context, argc > 2 ? atoi(argv[2]) : 100000, argc > 3 ? atoi(argv[3]) : 10);
+    if(!strcmp(argv[1], "gpucull"))
+        return BenchmarkGPUCull(context, argc > 2 ? atoi(argv[2]) : 100000, argc > 3 ? atoi(argv[3]) : 10);
+    if(!strcmp(argv[1], "jobs"))
+        return BenchmarkJobs(context, argc > 2 ? atoi(argv[2]) : 100000, argc > 3 ? atoi(argv[3]) : 10);
+    if(!strcmp(argv[1], "transforms"))
+        return BenchmarkTransforms(argc > 2 ? atoi(argv[2]) : 100000, argc > 3 ? atoi(argv[3]) : 100,
+                argc > 4 ? atoi(argv[4]) : 100);
+    if(!strcmp(argv[1], "profile"))
+        return BenchmarkProfile(context, argc > 2 ? atoi(argv[2]) : 100000, argc > 3 ? atoi(argv[3]) : 100,
+                argc > 4 ? argv[4] : "profile");
+    if(!strcmp(argv[1], "streaming"))
+        return BenchmarkStreaming(context, argc > 2 ? atoi(argv[2]) : 64, argc > 3 ? argv[3] : "stream_meshes");
+    if(!strcmp(argv[1], "dynamic"))
+        return BenchmarkDynamic(context, argc > 2 ? atoi(argv[2]) : 1000000, argc > 3 ? atoi(argv[3]) : 10);
+
+    std::cout << "Unknown benchmark " << argv[1] << std::endl;
+    return 1;
+}
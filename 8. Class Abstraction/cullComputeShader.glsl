@@ -0,0 +1,78 @@
+#version 450
+layout(local_size_x = 64) in;
+
+struct CullObject
+{
+    mat4 model;
+    vec4 center;
+    vec4 extents;
+    uint count;
+    uint firstIndex;
+    int baseVertex;
+    uint padding;
+};
+
+struct DrawCommand
+{
+    uint count;
+    uint instanceCount;
+    uint firstIndex;
+    int baseVertex;
+    uint baseInstance;
+};
+
+layout(std430, binding = 0) writeonly buffer Models
+{
+    mat4 models[];
+};
+
+layout(std430, binding = 1) readonly buffer Objects
+{
+    CullObject objects[];
+};
+
+layout(std430, binding = 2) writeonly buffer Commands
+{
+    DrawCommand commands[];
+};
+
+layout(std430, binding = 3) buffer DrawCount
+{
+    uint drawCount;
+};
+
+layout(std430, binding = 4) writeonly buffer VisibleObjects
+{
+    uint visibleObjects[];
+};
+
+uniform uint objectCount;
+uniform mat4 viewProjection;
+uniform mat4 vertexTransform;
+uniform vec4 planes[6];
+
+void main()
+{
+    uint index = gl_GlobalInvocationID.x;
+    if(index >= objectCount)
+        return;
+
+    // World box of the transformed local box (Arvo), as Bounds::Transform
+    mat4 model = objects[index].model * vertexTransform;
+    vec3 extents = objects[index].extents.xyz;
+    vec3 center = (model * vec4(objects[index].center.xyz, 1.0)).xyz;
+    vec3 worldExtents = abs(model[0].xyz) * extents.x + abs(model[1].xyz) * extents.y + abs(model[2].xyz) * extents.z;
+
+    for(int i = 0; i < 6; ++i) {
+        float distance = planes[i].x * center.x + planes[i].y * center.y + planes[i].z * center.z + planes[i].w;
+        float reach = abs(planes[i].x) * worldExtents.x + abs(planes[i].y) * worldExtents.y +
+            abs(planes[i].z) * worldExtents.z;
+        if(distance + reach < 0.0)
+            return;
+    }
+
+    uint slot = atomicAdd(drawCount, 1u);
+    commands[slot] = DrawCommand(objects[index].count, 1u, objects[index].firstIndex, objects[index].baseVertex, slot);
+    models[slot] = viewProjection * objects[index].model;
+    visibleObjects[slot] = index;
+}
@@ -0,0 +1,26 @@
+#version 450
+layout(location = 0) in vec3 pos;
+layout(location = 6) in vec4 normalIn;
+layout(location = 7) in vec2 uv;
+out vec4 vCol;
+uniform mat4 model;
+
+// Octahedral normals arrive as x, y in [-1, 1]; unfold them back onto the sphere
+vec3 DecodeNormal(vec4 encoded)
+{
+#ifdef OCTAHEDRAL_NORMALS
+    vec3 n = vec3(encoded.xy, 1.0 - abs(encoded.x) - abs(encoded.y));
+    if(n.z < 0.0)
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return normalize(n);
+#else
+    return encoded.xyz;
+#endif
+}
+
+void main()
+{
+    gl_Position = model * vec4(pos, 1.0);
+    vec3 n = DecodeNormal(normalIn);
+    vCol = vec4((0.5 * n + 0.5) * (0.6 + 0.4 * uv.y), 1.0);
+}
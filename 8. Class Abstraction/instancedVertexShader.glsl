@@ -0,0 +1,10 @@
+#version 450
+layout(location = 0) in vec3 pos;
+layout(location = 1) in mat4 instanceModel;
+out vec4 vCol;
+
+void main()
+{
+    gl_Position = instanceModel * vec4(pos.x * 0.4, pos.y * 0.4, pos.z, 1.0);
+    vCol = vec4(clamp(pos, 0.0, 1.0), 1.0);
+}
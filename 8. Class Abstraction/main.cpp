@@ -1,5 +1,10 @@
 #include <iostream>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <string>
 #include <vector>
 
 #include <GL/glew.h>
@@ -9,13 +14,22 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include "BatchRenderer.hpp"
+#include "Context.hpp"
+#include "FrameProfiler.hpp"
+#include "FrustumCuller.hpp"
+#include "JobSystem.hpp"
 #include "Mesh.hpp"
 #include "Shader.hpp"
+#include "ShaderWatcher.hpp"
+#include "TransformHierarchy.hpp"
 
 const int WIDTH = 800, HEIGHT = 600;
 const float pi = 3.14159265358979323846f;
+// Degrees per second the meshes spin at
+const double spinSpeed = 30.0;
 
-static const char *vShader = "vertexShader.glsl";
+static const char *vShader = "batchVertexShader.glsl";
 
 static const char *fShader = "fragmentShader.glsl";
 
@@ -54,81 +68,156 @@ void CreateShaders()
     shaderList.push_back(shader);
 }
 
-int main(void)
+// Parses a whole non-negative decimal number; false for anything else
+bool ParseCount(const char *text, unsigned int &value)
 {
-    if(glfwInit() != GLFW_TRUE) {
-        std::cout << "GLFW Init failed!!" << std::endl;
-        glfwTerminate();
-        return 1;
-    }
-
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 5);
-    // Core Profile = No Backwards Compatibility
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    char *end;
+    errno = 0;
+    long parsed = strtol(text, &end, 10);
+    if(end == text || *end != '\0' || errno == ERANGE || parsed < 0 || parsed > UINT_MAX)
+        return false;
+    value = parsed;
+    return true;
+}
 
-    GLFWwindow *mainWindow = glfwCreateWindow(WIDTH, HEIGHT, "My Triangle", NULL, NULL);
-    if (!mainWindow) {
-        std::cout << "GLFW window creation failed!" << std::endl;
-        glfwTerminate();
-        return 1;
+int main(int argc, char **argv)
+{
+    // --headless <frames> : render offscreen (EGL/OSMesa) for a number of frames
+    // --dump <prefix>     : with --headless, write every frame to <prefix>NNNN.ppm
+    // --checksum          : with --headless, print a hash of every frame
+    // --shader-cache <dir>: keep linked shader binaries in dir between runs
+    // --threads <n>       : threads for scene update and culling, 0 for all
+    // --profile <prefix>  : time frames and write prefix.json and
+    //                       prefix.trace.json (Chrome trace) on exit
+    unsigned int headlessFrames = 0, threads = 0;
+    const char *dumpPrefix = nullptr, *profilePrefix = nullptr;
+    bool checksum = false;
+    for(int i = 1; i < argc; ++i) {
+        if(!strcmp(argv[i], "--headless") && i + 1 < argc && ParseCount(argv[i + 1], headlessFrames))
+            ++i;
+        else if(!strcmp(argv[i], "--dump") && i + 1 < argc)
+            dumpPrefix = argv[++i];
+        else if(!strcmp(argv[i], "--checksum"))
+            checksum = true;
+        else if(!strcmp(argv[i], "--shader-cache") && i + 1 < argc)
+            Shader::SetCacheDirectory(argv[++i]);
+        else if(!strcmp(argv[i], "--threads") && i + 1 < argc && ParseCount(argv[i + 1], threads))
+            ++i;
+        else if(!strcmp(argv[i], "--profile") && i + 1 < argc)
+            profilePrefix = argv[++i];
+        else {
+            std::cout << "Usage: " << argv[0] << " [--headless frames [--dump prefix] [--checksum]] [--shader-cache dir] [--threads n] [--profile prefix]" << std::endl;
+            return 1;
+        }
     }
 
-    // Set context for GLEW to use
-    glfwMakeContextCurrent(mainWindow);
-
-    // Allow modern extension features
-    glewExperimental = GL_TRUE;
-
-    if (glewInit() != GLEW_OK) {
-        std::cout << "GLEW initialisation failed!" << std::endl;
-        glfwDestroyWindow(mainWindow);
-        glfwTerminate();
+    Context context;
+    if(headlessFrames > 0) {
+        if(!context.CreateHeadless(WIDTH, HEIGHT, headlessFrames))
+            return 1;
+    } else if(!context.CreateWindowed(WIDTH, HEIGHT, "My Triangle"))
         return 1;
-    }
 
     glEnable(GL_DEPTH_TEST);
 
     CreateTriangle();
     CreateShaders();
 
+    // Edits to the shader files show up without a restart
+    ShaderWatcher watcher;
+    watcher.Watch(shaderList[0]);
+
+    // The scene is updated, culled and recorded on job threads; the GL
+    // thread only submits the finished draw list, in a single multi-draw
+    JobSystem jobs;
+    jobs.Start(threads);
+    DrawList drawList;
+    BatchRenderer batch;
     float angle = 0;
-    GLuint uniformModel = 0;
 
-    while (!glfwWindowShouldClose(mainWindow)) {
-        // Get + Handle user input events
-        glfwPollEvents();
+    // There is no camera, the models map straight to clip space. The vertex
+    // shader scales x and y by 0.4 first, so the bounds get the same scale
+    FrustumCuller culler;
+    culler.SetFrustum(glm::mat4(1.0f));
+    culler.SetJobSystem(&jobs);
+    const glm::mat4 shaderScale = glm::scale(glm::mat4(1.0f), glm::vec3(0.4f, 0.4f, 1.0f));
+
+    // The first mesh hangs below a spinning, half-size pivot; the second
+    // spins the other way above it
+    TransformHierarchy scene;
+    unsigned int pivot = scene.AddNode();
+    scene.SetScale(pivot, glm::vec3(0.5f, 0.5f, 0.5f));
+    std::vector<unsigned int> meshNodes(meshList.size());
+    meshNodes[0] = scene.AddNode(pivot);
+    scene.SetTranslation(meshNodes[0], glm::vec3(0, -0.5f, 0));
+    meshNodes[1] = scene.AddNode();
+    scene.SetTranslation(meshNodes[1], glm::vec3(0, 0.5f, 0));
+    scene.SetScale(meshNodes[1], glm::vec3(0.5f, 0.5f, 0.5f));
+
+    // Does nothing unless created
+    FrameProfiler profiler;
+    if(profilePrefix)
+        profiler.Create();
+
+    while (!context.ShouldClose()) {
+        profiler.BeginFrame();
+        watcher.Poll();
 
         // Clear window
         glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        angle += 0.5f;
+        // Advanced by elapsed time, so the speed does not depend on the
+        // frame rate; headless frames are a fixed step
+        angle += spinSpeed * context.GetFrameTime();
         if(angle >= 360)
-            angle = 0;
-
+            angle -= 360;
+
+        scene.SetRotation(pivot, glm::angleAxis(angle*pi/180, glm::vec3(0.0f, 1.0f, 0.0f)));
+        scene.SetRotation(meshNodes[1], glm::angleAxis(-angle*pi/180, glm::vec3(0.0f, 1.0f, 0.0f)));
+
+        // Only meshes inside the view reach the draw list
+        profiler.BeginScope("update and record");
+        JobCounter record;
+        jobs.Run(record, [&]() {
+            scene.Update();
+            culler.Begin();
+            for(size_t i = 0; i < meshList.size(); ++i)
+                culler.Add(meshList[i]->GetBounds(), scene.GetWorld(meshNodes[i]) * shaderScale);
+            const std::vector<unsigned int> &visible = culler.Cull();
+
+            drawList.Begin();
+            for(size_t i = 0; i < visible.size(); ++i)
+                drawList.Add(meshList[visible[i]], scene.GetWorld(meshNodes[visible[i]]));
+        });
+        jobs.Wait(record);
+        profiler.EndScope();
+
+        profiler.BeginScope("submit");
         shaderList[0]->UseShader();
-        uniformModel = shaderList[0]->GetModelLocation();
-
-        glm::mat4 model{1.0f};
-        model = glm::rotate(model, angle*pi/180, glm::vec3(0.0f, 1.0f, 0.0f));
-        model = glm::scale(model, glm::vec3(0.5f, 0.5f, 0.5f));
-        model = glm::translate(model, glm::vec3(0, -0.5f, 0));
-        glUniformMatrix4fv(uniformModel, 1, GL_FALSE, glm::value_ptr(model));
-       
-        meshList[0]->RenderMesh();
-
-
-        glm::mat4 model2{1.0f};
-        model2 = glm::translate(model2, glm::vec3(0, 0.5f, 0));
-        model2 = glm::rotate(model2, -angle*pi/180, glm::vec3(0.0f, 1.0f, 0.0f));
-        model2 = glm::scale(model2, glm::vec3(0.5f, 0.5f, 0.5f));
-        glUniformMatrix4fv(uniformModel, 1, GL_FALSE, glm::value_ptr(model2));
-
-        meshList[1]->RenderMesh();
-
-        glUseProgram(0);
+        batch.Submit(drawList);
+        profiler.EndScope();
+
+        if(context.IsHeadless() && (dumpPrefix || checksum)) {
+            ProfileScope scope(&profiler, "readback");
+            std::vector<unsigned char> pixels = context.ReadPixels();
+            if(dumpPrefix) {
+                char path[256];
+                snprintf(path, sizeof(path), "%s%04u.ppm", dumpPrefix, context.GetFrame());
+                context.SavePPM(path, pixels);
+            }
+            if(checksum)
+                printf("frame %u %016llx\n", context.GetFrame(), (unsigned long long)Context::Checksum(pixels));
+        }
+
+        profiler.EndFrame();
+        context.EndFrame();
+    }
 
-        glfwSwapBuffers(mainWindow);
+    if(profilePrefix) {
+        profiler.Flush();
+        profiler.PrintSummary();
+        profiler.SaveJSON(std::string(profilePrefix) + ".json");
+        profiler.SaveChromeTrace(std::string(profilePrefix) + ".trace.json");
     }
 }
@@ -2,6 +2,16 @@
 #include <vector>
 #include <utility>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
 #include "Parameters.h"
 
 constexpr float inf = std::numeric_limits<float>::infinity();
@@ -14,11 +24,13 @@ class Point
     Point() {}
     Point(float x, float y, float z):x(x), y(y), z(z) {}
 
-    Point CanvasToViewport();
     float dot(Point &p);
+    float norm();
+    Point cross(Point &p);
     Point operator +(Point &p);
     Point operator -(Point &p);
-    void operator =(Point &p);
+    Point operator *(float c);
+    void operator =(Point p);
 };
 
 using Vector = Point;
@@ -28,6 +40,16 @@ float Point::dot(Point &p)
     return x * p.x + y * p.y + z * p.z;
 }
 
+float Point::norm()
+{
+    return sqrt(this->dot(*this));
+}
+
+Point Point::cross(Point &p)
+{
+    return Point {y * p.z - z * p.y, z * p.x - x * p.z, x * p.y - y * p.x};
+}
+
 Point Point::operator +(Point &p)
 {
     return Point {x + p.x, y + p.y, z + p.z};
@@ -38,16 +60,16 @@ Point Point::operator -(Point &p)
     return Point {x - p.x, y - p.y, z - p.z};
 }
 
-void Point::operator =(Point &p)
+Point Point::operator *(float c)
 {
-    x = p.x;
-    y = p.y;
-    z = p.z;
+    return Point{c * x, c * y, c * z};
 }
 
-Point Point::CanvasToViewport()
+void Point::operator =(Point p)
 {
-    return Point {x * V_W/C_W, y * V_H/C_H, V_D};
+    x = p.x;
+    y = p.y;
+    z = p.z;
 }
 
 class Sphere
@@ -104,22 +126,251 @@ std::vector<float> &TraceRay(Point &origin, Point &direction, float t_min, float
     return closest_sphere->color;
 }
 
+// Counter-based RNG: every (pixel, sample, dimension) triple maps to a fixed
+// value, so the image doesn't depend on which thread renders which pixel
+float PixelRandom(unsigned int px, unsigned int py, unsigned int sample, unsigned int dim)
+{
+    uint64_t h = ((uint64_t)RNG_SEED << 32) ^ ((uint64_t)py * C_W + px);
+    h = h * 0x9E3779B97F4A7C15ull + ((uint64_t)sample << 8 | dim);
+    h ^= h >> 30;
+    h *= 0xBF58476D1CE4E5B9ull;
+    h ^= h >> 27;
+    h *= 0x94D049BB133111EBull;
+    h ^= h >> 31;
+    return (h >> 40) * (1.0f / (1 << 24));
+}
+
+// Look-at camera with an optional vertical field of view and thin lens. Pixel
+// directions are the top-left pixel's plus per-column and per-row steps, set
+// up once per frame by SetCanvas.
+class Camera
+{
+    public:
+    Point position;
+    Vector forward, right, up;
+    float distance, viewport_w, viewport_h, fov;
+    float lens_radius, focus_distance;
+    Vector top_left, col_delta, row_delta;
+
+    Camera(Point eye, Point target, Vector up_hint, float fov_degrees, float aperture, float focus);
+    void SetCanvas(int width, int height);
+    void GenerateRay(int col, int row, float jx, float jy, int sample, Point &origin, Vector &direction);
+};
+
+Camera::Camera(Point eye, Point target, Vector up_hint, float fov_degrees, float aperture, float focus)
+{
+    position = eye;
+    forward = target - eye;
+    forward = forward * (1 / forward.norm());
+    right = up_hint.cross(forward);
+    right = right * (1 / right.norm());
+    up = forward.cross(right);
+
+    distance = V_D;
+    viewport_w = V_W;
+    viewport_h = V_H;
+    fov = fov_degrees;
+    lens_radius = aperture / 2;
+    focus_distance = focus;
+}
+
+void Camera::SetCanvas(int width, int height)
+{
+    // Without a field of view the V_W x V_H viewport is used as is
+    if(fov > 0) {
+        viewport_h = 2 * distance * tan(fov * M_PI / 360);
+        viewport_w = viewport_h * width / height;
+    }
+
+    Vector center = forward * distance;
+    Vector left = right * (-width/2 * viewport_w / width);
+    Vector top = up * ((height/2 - 1) * viewport_h / height);
+    top_left = center + left;
+    top_left = top_left + top;
+    col_delta = right * (viewport_w / width);
+    row_delta = up * (-viewport_h / height);
+}
+
+// Ray through pixel (col, row) offset by the jitter (jx, jy), measured in
+// pixels from the top-left pixel. With a lens it starts on the lens disk and
+// aims at the same point of the focal plane the pinhole ray passes through;
+// the lens sample comes from the pixel's own random stream, not the jittered
+// position's.
+void Camera::GenerateRay(int col, int row, float jx, float jy, int sample, Point &origin, Vector &direction)
+{
+    Vector across = col_delta * (col + jx);
+    Vector down = row_delta * (row + jy);
+    direction = top_left + down;
+    direction = direction + across;
+    origin = position;
+    if(lens_radius <= 0)
+        return;
+
+    float r = lens_radius * sqrt(PixelRandom(col, row, sample, 2));
+    float theta = 2 * M_PI * PixelRandom(col, row, sample, 3);
+    Vector lens_u = right * (r * cos(theta));
+    Vector lens_v = up * (r * sin(theta));
+    Vector lens = lens_u + lens_v;
+    origin = origin + lens;
+    Vector shift = lens * (distance / focus_distance);
+    direction = direction - shift;
+}
+
+// FNV-1a over the 8-bit pixel values written to the output
+uint64_t HashPixels(std::vector<float> &image, int x0, int y0, int w, int h)
+{
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for(int row = y0; row < y0 + h; ++row) {
+        for(int col = x0; col < x0 + w; ++col) {
+            for(int c = 0; c < 3; ++c) {
+                float v = image[(row * C_W + col) * 3 + c];
+                hash ^= (uint8_t)std::min(std::max(v, 0.0f), 255.0f);
+                hash *= 0x100000001B3ull;
+            }
+        }
+    }
+    return hash;
+}
+
+void RenderTile(int tile, std::vector<float> &image, Camera &camera, std::vector<Sphere> &sphere_list)
+{
+    int tiles_x = (C_W + TILE_SIZE - 1) / TILE_SIZE;
+    int x0 = (tile % tiles_x) * TILE_SIZE;
+    int y0 = (tile / tiles_x) * TILE_SIZE;
+
+    for(int row = y0; row < std::min(y0 + TILE_SIZE, C_H); ++row) {
+        for(int col = x0; col < std::min(x0 + TILE_SIZE, C_W); ++col) {
+            float sum[3] = {0.0f, 0.0f, 0.0f};
+
+            for(int s = 0; s < SAMPLES_PER_PIXEL; ++s) {
+                float jx = 0.0f, jy = 0.0f;
+                if(SAMPLES_PER_PIXEL > 1) {
+                    jx = PixelRandom(col, row, s, 0) - 0.5f;
+                    jy = PixelRandom(col, row, s, 1) - 0.5f;
+                }
+                Point origin;
+                Vector direction;
+                camera.GenerateRay(col, row, jx, jy, s, origin, direction);
+                std::vector<float> &color = TraceRay(origin, direction, 1, inf, sphere_list);
+                for(int c = 0; c < 3; ++c)
+                    sum[c] += color[c];
+            }
+
+            for(int c = 0; c < 3; ++c)
+                image[(row * C_W + col) * 3 + c] = round(sum[c] / SAMPLES_PER_PIXEL);
+        }
+    }
+}
+
+// Hash a reference dump ("r g b" per line) the same way as HashPixels
+bool HashReference(const char *path, uint64_t &hash)
+{
+    std::ifstream ref(path);
+    if(!ref.is_open()) {
+        std::cerr << "Can't read reference " << path << std::endl;
+        return false;
+    }
+
+    std::vector<float> image(C_W * C_H * 3);
+    for(int i = 0; i < C_W * C_H * 3; ++i) {
+        if(!(ref >> image[i])) {
+            std::cerr << "Reference " << path << " is smaller than " << C_W << "x" << C_H << std::endl;
+            return false;
+        }
+    }
+    hash = HashPixels(image, 0, 0, C_W, C_H);
+    return true;
+}
+
+// Parses a whole non-negative decimal number; false for anything else
+bool ParseCount(const char *text, int &value)
+{
+    char *end;
+    errno = 0;
+    long parsed = strtol(text, &end, 10);
+    if(end == text || *end != '\0' || errno == ERANGE || parsed < 0 || parsed > INT_MAX)
+        return false;
+    value = parsed;
+    return true;
+}
+
 int main(int argc, char **argv)
 {
+    // -t <threads>  : worker thread count
+    // -c            : print per-tile and whole-image hashes instead of pixels
+    // -r <file>     : compare the image hash against a reference dump
+    int num_threads = NUM_THREADS;
+    bool checksum = false;
+    const char *reference = nullptr;
+    for(int i = 1; i < argc; ++i) {
+        if(!strcmp(argv[i], "-t") && i + 1 < argc && ParseCount(argv[i + 1], num_threads))
+            ++i;
+        else if(!strcmp(argv[i], "-c"))
+            checksum = true;
+        else if(!strcmp(argv[i], "-r") && i + 1 < argc)
+            reference = argv[++i];
+        else {
+            std::cerr << "Usage: " << argv[0] << " [-t threads] [-c] [-r reference]" << std::endl;
+            return 1;
+        }
+    }
+    if(num_threads <= 0)
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+
     // Create the scene
     std::vector<Sphere> sphere_list;
     sphere_list.push_back(Sphere(Point(0, -1, 3), std::vector<float>{255, 0, 0}, 1));
     sphere_list.push_back(Sphere(Point(2, 0, 4), std::vector<float>{0, 0, 255}, 1));
     sphere_list.push_back(Sphere(Point(-2, 0, 4), std::vector<float>{0, 255, 0}, 1));
 
-    Point origin{O_X, O_Y, O_Z};
+    Camera camera(Point{O_X, O_Y, O_Z}, Point{LOOK_X, LOOK_Y, LOOK_Z}, Vector{0, 1, 0}, CAMERA_FOV, APERTURE, FOCUS_DISTANCE);
+    camera.SetCanvas(C_W, C_H);
 
-    for(int y = C_H/2 - 1; y >= -C_H/2; --y) {
-        for(int x = -C_W/2; x <= C_W/2 - 1; ++x) {
-            Point converted = Point{x, y, 0}.CanvasToViewport();
-            std::vector<float> color = TraceRay(origin, converted, 1, inf, sphere_list);
+    // Tiles are handed out dynamically, but every pixel is written to a fixed
+    // slot, so the result is the same for any thread count or schedule
+    int tiles_x = (C_W + TILE_SIZE - 1) / TILE_SIZE;
+    int tiles_y = (C_H + TILE_SIZE - 1) / TILE_SIZE;
+    std::vector<float> image(C_W * C_H * 3);
+    std::atomic<int> next_tile{0};
 
-            std::cout << color[0] << " " << color[1] << " " << color[2] << std::endl;
+    std::vector<std::thread> workers;
+    for(int t = 0; t < num_threads; ++t) {
+        workers.push_back(std::thread([&]() {
+            int tile;
+            while((tile = next_tile++) < tiles_x * tiles_y)
+                RenderTile(tile, image, camera, sphere_list);
+        }));
+    }
+    for(int t = 0; t < num_threads; ++t)
+        workers[t].join();
+
+    if(!checksum && !reference) {
+        for(int i = 0; i < C_W * C_H; ++i)
+            std::cout << image[i * 3] << " " << image[i * 3 + 1] << " " << image[i * 3 + 2] << "\n";
+        return 0;
+    }
+
+    uint64_t image_hash = HashPixels(image, 0, 0, C_W, C_H);
+    if(checksum) {
+        std::cout << std::hex << std::setfill('0');
+        for(int ty = 0; ty < tiles_y; ++ty) {
+            for(int tx = 0; tx < tiles_x; ++tx) {
+                int w = std::min(TILE_SIZE, C_W - tx * TILE_SIZE);
+                int h = std::min(TILE_SIZE, C_H - ty * TILE_SIZE);
+                std::cout << "tile " << std::dec << tx << " " << ty << " " << std::hex << std::setw(16)
+                          << HashPixels(image, tx * TILE_SIZE, ty * TILE_SIZE, w, h) << "\n";
+            }
         }
+        std::cout << "image " << std::setw(16) << image_hash << std::endl;
     }
-}    
+
+    if(reference) {
+        uint64_t reference_hash;
+        if(!HashReference(reference, reference_hash))
+            return 1;
+        if(reference_hash != image_hash) {
+            std::cerr << "Image doesn't match reference " << reference << std::endl;
+            return 1;
+        }
+    }
+}
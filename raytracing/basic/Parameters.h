@@ -16,3 +16,19 @@
 #define BACKGROUND_R 255
 #define BACKGROUND_G 255
 #define BACKGROUND_B 255
+
+// Rendering parameters
+#define TILE_SIZE 32
+#define NUM_THREADS 0 // 0 = one thread per hardware thread
+#define SAMPLES_PER_PIXEL 1 // 1 = single sample at the pixel position, no jitter
+#define RNG_SEED 0
+
+// Camera: looks from the origin towards LOOK_X/Y/Z. CAMERA_FOV is the vertical
+// field of view in degrees; 0 keeps the V_W x V_H viewport at V_D.
+// APERTURE > 0 enables thin-lens depth of field focused at FOCUS_DISTANCE.
+#define LOOK_X 0.0f
+#define LOOK_Y 0.0f
+#define LOOK_Z 1.0f
+#define CAMERA_FOV 0.0f
+#define APERTURE 0.0f
+#define FOCUS_DISTANCE 3.0f
@@ -2,7 +2,32 @@
 #include <vector>
 #include <utility>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <string>
+#include <filesystem>
+#include <sstream>
+#include <functional>
+#include <memory>
+#include <map>
+#include <queue>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
 #include "Parameters.h"
+#include "Profile.h"
 
 constexpr float inf = std::numeric_limits<float>::infinity();
 std::vector<float> background_color {BACKGROUND_R, BACKGROUND_G, BACKGROUND_B};
@@ -14,9 +39,9 @@ class Point
     Point() {}
     Point(float x, float y, float z):x(x), y(y), z(z) {}
 
-    Point CanvasToViewport();
     float dot(Point &p);
     float norm();
+    Point cross(Point &p);
     Point operator +(Point &p);
     Point operator -(Point &p);
     Point operator *(float c);
@@ -35,6 +60,11 @@ float Point::norm()
     return sqrt(this->dot(*this));
 }
 
+Point Point::cross(Point &p)
+{
+    return Point {y * p.z - z * p.y, z * p.x - x * p.z, x * p.y - y * p.x};
+}
+
 Point Point::operator +(Point &p)
 {
     return Point {x + p.x, y + p.y, z + p.z};
@@ -57,11 +87,6 @@ void Point::operator =(Point p)
     z = p.z;
 }
 
-Point Point::CanvasToViewport()
-{
-    return Point {x * V_W/C_W, y * V_H/C_H, V_D};
-}
-
 enum
 {
     LIGHT_AMBIENT,
@@ -111,58 +136,173 @@ float ComputeLighting(Point p, Vector normal, std::vector<Light> &light_sources)
     return i;
 }
 
-class Sphere
+// One row of up to TILE_SIZE rays, stored as separate component arrays so the
+// per-ray loops in ray generation and intersection vectorise
+class RayPacket
 {
     public:
-    Point center;
-    std::vector<float> color;
-    float radius;
+    int count;
+    float ox[TILE_SIZE], oy[TILE_SIZE], oz[TILE_SIZE];
+    float dx[TILE_SIZE], dy[TILE_SIZE], dz[TILE_SIZE];
+    float closest_t[TILE_SIZE];
+    int closest_sphere[TILE_SIZE];
+};
 
-    Sphere(Point c, std::vector<float> clr, float r):center(c), color(clr), radius(r) {}
-    std::pair<float, float> IntersectRaySphere(Point &origin, Point &direction);
+float PixelRandom(unsigned int px, unsigned int py, unsigned int sample, unsigned int dim);
+
+// Pinhole or thin-lens camera. SetCanvas precomputes the direction of the
+// top-left pixel and the per-column and per-row steps, so generating a ray is
+// a couple of multiply-adds instead of per-pixel divisions.
+class Camera
+{
+    public:
+    Point position;
+    Vector forward, right, up;
+    float distance, viewport_w, viewport_h, fov;
+    float lens_radius, focus_distance;
+    Vector top_left, col_delta, row_delta;
+
+    Camera(Point eye, Point target, Vector up_hint, float fov_degrees, float aperture, float focus);
+    void SetCanvas(int width, int height);
+    Vector PixelDirection(float col, float row);
+    void GenerateRays(RayPacket &packet, int col, int row, int count, int sample, int samples);
 };
 
-std::pair<float, float> Sphere::IntersectRaySphere(Point &origin, Point &direction)
+Camera::Camera(Point eye, Point target, Vector up_hint, float fov_degrees, float aperture, float focus)
+{
+    position = eye;
+    forward = target - eye;
+    forward = forward * (1 / forward.norm());
+    right = up_hint.cross(forward);
+    right = right * (1 / right.norm());
+    up = forward.cross(right);
+
+    distance = V_D;
+    viewport_w = V_W;
+    viewport_h = V_H;
+    fov = fov_degrees;
+    lens_radius = aperture / 2;
+    focus_distance = focus;
+}
+
+void Camera::SetCanvas(int width, int height)
+{
+    // Without a field of view the V_W x V_H viewport is used as is
+    if(fov > 0) {
+        viewport_h = 2 * distance * tan(fov * M_PI / 360);
+        viewport_w = viewport_h * width / height;
+    }
+
+    Vector center = forward * distance;
+    Vector left = right * (-width/2 * viewport_w / width);
+    Vector top = up * ((height/2 - 1) * viewport_h / height);
+    top_left = center + left;
+    top_left = top_left + top;
+    col_delta = right * (viewport_w / width);
+    row_delta = up * (-viewport_h / height);
+}
+
+// Direction through canvas position (col, row), measured in pixels from the
+// top-left pixel
+Vector Camera::PixelDirection(float col, float row)
 {
-    Vector oc = origin - center;
-    float k1 = direction.dot(direction);
-    float k2 = 2 * oc.dot(direction);
-    float k3 = oc.dot(oc) - radius * radius;
+    Vector across = col_delta * col;
+    Vector down = row_delta * row;
+    Vector direction = top_left + down;
+    return direction + across;
+}
 
-    float discriminant = k2 * k2 - 4 * k1 * k3;
-    if(discriminant < 0)
-        return std::pair<float, float>(inf, inf);
+// Fills the packet with the rays of pixels [col, col + count) of a row for one
+// sample. Jitter and lens positions come from the counter-based RNG.
+void Camera::GenerateRays(RayPacket &packet, int col, int row, int count, int sample, int samples)
+{
+    float jx[TILE_SIZE] = {}, jy[TILE_SIZE] = {}, lu[TILE_SIZE] = {}, lv[TILE_SIZE] = {};
+    if(samples > 1) {
+        for(int i = 0; i < count; ++i) {
+            jx[i] = PixelRandom(col + i, row, sample, 0) - 0.5f;
+            jy[i] = PixelRandom(col + i, row, sample, 1) - 0.5f;
+        }
+    }
+    if(lens_radius > 0) {
+        for(int i = 0; i < count; ++i) {
+            float r = lens_radius * sqrt(PixelRandom(col + i, row, sample, 2));
+            float theta = 2 * M_PI * PixelRandom(col + i, row, sample, 3);
+            lu[i] = r * cos(theta);
+            lv[i] = r * sin(theta);
+        }
+    }
 
-    float t1 = (-k2 + sqrt(discriminant)) / (2 * k1);
-    float t2 = (-k2 - sqrt(discriminant)) / (2 * k1);
-    return std::pair<float, float>(t1, t2);
+    Vector row_start = PixelDirection(col, row);
+    float focus_scale = lens_radius > 0 ? distance / focus_distance : 0;
+    packet.count = count;
+    for(int i = 0; i < count; ++i) {
+        float u = i + jx[i];
+        float dx = row_start.x + col_delta.x * u + row_delta.x * jy[i];
+        float dy = row_start.y + col_delta.y * u + row_delta.y * jy[i];
+        float dz = row_start.z + col_delta.z * u + row_delta.z * jy[i];
+
+        // Thin lens: start on the lens disk and aim at the same point of the
+        // focal plane the pinhole ray passes through
+        float lx = right.x * lu[i] + up.x * lv[i];
+        float ly = right.y * lu[i] + up.y * lv[i];
+        float lz = right.z * lu[i] + up.z * lv[i];
+        packet.ox[i] = position.x + lx;
+        packet.oy[i] = position.y + ly;
+        packet.oz[i] = position.z + lz;
+        packet.dx[i] = dx - lx * focus_scale;
+        packet.dy[i] = dy - ly * focus_scale;
+        packet.dz[i] = dz - lz * focus_scale;
+    }
 }
 
-std::vector<float> TraceRay(Point &origin, Point &direction, float t_min, float t_max,
-        std::vector<Sphere> &sphere_list, std::vector<Light> &light_sources)
+class Sphere
 {
-    float closest_t = inf;
-    Sphere *closest_sphere = nullptr;
+    public:
+    Point center;
+    std::vector<float> color;
+    float radius;
 
-    for(int i = 0; i < sphere_list.size(); ++i) {
-        std::pair<float, float> t_pair = sphere_list[i].IntersectRaySphere(origin, direction);
-        float t1 = t_pair.first;
-        float t2 = t_pair.second;
+    Sphere(Point c, std::vector<float> clr, float r):center(c), color(clr), radius(r) {}
+    void IntersectRaySphere(RayPacket &packet, int index, float t_min, float t_max);
+};
 
+// Updates the closest hit of every ray in the packet that meets this sphere
+// (the sphere's index in the scene) within [t_min, t_max]
+void Sphere::IntersectRaySphere(RayPacket &packet, int index, float t_min, float t_max)
+{
+    for(int i = 0; i < packet.count; ++i) {
+        float ocx = packet.ox[i] - center.x;
+        float ocy = packet.oy[i] - center.y;
+        float ocz = packet.oz[i] - center.z;
+        float k1 = packet.dx[i] * packet.dx[i] + packet.dy[i] * packet.dy[i] + packet.dz[i] * packet.dz[i];
+        float k2 = 2 * (ocx * packet.dx[i] + ocy * packet.dy[i] + ocz * packet.dz[i]);
+        float k3 = (ocx * ocx + ocy * ocy + ocz * ocz) - radius * radius;
+
+        // A miss has a negative discriminant; its NaN roots fail every
+        // comparison below, which keeps the loop branch-free
+        float discriminant = k2 * k2 - 4 * k1 * k3;
+        float t1 = (-k2 + sqrt(discriminant)) / (2 * k1);
+        float t2 = (-k2 - sqrt(discriminant)) / (2 * k1);
+
+        float closest_t = packet.closest_t[i];
+        int closest_sphere = packet.closest_sphere[i];
         if(t1 >= t_min && t1 <= t_max && t1 < closest_t) {
             closest_t = t1;
-            closest_sphere = &sphere_list[i];
+            closest_sphere = index;
         }
-        
+
         if(t2 >= t_min && t2 <= t_max && t2 < closest_t) {
             closest_t = t2;
-            closest_sphere = &sphere_list[i];
+            closest_sphere = index;
         }
+        packet.closest_t[i] = closest_t;
+        packet.closest_sphere[i] = closest_sphere;
     }
+}
 
-    if(closest_sphere == nullptr)
-        return background_color;
-
+std::vector<float> ShadeHit(Point &origin, Point &direction, float closest_t, Sphere *closest_sphere,
+        std::vector<Light> &light_sources)
+{
     // Compute point of intersection, normal
     direction = direction * closest_t;
     Point p = origin + direction;
@@ -180,29 +320,703 @@ std::vector<float> TraceRay(Point &origin, Point &direction, float t_min, float
     return final_color;
 }
 
-int main(int argc, char **argv)
+class Scene
 {
-    // Create the scene
+    public:
     std::vector<Sphere> sphere_list;
-    sphere_list.push_back(Sphere(Point(0, -1, 3), std::vector<float>{255, 0, 0}, 1));
-    sphere_list.push_back(Sphere(Point(2, 0, 4), std::vector<float>{0, 0, 255}, 1));
-    sphere_list.push_back(Sphere(Point(-2, 0, 4), std::vector<float>{0, 255, 0}, 1));
-    sphere_list.push_back(Sphere(Point(0, -5001, 0), std::vector<float>{255, 255, 0}, 5000));
+    std::vector<Light> light_sources;
+};
+
+Scene CreateDefaultScene()
+{
+    Scene scene;
+    scene.sphere_list.push_back(Sphere(Point(0, -1, 3), std::vector<float>{255, 0, 0}, 1));
+    scene.sphere_list.push_back(Sphere(Point(2, 0, 4), std::vector<float>{0, 0, 255}, 1));
+    scene.sphere_list.push_back(Sphere(Point(-2, 0, 4), std::vector<float>{0, 255, 0}, 1));
+    scene.sphere_list.push_back(Sphere(Point(0, -5001, 0), std::vector<float>{255, 255, 0}, 5000));
 
     // Light Sources
-    std::vector<Light> light_sources;
-    light_sources.push_back(Light(LIGHT_AMBIENT, 0.2f));
-    light_sources.push_back(Light(LIGHT_POINT, 0.6f, Point{2, 1, 0}));
-    light_sources.push_back(Light(LIGHT_DIRECTIONAL, 0.2f, Vector{1, 4, 4}));
+    scene.light_sources.push_back(Light(LIGHT_AMBIENT, 0.2f));
+    scene.light_sources.push_back(Light(LIGHT_POINT, 0.6f, Point{2, 1, 0}));
+    scene.light_sources.push_back(Light(LIGHT_DIRECTIONAL, 0.2f, Vector{1, 4, 4}));
+    return scene;
+}
+
+// Everything that describes one render: resolution, sampling, camera and
+// the resulting pixels (row-major, top row first, 3 floats per pixel)
+class Frame
+{
+    public:
+    int width, height, samples;
+    Camera camera;
+    std::vector<float> image;
+
+    Frame(int w, int h, int s, Camera c):width(w), height(h), samples(s), camera(c), image(w * h * 3)
+    {
+        camera.SetCanvas(w, h);
+    }
+    int TileCount();
+    void GetTile(int tile, int &x0, int &y0, int &w, int &h);
+};
+
+int Frame::TileCount()
+{
+    return ((width + TILE_SIZE - 1) / TILE_SIZE) * ((height + TILE_SIZE - 1) / TILE_SIZE);
+}
+
+void Frame::GetTile(int tile, int &x0, int &y0, int &w, int &h)
+{
+    int tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+    x0 = (tile % tiles_x) * TILE_SIZE;
+    y0 = (tile / tiles_x) * TILE_SIZE;
+    w = std::min(TILE_SIZE, width - x0);
+    h = std::min(TILE_SIZE, height - y0);
+}
+
+// Counter-based RNG: every (pixel, sample, dimension) triple maps to a fixed
+// value, so the image doesn't depend on which thread renders which pixel
+float PixelRandom(unsigned int px, unsigned int py, unsigned int sample, unsigned int dim)
+{
+    uint64_t h = ((uint64_t)RNG_SEED << 32) ^ ((uint64_t)py << 16) ^ px;
+    h = h * 0x9E3779B97F4A7C15ull + ((uint64_t)sample << 8 | dim);
+    h ^= h >> 30;
+    h *= 0xBF58476D1CE4E5B9ull;
+    h ^= h >> 27;
+    h *= 0x94D049BB133111EBull;
+    h ^= h >> 31;
+    return (h >> 40) * (1.0f / (1 << 24));
+}
+
+// FNV-1a over the 8-bit pixel values written to the output
+uint64_t HashPixels(Frame &frame, int x0, int y0, int w, int h)
+{
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for(int row = y0; row < y0 + h; ++row) {
+        for(int col = x0; col < x0 + w; ++col) {
+            for(int c = 0; c < 3; ++c) {
+                float v = frame.image[(row * frame.width + col) * 3 + c];
+                hash ^= (uint8_t)std::min(std::max(v, 0.0f), 255.0f);
+                hash *= 0x100000001B3ull;
+            }
+        }
+    }
+    return hash;
+}
+
+void RenderTile(int tile, Frame &frame, Scene &scene)
+{
+    int x0, y0, w, h;
+    frame.GetTile(tile, x0, y0, w, h);
+    PROFILE_TRACE("tile " + std::to_string(tile));
+
+    // Each tile row is traced as one packet per sample: generate the rays,
+    // find the closest hit of every ray, then shade
+    RayPacket packet;
+    float sum[TILE_SIZE * 3];
+    for(int row = y0; row < y0 + h; ++row) {
+        std::fill(sum, sum + w * 3, 0.0f);
+
+        for(int s = 0; s < frame.samples; ++s) {
+            {
+                PROFILE_STAGE(STAGE_RAY_GENERATION);
+                frame.camera.GenerateRays(packet, x0, row, w, s, frame.samples);
+                PROFILE_COUNT(rays, w);
+            }
+
+            {
+                PROFILE_STAGE(STAGE_INTERSECTION);
+                std::fill(packet.closest_t, packet.closest_t + w, inf);
+                std::fill(packet.closest_sphere, packet.closest_sphere + w, -1);
+
+                for(int k = 0; k < scene.sphere_list.size(); ++k)
+                    scene.sphere_list[k].IntersectRaySphere(packet, k, 1, inf);
+                PROFILE_COUNT(intersection_tests, w * scene.sphere_list.size());
+            }
+
+            PROFILE_STAGE(STAGE_SHADING);
+            for(int i = 0; i < w; ++i) {
+                std::vector<float> color = background_color;
+                if(packet.closest_sphere[i] >= 0) {
+                    PROFILE_COUNT(hits, 1);
+                    PROFILE_COUNT(shading_calls, 1);
+                    Point origin{packet.ox[i], packet.oy[i], packet.oz[i]};
+                    Vector direction{packet.dx[i], packet.dy[i], packet.dz[i]};
+                    color = ShadeHit(origin, direction, packet.closest_t[i],
+                            &scene.sphere_list[packet.closest_sphere[i]], scene.light_sources);
+                }
+                for(int c = 0; c < 3; ++c)
+                    sum[i * 3 + c] += color[c];
+            }
+        }
+
+        for(int i = 0; i < w * 3; ++i)
+            frame.image[(row * frame.width + x0) * 3 + i] = round(sum[i] / frame.samples);
+    }
+}
+
+// Hash a reference dump ("r g b" per line) the same way as HashPixels
+bool HashReference(const char *path, Frame &frame, uint64_t &hash)
+{
+    std::ifstream ref(path);
+    if(!ref.is_open()) {
+        std::cerr << "Can't read reference " << path << std::endl;
+        return false;
+    }
+
+    Frame reference(frame.width, frame.height, frame.samples, frame.camera);
+    for(int i = 0; i < reference.image.size(); ++i) {
+        if(!(ref >> reference.image[i])) {
+            std::cerr << "Reference " << path << " is smaller than " << frame.width << "x" << frame.height << std::endl;
+            return false;
+        }
+    }
+    hash = HashPixels(reference, 0, 0, reference.width, reference.height);
+    return true;
+}
+
+uint64_t HashBytes(uint64_t hash, const void *data, size_t size)
+{
+    const uint8_t *bytes = (const uint8_t *)data;
+    for(size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 0x100000001B3ull;
+    }
+    return hash;
+}
+
+uint64_t HashPoint(uint64_t hash, Point &p)
+{
+    float xyz[3] = {p.x, p.y, p.z};
+    return HashBytes(hash, xyz, sizeof(xyz));
+}
+
+// Conservative test of a sphere against the frustum of rays leaving the camera
+// through canvas rectangle [col_min, col_max] x [row_min, row_max], beyond t = 1
+bool SphereInFrustum(Sphere &sphere, Camera &camera, float col_min, float col_max, float row_min, float row_max)
+{
+    // Lens rays don't share an apex, so every sphere counts
+    if(camera.lens_radius > 0)
+        return true;
+
+    Vector left = camera.PixelDirection(col_min, row_min);
+    Vector right = camera.PixelDirection(col_max, row_min);
+    Vector top = camera.PixelDirection(col_min, row_min);
+    Vector bottom = camera.PixelDirection(col_min, row_max);
+    Vector planes[5] = {
+        left.cross(camera.row_delta),
+        camera.row_delta.cross(right),
+        camera.col_delta.cross(top),
+        bottom.cross(camera.col_delta),
+        camera.forward
+    };
+    float offsets[5] = {0, 0, 0, 0, camera.distance};
+
+    Vector oc = sphere.center - camera.position;
+    for(int i = 0; i < 5; ++i) {
+        if(planes[i].dot(oc) - offsets[i] < -sphere.radius * planes[i].norm())
+            return false;
+    }
+    return true;
+}
+
+// Hash of every scene input the pixels of a tile depend on: the spheres that
+// overlap its frustum and, if any do, all lights (lighting is unshadowed, so
+// every light reaches every visible surface)
+uint64_t TileKey(int tile, Frame &frame, Scene &scene)
+{
+    int x0, y0, w, h;
+    frame.GetTile(tile, x0, y0, w, h);
+    int x1 = x0 + w - 1;
+    int y1 = y0 + h - 1;
+
+    Camera &camera = frame.camera;
+    int header[] = {TILE_CACHE_VERSION, frame.width, frame.height, x0, y0, x1, y1, frame.samples, RNG_SEED};
+    float view[] = {camera.distance, camera.viewport_w, camera.viewport_h, camera.lens_radius, camera.focus_distance};
+    uint64_t hash = HashBytes(0xCBF29CE484222325ull, header, sizeof(header));
+    hash = HashBytes(hash, view, sizeof(view));
+    hash = HashPoint(hash, camera.position);
+    hash = HashPoint(hash, camera.forward);
+    hash = HashPoint(hash, camera.right);
+    hash = HashPoint(hash, camera.up);
+    hash = HashBytes(hash, background_color.data(), background_color.size() * sizeof(float));
+
+    // Jittered samples reach half a pixel past the outer pixel positions
+    bool visible = false;
+    for(int i = 0; i < scene.sphere_list.size(); ++i) {
+        Sphere &sphere = scene.sphere_list[i];
+        if(!SphereInFrustum(sphere, camera, x0 - 0.5f, x1 + 0.5f, y0 - 0.5f, y1 + 0.5f))
+            continue;
+
+        visible = true;
+        hash = HashPoint(hash, sphere.center);
+        hash = HashBytes(hash, &sphere.radius, sizeof(sphere.radius));
+        hash = HashBytes(hash, sphere.color.data(), sphere.color.size() * sizeof(float));
+    }
+
+    if(visible) {
+        for(int k = 0; k < scene.light_sources.size(); ++k) {
+            Light &light = scene.light_sources[k];
+            hash = HashBytes(hash, &light.type, sizeof(light.type));
+            hash = HashBytes(hash, &light.intensity, sizeof(light.intensity));
+            if(light.type == LIGHT_POINT)
+                hash = HashPoint(hash, light.position);
+            else if(light.type == LIGHT_DIRECTIONAL)
+                hash = HashPoint(hash, light.direction);
+        }
+    }
+    return hash;
+}
+
+std::string TilePath(const char *cache_dir, uint64_t key)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.tile", (unsigned long long)key);
+    return std::string(cache_dir) + "/" + name;
+}
+
+// Tiles are stored as the raw floats of their pixels, row by row
+bool LoadTile(int tile, Frame &frame, const char *cache_dir, uint64_t key)
+{
+    std::ifstream file(TilePath(cache_dir, key), std::ios::binary);
+    if(!file.is_open())
+        return false;
+
+    int x0, y0, w, h;
+    frame.GetTile(tile, x0, y0, w, h);
+
+    std::vector<float> pixels(w * h * 3);
+    if(!file.read((char *)pixels.data(), pixels.size() * sizeof(float)) || file.peek() != EOF)
+        return false;
+
+    for(int row = 0; row < h; ++row)
+        std::copy(&pixels[row * w * 3], &pixels[(row + 1) * w * 3], &frame.image[((y0 + row) * frame.width + x0) * 3]);
+    return true;
+}
+
+void StoreTile(int tile, Frame &frame, const char *cache_dir, uint64_t key)
+{
+    int x0, y0, w, h;
+    frame.GetTile(tile, x0, y0, w, h);
+
+    // Write to a temporary name first so readers never see a partial tile
+    std::string path = TilePath(cache_dir, key);
+    std::string tmp_path = path + ".tmp" + std::to_string(getpid()) + "_" + std::to_string(tile);
+    std::ofstream file(tmp_path, std::ios::binary);
+    for(int row = 0; row < h; ++row)
+        file.write((char *)&frame.image[((y0 + row) * frame.width + x0) * 3], w * 3 * sizeof(float));
+    file.close();
+
+    if(!file || rename(tmp_path.c_str(), path.c_str()) != 0) {
+        std::cerr << "Can't write tile cache entry " << path << std::endl;
+        remove(tmp_path.c_str());
+    }
+}
+
+// Renders every tile of the frame on num_threads workers. on_tile (if set) is
+// called from the worker that finished the tile; returning false abandons
+// the remaining tiles. Returns the number of tiles taken from the cache.
+int RenderFrame(Frame &frame, Scene &scene, int num_threads, const char *cache_dir,
+        std::function<bool(int)> on_tile = nullptr)
+{
+    // Tiles are handed out dynamically, but every pixel is written to a fixed
+    // slot, so the result is the same for any thread count or schedule
+    int tile_count = frame.TileCount();
+    std::atomic<int> next_tile{0};
+    std::atomic<int> cached_tiles{0};
+
+    std::vector<std::thread> workers;
+    for(int t = 0; t < num_threads; ++t) {
+        workers.push_back(std::thread([&]() {
+            int tile;
+            while((tile = next_tile++) < tile_count) {
+                uint64_t key = 0;
+                if(cache_dir)
+                    key = TileKey(tile, frame, scene);
+
+                if(cache_dir && LoadTile(tile, frame, cache_dir, key))
+                    ++cached_tiles;
+                else {
+                    RenderTile(tile, frame, scene);
+                    if(cache_dir)
+                        StoreTile(tile, frame, cache_dir, key);
+                }
+
+                if(on_tile && !on_tile(tile))
+                    next_tile = tile_count;
+            }
+        }));
+    }
+    for(int t = 0; t < num_threads; ++t)
+        workers[t].join();
+
+    return cached_tiles;
+}
+
+// Render server: scenes stay resident and jobs arrive over a Unix domain
+// socket, one request line per connection:
+//     RENDER <scene> [priority=P] [width=W] [height=H] [samples=S]
+//            [origin=X,Y,Z] [target=X,Y,Z] [fov=DEGREES] [aperture=A] [focus=F]
+// Tiles are streamed back as they finish, each as "TILE x0 y0 w h" followed by
+// w*h "r g b" lines, then "DONE <image hash>" (or "ERROR <reason>").
+class Job
+{
+    public:
+    int priority;
+    uint64_t sequence;
+    int client;
+    std::string scene_name;
+    // The image is only allocated once the job runs, so queued jobs are small
+    int width, height, samples;
+    Camera camera;
+
+    Job(int p, uint64_t seq, int fd, std::string name, int w, int h, int s, Camera c):priority(p), sequence(seq),
+        client(fd), scene_name(name), width(w), height(h), samples(s), camera(c) {}
+};
+
+// Highest priority first, FIFO among equal priorities
+class JobOrder
+{
+    public:
+    bool operator ()(std::shared_ptr<Job> &a, std::shared_ptr<Job> &b)
+    {
+        if(a->priority != b->priority)
+            return a->priority < b->priority;
+        return a->sequence > b->sequence;
+    }
+};
+
+class RenderServer
+{
+    public:
+    RenderServer(int threads, const char *cache):num_threads(threads), cache_dir(cache), next_sequence(0) {}
+
+    void AddScene(std::string name, Scene scene);
+    int Run(const char *socket_path);
+
+    private:
+    int num_threads;
+    const char *cache_dir;
+    std::map<std::string, Scene> scenes;
+
+    std::mutex queue_mutex;
+    std::condition_variable queue_cv;
+    std::priority_queue<std::shared_ptr<Job>, std::vector<std::shared_ptr<Job>>, JobOrder> queue;
+    uint64_t next_sequence;
+
+    void ReadRequest(int client);
+    void RunJobs();
+    void RunJob(Job &job);
+};
+
+bool SendAll(int fd, const std::string &data)
+{
+    size_t sent = 0;
+    while(sent < data.size()) {
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return false;
+        sent += n;
+    }
+    return true;
+}
+
+void RenderServer::AddScene(std::string name, Scene scene)
+{
+    scenes[name] = scene;
+}
+
+int RenderServer::Run(const char *socket_path)
+{
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(listener < 0) {
+        std::cerr << "Can't create socket : " << strerror(errno) << std::endl;
+        return 1;
+    }
+
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if(strlen(socket_path) >= sizeof(address.sun_path)) {
+        std::cerr << "Socket path too long : " << socket_path << std::endl;
+        return 1;
+    }
+    strcpy(address.sun_path, socket_path);
+    unlink(socket_path);
 
+    if(bind(listener, (sockaddr *)&address, sizeof(address)) < 0 || listen(listener, 16) < 0) {
+        std::cerr << "Can't listen on " << socket_path << " : " << strerror(errno) << std::endl;
+        close(listener);
+        return 1;
+    }
+    std::cerr << "Render server listening on " << socket_path << std::endl;
+
+    std::thread(&RenderServer::RunJobs, this).detach();
+
+    while(true) {
+        int client = accept(listener, nullptr, nullptr);
+        if(client < 0) {
+            if(errno == EINTR)
+                continue;
+            std::cerr << "accept failed : " << strerror(errno) << std::endl;
+            break;
+        }
+        // A client that never finishes its request line gives up its reader,
+        // and one that stops reading its tiles gives up its job
+        timeval timeout{REQUEST_TIMEOUT, 0};
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        timeval send_timeout{SEND_TIMEOUT, 0};
+        setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &send_timeout, sizeof(send_timeout));
+        std::thread(&RenderServer::ReadRequest, this, client).detach();
+    }
+
+    close(listener);
+    unlink(socket_path);
+    return 1;
+}
+
+// Parses one request line and queues it; the connection is handed to the job
+void RenderServer::ReadRequest(int client)
+{
+    std::string line;
+    char c = 0;
+    while(line.size() < 1024 && read(client, &c, 1) == 1 && c != '\n')
+        line += c;
+    // Only a whole line is a request; a timeout, EOF or over-long line is not
+    if(c != '\n') {
+        SendAll(client, "ERROR expected one request line\n");
+        close(client);
+        return;
+    }
+
+    std::istringstream request(line);
+    std::string command, scene_name, option;
+    request >> command >> scene_name;
+    if(command != "RENDER" || scenes.find(scene_name) == scenes.end()) {
+        SendAll(client, "ERROR expected RENDER <scene> with a known scene\n");
+        close(client);
+        return;
+    }
+
+    int priority = 0, width = C_W, height = C_H, samples = SAMPLES_PER_PIXEL;
+    float fov = CAMERA_FOV, aperture = APERTURE, focus = FOCUS_DISTANCE;
     Point origin{O_X, O_Y, O_Z};
+    Point target{NAN, NAN, NAN};
+    bool valid = true;
+    while(request >> option) {
+        if(!option.compare(0, 9, "priority="))
+            priority = atoi(option.c_str() + 9);
+        else if(!option.compare(0, 6, "width="))
+            width = atoi(option.c_str() + 6);
+        else if(!option.compare(0, 7, "height="))
+            height = atoi(option.c_str() + 7);
+        else if(!option.compare(0, 8, "samples="))
+            samples = atoi(option.c_str() + 8);
+        else if(!option.compare(0, 7, "origin=")) {
+            if(sscanf(option.c_str() + 7, "%f,%f,%f", &origin.x, &origin.y, &origin.z) != 3)
+                valid = false;
+        } else if(!option.compare(0, 7, "target=")) {
+            if(sscanf(option.c_str() + 7, "%f,%f,%f", &target.x, &target.y, &target.z) != 3)
+                valid = false;
+        } else if(!option.compare(0, 4, "fov="))
+            fov = atof(option.c_str() + 4);
+        else if(!option.compare(0, 9, "aperture="))
+            aperture = atof(option.c_str() + 9);
+        else if(!option.compare(0, 6, "focus="))
+            focus = atof(option.c_str() + 6);
+        else
+            valid = false;
+    }
+    // Without a target the camera keeps its default viewing direction
+    if(std::isnan(target.x))
+        target = Point{origin.x + LOOK_X - O_X, origin.y + LOOK_Y - O_Y, origin.z + LOOK_Z - O_Z};
+    Vector view = target - origin;
+    Vector up{0, 1, 0};
+    if(up.cross(view).norm() == 0 || fov < 0 || fov >= 180 || aperture < 0 || focus <= 0)
+        valid = false;
+
+    if(!valid || width <= 0 || height <= 0 || samples <= 0 || width > MAX_JOB_SIZE || height > MAX_JOB_SIZE) {
+        SendAll(client, "ERROR bad job option in : " + line + "\n");
+        close(client);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    queue.push(std::make_shared<Job>(priority, next_sequence++, client, scene_name, width, height, samples,
+                Camera(origin, target, up, fov, aperture, focus)));
+    queue_cv.notify_one();
+}
+
+void RenderServer::RunJobs()
+{
+    while(true) {
+        std::shared_ptr<Job> job;
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            queue_cv.wait(lock, [this]() { return !queue.empty(); });
+            job = queue.top();
+            queue.pop();
+        }
+        RunJob(*job);
+        close(job->client);
+    }
+}
 
-    for(int y = C_H/2 - 1; y >= -C_H/2; --y) {
-        for(int x = -C_W/2; x <= C_W/2 - 1; ++x) {
-            Point converted = Point{x, y, 0}.CanvasToViewport();
-            std::vector<float> color = TraceRay(origin, converted, 1, inf, sphere_list, light_sources);
+void RenderServer::RunJob(Job &job)
+{
+    Frame frame(job.width, job.height, job.samples, job.camera);
+
+    // Finished tiles queue up in outbox, and whichever worker finds nobody
+    // sending drains it, so a slow client never holds up the others, which
+    // keep rendering; client_mutex is never held during a send
+    std::mutex client_mutex;
+    std::deque<std::string> outbox;
+    bool sending = false, client_ok = true;
+
+    PROFILE_FRAME_BEGIN();
+    RenderFrame(frame, scenes.at(job.scene_name), num_threads, cache_dir, [&](int tile) {
+        PROFILE_STAGE(STAGE_OUTPUT);
+        int x0, y0, w, h;
+        frame.GetTile(tile, x0, y0, w, h);
+
+        std::ostringstream message;
+        message << "TILE " << x0 << " " << y0 << " " << w << " " << h << "\n";
+        for(int row = y0; row < y0 + h; ++row) {
+            for(int col = x0; col < x0 + w; ++col) {
+                float *pixel = &frame.image[(row * frame.width + col) * 3];
+                message << pixel[0] << " " << pixel[1] << " " << pixel[2] << "\n";
+            }
+        }
 
-            std::cout << color[0] << " " << color[1] << " " << color[2] << std::endl;
+        std::unique_lock<std::mutex> lock(client_mutex);
+        outbox.push_back(message.str());
+        if(sending)
+            return client_ok;
+        sending = true;
+        while(client_ok && !outbox.empty()) {
+            std::string data = std::move(outbox.front());
+            outbox.pop_front();
+            lock.unlock();
+            // A client that went away or stopped reading stops the rest of its job
+            bool sent = SendAll(job.client, data);
+            lock.lock();
+            client_ok = client_ok && sent;
         }
+        sending = false;
+        return client_ok;
+    });
+
+    if(client_ok) {
+        std::ostringstream done;
+        done << "DONE " << std::hex << std::setfill('0') << std::setw(16) << HashPixels(frame, 0, 0, frame.width, frame.height) << "\n";
+        SendAll(job.client, done.str());
     }
-}    
+    PROFILE_FRAME_END(frame.width, frame.height, frame.samples);
+}
+
+// Parses a whole non-negative decimal number; false for anything else
+bool ParseCount(const char *text, int &value)
+{
+    char *end;
+    errno = 0;
+    long parsed = strtol(text, &end, 10);
+    if(end == text || *end != '\0' || errno == ERANGE || parsed < 0 || parsed > INT_MAX)
+        return false;
+    value = parsed;
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    // -t <threads>  : worker thread count
+    // -c            : print per-tile and whole-image hashes instead of pixels
+    // -r <file>     : compare the image hash against a reference dump
+    // -k <dir>      : reuse tiles whose inputs are unchanged from a cache directory
+    // -s <socket>   : run as a render server on a Unix domain socket
+    int num_threads = NUM_THREADS;
+    bool checksum = false;
+    const char *reference = nullptr;
+    const char *cache_dir = nullptr;
+    const char *socket_path = nullptr;
+    for(int i = 1; i < argc; ++i) {
+        if(!strcmp(argv[i], "-t") && i + 1 < argc && ParseCount(argv[i + 1], num_threads))
+            ++i;
+        else if(!strcmp(argv[i], "-c"))
+            checksum = true;
+        else if(!strcmp(argv[i], "-r") && i + 1 < argc)
+            reference = argv[++i];
+        else if(!strcmp(argv[i], "-k") && i + 1 < argc)
+            cache_dir = argv[++i];
+        else if(!strcmp(argv[i], "-s") && i + 1 < argc)
+            socket_path = argv[++i];
+        else {
+            std::cerr << "Usage: " << argv[0] << " [-t threads] [-c] [-r reference] [-k cache_dir] [-s socket]" << std::endl;
+            return 1;
+        }
+    }
+    if(num_threads <= 0)
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+
+    if(cache_dir) {
+        std::error_code error;
+        std::filesystem::create_directories(cache_dir, error);
+        if(error) {
+            std::cerr << "Can't create tile cache " << cache_dir << " : " << error.message() << std::endl;
+            return 1;
+        }
+    }
+
+    // Create the scene
+    Scene scene = CreateDefaultScene();
+
+    if(socket_path) {
+        RenderServer server(num_threads, cache_dir);
+        server.AddScene("default", scene);
+        return server.Run(socket_path);
+    }
+
+    Camera camera(Point{O_X, O_Y, O_Z}, Point{LOOK_X, LOOK_Y, LOOK_Z}, Vector{0, 1, 0},
+            CAMERA_FOV, APERTURE, FOCUS_DISTANCE);
+    Frame frame(C_W, C_H, SAMPLES_PER_PIXEL, camera);
+    PROFILE_FRAME_BEGIN();
+    int cached_tiles = RenderFrame(frame, scene, num_threads, cache_dir);
+    if(cache_dir)
+        std::cerr << "Tile cache: " << cached_tiles << " reused, "
+                  << frame.TileCount() - cached_tiles << " traced" << std::endl;
+
+    if(!checksum && !reference) {
+        {
+            PROFILE_TRACE("output");
+            PROFILE_STAGE(STAGE_OUTPUT);
+            for(int i = 0; i < C_W * C_H; ++i)
+                std::cout << frame.image[i * 3] << " " << frame.image[i * 3 + 1] << " " << frame.image[i * 3 + 2] << "\n";
+            std::cout.flush();
+        }
+        PROFILE_FRAME_END(frame.width, frame.height, frame.samples);
+        return 0;
+    }
+    PROFILE_FRAME_END(frame.width, frame.height, frame.samples);
+
+    uint64_t image_hash = HashPixels(frame, 0, 0, C_W, C_H);
+    if(checksum) {
+        std::cout << std::hex << std::setfill('0');
+        int tiles_x = (C_W + TILE_SIZE - 1) / TILE_SIZE;
+        for(int tile = 0; tile < frame.TileCount(); ++tile) {
+            int x0, y0, w, h;
+            frame.GetTile(tile, x0, y0, w, h);
+            std::cout << "tile " << std::dec << tile % tiles_x << " " << tile / tiles_x << " "
+                      << std::hex << std::setw(16) << HashPixels(frame, x0, y0, w, h) << "\n";
+        }
+        std::cout << "image " << std::setw(16) << image_hash << std::endl;
+    }
+
+    if(reference) {
+        uint64_t reference_hash;
+        if(!HashReference(reference, frame, reference_hash))
+            return 1;
+        if(reference_hash != image_hash) {
+            std::cerr << "Image doesn't match reference " << reference << std::endl;
+            return 1;
+        }
+    }
+}
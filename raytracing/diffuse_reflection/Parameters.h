@@ -16,3 +16,29 @@
 #define BACKGROUND_R 255
 #define BACKGROUND_G 255
 #define BACKGROUND_B 255
+
+// Rendering parameters
+#define TILE_SIZE 32
+#define NUM_THREADS 0 // 0 = one thread per hardware thread
+#define SAMPLES_PER_PIXEL 1 // 1 = single sample at the pixel position, no jitter
+#define RNG_SEED 0
+
+// Bump when a change to the renderer invalidates tiles in existing caches
+#define TILE_CACHE_VERSION 1
+
+// Largest width/height accepted for a render server job
+#define MAX_JOB_SIZE 8192
+// Seconds a render server client has to send its request line
+#define REQUEST_TIMEOUT 10
+// Seconds one send to a render server client may block before the job is dropped
+#define SEND_TIMEOUT 10
+
+// Camera: looks from the origin towards LOOK_X/Y/Z. CAMERA_FOV is the vertical
+// field of view in degrees; 0 keeps the V_W x V_H viewport at V_D.
+// APERTURE > 0 enables thin-lens depth of field focused at FOCUS_DISTANCE.
+#define LOOK_X 0.0f
+#define LOOK_Y 0.0f
+#define LOOK_Z 1.0f
+#define CAMERA_FOV 0.0f
+#define APERTURE 0.0f
+#define FOCUS_DISTANCE 3.0f
@@ -0,0 +1,305 @@
+// Per-stage instrumentation, compiled in with -DPROFILE (make profile).
+//
+// Every render thread counts rays, intersection tests, hits and shading calls,
+// and times each stage it runs. Where perf_event_open is allowed, the stages
+// also read cycles, instructions and cache misses of the calling thread.
+// ProfileFrameEnd prints a per-frame summary to stderr and writes a Chrome
+// trace (chrome://tracing, Perfetto) to PROFILE_TRACE_FILE.
+
+#ifdef PROFILE
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define PROFILE_TRACE_FILE "trace.json"
+
+enum
+{
+    STAGE_RAY_GENERATION,
+    STAGE_INTERSECTION,
+    STAGE_SHADING,
+    STAGE_OUTPUT,
+    STAGE_COUNT
+};
+
+static const char *stage_names[STAGE_COUNT] = {"ray generation", "intersection", "shading", "output"};
+
+enum
+{
+    COUNTER_CYCLES,
+    COUNTER_INSTRUCTIONS,
+    COUNTER_CACHE_MISSES,
+    COUNTER_COUNT
+};
+
+class TraceEvent
+{
+    public:
+    std::string name;
+    uint64_t start_ns, duration_ns;
+    uint64_t stage_ns[STAGE_COUNT];
+};
+
+class ThreadProfile
+{
+    public:
+    int id;
+    uint64_t rays, intersection_tests, hits, shading_calls;
+    uint64_t stage_ns[STAGE_COUNT];
+    uint64_t stage_counters[STAGE_COUNT][COUNTER_COUNT];
+    // Group leader (cycles) and its two siblings; each is its own fd
+    int perf_fd, instructions_fd, cache_misses_fd;
+    std::vector<TraceEvent> events;
+
+    ThreadProfile(int i);
+    ~ThreadProfile();
+    bool ReadCounters(uint64_t *values);
+    void CloseCounters();
+};
+
+// All threads that took part in the current frame. A thread re-registers
+// when the frame generation changes, so worker threads of earlier frames
+// and the main thread never see a stale entry.
+static std::mutex profile_mutex;
+static std::vector<std::unique_ptr<ThreadProfile>> profiles;
+static int profile_generation = 0;
+static std::chrono::steady_clock::time_point frame_start;
+static thread_local ThreadProfile *thread_profile = nullptr;
+static thread_local int thread_generation = -1;
+
+static uint64_t ProfileNow()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - frame_start).count();
+}
+
+static int OpenCounter(uint64_t config, int group_fd)
+{
+    perf_event_attr attr{};
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.disabled = group_fd < 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+ThreadProfile::ThreadProfile(int i):id(i), rays(0), intersection_tests(0), hits(0), shading_calls(0),
+    stage_ns{}, stage_counters{}, instructions_fd(-1), cache_misses_fd(-1)
+{
+    // One group per thread so a single read() returns all three counters
+    perf_fd = OpenCounter(PERF_COUNT_HW_CPU_CYCLES, -1);
+    if(perf_fd < 0)
+        return;
+
+    instructions_fd = OpenCounter(PERF_COUNT_HW_INSTRUCTIONS, perf_fd);
+    cache_misses_fd = OpenCounter(PERF_COUNT_HW_CACHE_MISSES, perf_fd);
+    if(instructions_fd < 0 || cache_misses_fd < 0) {
+        CloseCounters();
+        return;
+    }
+    ioctl(perf_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+ThreadProfile::~ThreadProfile()
+{
+    CloseCounters();
+}
+
+void ThreadProfile::CloseCounters()
+{
+    int *fds[] = {&cache_misses_fd, &instructions_fd, &perf_fd};
+    for(int i = 0; i < 3; ++i) {
+        if(*fds[i] >= 0)
+            close(*fds[i]);
+        *fds[i] = -1;
+    }
+}
+
+bool ThreadProfile::ReadCounters(uint64_t *values)
+{
+    uint64_t group[1 + COUNTER_COUNT];
+    if(perf_fd < 0 || read(perf_fd, group, sizeof(group)) != sizeof(group))
+        return false;
+
+    for(int c = 0; c < COUNTER_COUNT; ++c)
+        values[c] = group[1 + c];
+    return true;
+}
+
+static ThreadProfile &GetThreadProfile()
+{
+    if(thread_generation != profile_generation || !thread_profile) {
+        std::lock_guard<std::mutex> lock(profile_mutex);
+        profiles.push_back(std::unique_ptr<ThreadProfile>(new ThreadProfile(profiles.size())));
+        thread_profile = profiles.back().get();
+        thread_generation = profile_generation;
+    }
+    return *thread_profile;
+}
+
+// Adds the time and counter deltas of its lifetime to one stage
+class StageScope
+{
+    public:
+    StageScope(int s):stage(s), profile(GetThreadProfile())
+    {
+        has_counters = profile.ReadCounters(start_counters);
+        start_ns = ProfileNow();
+    }
+
+    ~StageScope()
+    {
+        profile.stage_ns[stage] += ProfileNow() - start_ns;
+
+        uint64_t end_counters[COUNTER_COUNT];
+        if(has_counters && profile.ReadCounters(end_counters)) {
+            for(int c = 0; c < COUNTER_COUNT; ++c)
+                profile.stage_counters[stage][c] += end_counters[c] - start_counters[c];
+        }
+    }
+
+    private:
+    int stage;
+    ThreadProfile &profile;
+    bool has_counters;
+    uint64_t start_ns;
+    uint64_t start_counters[COUNTER_COUNT];
+};
+
+// Records one Chrome trace event spanning its lifetime, with the time each
+// stage took inside it
+class TraceScope
+{
+    public:
+    TraceScope(std::string name):profile(GetThreadProfile())
+    {
+        event.name = name;
+        event.start_ns = ProfileNow();
+        std::copy(profile.stage_ns, profile.stage_ns + STAGE_COUNT, event.stage_ns);
+    }
+
+    ~TraceScope()
+    {
+        event.duration_ns = ProfileNow() - event.start_ns;
+        for(int s = 0; s < STAGE_COUNT; ++s)
+            event.stage_ns[s] = profile.stage_ns[s] - event.stage_ns[s];
+        profile.events.push_back(event);
+    }
+
+    private:
+    ThreadProfile &profile;
+    TraceEvent event;
+};
+
+static void ProfileFrameBegin()
+{
+    std::lock_guard<std::mutex> lock(profile_mutex);
+    profiles.clear();
+    ++profile_generation;
+    frame_start = std::chrono::steady_clock::now();
+}
+
+static void WriteChromeTrace(const char *path)
+{
+    std::ofstream trace(path);
+    if(!trace.is_open()) {
+        std::cerr << "Can't write trace " << path << std::endl;
+        return;
+    }
+
+    trace << std::fixed << std::setprecision(3);
+    trace << "{\"traceEvents\":[\n";
+    bool first = true;
+    for(int t = 0; t < profiles.size(); ++t) {
+        for(int e = 0; e < profiles[t]->events.size(); ++e) {
+            TraceEvent &event = profiles[t]->events[e];
+            trace << (first ? "" : ",\n") << "{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << t
+                  << ",\"ts\":" << event.start_ns / 1000.0 << ",\"dur\":" << event.duration_ns / 1000.0 << ",\"args\":{";
+            for(int s = 0; s < STAGE_COUNT; ++s)
+                trace << (s ? "," : "") << "\"" << stage_names[s] << " (us)\":" << event.stage_ns[s] / 1000.0;
+            trace << "}}";
+            first = false;
+        }
+    }
+    trace << "\n]}\n";
+}
+
+static void ProfileFrameEnd(int width, int height, int samples)
+{
+    std::lock_guard<std::mutex> lock(profile_mutex);
+    uint64_t frame_ns = ProfileNow();
+
+    uint64_t rays = 0, intersection_tests = 0, hits = 0, shading_calls = 0;
+    uint64_t stage_ns[STAGE_COUNT] = {}, stage_counters[STAGE_COUNT][COUNTER_COUNT] = {};
+    bool has_counters = false;
+    for(int t = 0; t < profiles.size(); ++t) {
+        ThreadProfile &profile = *profiles[t];
+        rays += profile.rays;
+        intersection_tests += profile.intersection_tests;
+        hits += profile.hits;
+        shading_calls += profile.shading_calls;
+        has_counters |= profile.perf_fd >= 0;
+        for(int s = 0; s < STAGE_COUNT; ++s) {
+            stage_ns[s] += profile.stage_ns[s];
+            for(int c = 0; c < COUNTER_COUNT; ++c)
+                stage_counters[s][c] += profile.stage_counters[s][c];
+        }
+    }
+
+    fprintf(stderr, "Frame %dx%d, %d spp, %zu threads, %.2f ms wall\n", width, height, samples, profiles.size(), frame_ns / 1e6);
+    fprintf(stderr, "  %-16s %12s %14s %14s %14s\n", "stage", "thread ms", "cycles", "instructions", "cache misses");
+    for(int s = 0; s < STAGE_COUNT; ++s) {
+        if(has_counters)
+            fprintf(stderr, "  %-16s %12.2f %14llu %14llu %14llu\n", stage_names[s], stage_ns[s] / 1e6,
+                    (unsigned long long)stage_counters[s][COUNTER_CYCLES],
+                    (unsigned long long)stage_counters[s][COUNTER_INSTRUCTIONS],
+                    (unsigned long long)stage_counters[s][COUNTER_CACHE_MISSES]);
+        else
+            fprintf(stderr, "  %-16s %12.2f %14s %14s %14s\n", stage_names[s], stage_ns[s] / 1e6, "-", "-", "-");
+    }
+    fprintf(stderr, "  rays %llu, intersection tests %llu, hits %llu, shading calls %llu\n",
+            (unsigned long long)rays, (unsigned long long)intersection_tests,
+            (unsigned long long)hits, (unsigned long long)shading_calls);
+    for(int t = 0; t < profiles.size(); ++t) {
+        ThreadProfile &profile = *profiles[t];
+        fprintf(stderr, "  thread %d: rays %llu, intersection tests %llu, hits %llu, shading calls %llu\n", t,
+                (unsigned long long)profile.rays, (unsigned long long)profile.intersection_tests,
+                (unsigned long long)profile.hits, (unsigned long long)profile.shading_calls);
+    }
+    if(!has_counters)
+        fprintf(stderr, "  hardware counters unavailable (perf_event_open denied or unsupported)\n");
+
+    WriteChromeTrace(PROFILE_TRACE_FILE);
+    fprintf(stderr, "  trace written to %s\n", PROFILE_TRACE_FILE);
+}
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_STAGE(stage) StageScope PROFILE_CONCAT(stage_scope_, __LINE__)(stage)
+#define PROFILE_TRACE(name) TraceScope PROFILE_CONCAT(trace_scope_, __LINE__)(name)
+#define PROFILE_COUNT(counter, n) (GetThreadProfile().counter += (n))
+#define PROFILE_FRAME_BEGIN() ProfileFrameBegin()
+#define PROFILE_FRAME_END(width, height, samples) ProfileFrameEnd(width, height, samples)
+
+#else
+
+#define PROFILE_STAGE(stage)
+#define PROFILE_TRACE(name)
+#define PROFILE_COUNT(counter, n)
+#define PROFILE_FRAME_BEGIN()
+#define PROFILE_FRAME_END(width, height, samples)
+
+#endif